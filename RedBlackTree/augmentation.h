@@ -0,0 +1,71 @@
+#pragma once
+
+//Augmentations describe a value aggregated over every subtree of a RedBlackTree.
+//The tree keeps the aggregate of each node equal to
+//  combine( combine( aggregate( left ), make( value ) ), aggregate( right ) )
+//through insertion, erasure and rotations, so combine must be associative
+//and identity() must be its neutral element (the aggregate of an empty subtree).
+//
+//An augmentation is a type with
+//  value_type                                   the aggregate
+//  static value_type make( const T& value )     aggregate of a single element
+//  static value_type combine( left, right )     aggregate of two adjacent ranges, left before right
+//  static value_type identity()
+//e.g. the sum of mapped values gives RedBlackTree::reduce the total volume of a price range of an order book.
+
+//Default: nodes carry no extra data
+struct NoAugmentation
+{
+    using value_type = void;
+};
+
+//Number of nodes in every subtree. Enables nth, rank and count_between.
+struct SubtreeSize
+{
+    using value_type = std::size_t;
+
+    template<typename T>
+    static value_type make( const T& )
+    {
+        return 1;
+    }
+
+    static value_type combine( value_type left, value_type right )
+    {
+        return left + right;
+    }
+
+    static value_type identity()
+    {
+        return 0;
+    }
+
+    static std::size_t size( value_type aggregate )
+    {
+        return aggregate;
+    }
+};
+
+//Augmentations which know the number of nodes in a subtree
+template<typename Augmentation, typename = void>
+struct HasSubtreeSize : std::false_type
+{
+};
+
+template<typename Augmentation>
+struct HasSubtreeSize<Augmentation, std::void_t<
+    decltype( Augmentation::size( std::declval<const typename Augmentation::value_type&>() ) )>> : std::true_type
+{
+};
+
+//Storage for the aggregate inside Node; takes no space without augmentation
+template<typename Augmentation>
+struct NodeAggregate
+{
+    typename Augmentation::value_type aggregate;
+};
+
+template<>
+struct NodeAggregate<NoAugmentation>
+{
+};
@@ -0,0 +1,373 @@
+#pragma once
+
+#include <optional>
+#include <shared_mutex>
+#include "map.h"
+
+//Map for many threads, partitioned by key range into shards that are independent Maps with a lock each.
+//Writers to different shards run in parallel, readers of one shard share its lock, and the shards stay
+//ordered, so ordered scans walk them one after the other.
+//
+//A shard growing past maxShardSize is split at its median key; a shard shrinking below a quarter of it
+//is joined with a neighbour when they fit together. Both take O(log n) on the trees (Map::split, Map::join)
+//under an exclusive lock of the routing table, which every other call holds shared. Boundaries given to
+//the constructor are kept, and a shard which found no neighbour to join is not tried again until the next
+//split or join, so small shards do not take the exclusive lock on every write.
+//Split shards share the allocator, which must therefore be thread safe.
+//
+//Values are returned by copy and visitors run under a shard lock: they must not call back into the map.
+template<typename KeyType, typename ValueType, typename Less = std::less<const KeyType>,
+    typename Allocator = std::allocator<std::pair<const KeyType, ValueType>>>
+class ConcurrentMap
+{
+public:
+    using key_type = KeyType;
+    using mapped_type = ValueType;
+    using value_type = std::pair<const KeyType, ValueType>;
+    using size_type = std::size_t;
+    using map_type = Map<KeyType, ValueType, Less, Allocator>;
+
+    static constexpr std::size_t defaultMaxShardSize = 1 << 16;
+
+public:
+    explicit ConcurrentMap( std::size_t maxShardSize = defaultMaxShardSize, const Allocator& allocator = Allocator() );
+
+    //Starts with a shard per range between sorted boundaries
+    ConcurrentMap( const std::vector<KeyType>& boundaries, std::size_t maxShardSize = defaultMaxShardSize,
+        const Allocator& allocator = Allocator() );
+
+    ConcurrentMap( const ConcurrentMap& ) = delete;
+    ConcurrentMap& operator=( const ConcurrentMap& ) = delete;
+
+    //false if the key is present already
+    bool insert( const KeyType& key, const ValueType& value );
+    //true if the key was inserted, false if its value was replaced
+    bool insert_or_assign( const KeyType& key, const ValueType& value );
+    size_type erase( const KeyType& key );
+
+    //Calls modify( value ) on the value of key under the shard's lock; false if the key is absent
+    template<typename Modifier>
+    bool modify( const KeyType& key, Modifier modify );
+
+    std::optional<ValueType> find( const KeyType& key ) const;
+    bool contains( const KeyType& key ) const;
+
+    size_type size() const;
+    bool empty() const;
+    std::size_t shard_count() const;
+
+    //Calls visit( pair ) for every entry in key order. Every shard is consistent in itself;
+    //writes to shards not yet visited may show up.
+    template<typename Visitor>
+    void for_each( Visitor visit ) const;
+
+    //Same for the keys in [low, high)
+    template<typename Visitor>
+    void for_each_in_range( const KeyType& low, const KeyType& high, Visitor visit ) const;
+
+private:
+    struct Shard
+    {
+        Shard( map_type&& map, bool mergeBlocked );
+
+        mutable std::shared_mutex mutex;
+        map_type map;
+        //set when a join was impossible, cleared on the next split or join; changed under the exclusive routing lock
+        bool mergeBlocked;
+    };
+
+    std::size_t shardIndex_( const KeyType& key ) const;
+    bool isUnbalanced_( const Shard& shard ) const;
+
+    template<typename Write>
+    auto write_( const KeyType& key, Write write );
+    void rebalance_( const KeyType& key );
+
+private:
+    Less m_less;
+    std::size_t m_maxShardSize;
+
+    mutable std::shared_mutex m_routing;
+    //m_boundaries[i] is the smallest key of m_shards[i + 1]
+    std::vector<KeyType> m_boundaries;
+    //whether m_boundaries[i] was given to the constructor; shards are never joined across it
+    std::vector<bool> m_preset;
+    std::vector<std::unique_ptr<Shard>> m_shards;
+};
+
+
+template<typename KeyType, typename ValueType, typename Less, typename Allocator>
+inline ConcurrentMap<KeyType, ValueType, Less, Allocator>::ConcurrentMap( std::size_t maxShardSize, const Allocator& allocator )
+    : ConcurrentMap( std::vector<KeyType>(), maxShardSize, allocator )
+{
+}
+
+template<typename KeyType, typename ValueType, typename Less, typename Allocator>
+inline ConcurrentMap<KeyType, ValueType, Less, Allocator>::ConcurrentMap( const std::vector<KeyType>& boundaries, std::size_t maxShardSize,
+    const Allocator& allocator )
+    : m_less{}
+    , m_maxShardSize{ std::max<std::size_t>( maxShardSize, 4 ) }
+    , m_routing()
+    , m_boundaries( boundaries )
+    , m_preset( boundaries.size(), true )
+    , m_shards()
+{
+    if ( !std::is_sorted( m_boundaries.begin(), m_boundaries.end(), m_less ) ||
+        std::adjacent_find( m_boundaries.begin(), m_boundaries.end(), [this]( const KeyType& left, const KeyType& right )
+        {
+            return !m_less( left, right );
+        } ) != m_boundaries.end() )
+    {
+        throw std::invalid_argument( "Shard boundaries must be strictly increasing" );
+    }
+
+    //shards between preset boundaries have nothing to join
+    for ( std::size_t i = 0; i <= m_boundaries.size(); ++i )
+    {
+        m_shards.push_back( std::make_unique<Shard>( map_type( allocator ), true ) );
+    }
+}
+
+template<typename KeyType, typename ValueType, typename Less, typename Allocator>
+inline bool ConcurrentMap<KeyType, ValueType, Less, Allocator>::insert( const KeyType& key, const ValueType& value )
+{
+    return write_( key, [&key, &value]( map_type& map )
+    {
+        return map.try_emplace( key, value ).second;
+    } );
+}
+
+template<typename KeyType, typename ValueType, typename Less, typename Allocator>
+inline bool ConcurrentMap<KeyType, ValueType, Less, Allocator>::insert_or_assign( const KeyType& key, const ValueType& value )
+{
+    return write_( key, [&key, &value]( map_type& map )
+    {
+        return map.insert_or_assign( key, value ).second;
+    } );
+}
+
+template<typename KeyType, typename ValueType, typename Less, typename Allocator>
+inline typename ConcurrentMap<KeyType, ValueType, Less, Allocator>::size_type ConcurrentMap<KeyType, ValueType, Less, Allocator>::erase( const KeyType& key )
+{
+    return write_( key, [&key]( map_type& map ) -> size_type
+    {
+        const auto it = map.find( key );
+        if ( it == map.end() )
+        {
+            return 0;
+        }
+        map.erase( it );
+        return 1;
+    } );
+}
+
+template<typename KeyType, typename ValueType, typename Less, typename Allocator>
+template<typename Modifier>
+inline bool ConcurrentMap<KeyType, ValueType, Less, Allocator>::modify( const KeyType& key, Modifier modify )
+{
+    return write_( key, [&key, &modify]( map_type& map )
+    {
+        auto it = map.find( key );
+        if ( it == map.end() )
+        {
+            return false;
+        }
+        modify( it->second );
+        return true;
+    } );
+}
+
+template<typename KeyType, typename ValueType, typename Less, typename Allocator>
+inline std::optional<ValueType> ConcurrentMap<KeyType, ValueType, Less, Allocator>::find( const KeyType& key ) const
+{
+    std::shared_lock routing( m_routing );
+    const auto& shard = *m_shards[shardIndex_( key )];
+    std::shared_lock lock( shard.mutex );
+
+    const auto it = shard.map.find( key );
+    if ( it == shard.map.end() )
+    {
+        return std::nullopt;
+    }
+    return it->second;
+}
+
+template<typename KeyType, typename ValueType, typename Less, typename Allocator>
+inline bool ConcurrentMap<KeyType, ValueType, Less, Allocator>::contains( const KeyType& key ) const
+{
+    std::shared_lock routing( m_routing );
+    const auto& shard = *m_shards[shardIndex_( key )];
+    std::shared_lock lock( shard.mutex );
+
+    return shard.map.contains( key );
+}
+
+template<typename KeyType, typename ValueType, typename Less, typename Allocator>
+inline typename ConcurrentMap<KeyType, ValueType, Less, Allocator>::size_type ConcurrentMap<KeyType, ValueType, Less, Allocator>::size() const
+{
+    std::shared_lock routing( m_routing );
+
+    size_type size = 0;
+    for ( const auto& shard : m_shards )
+    {
+        std::shared_lock lock( shard->mutex );
+        size += shard->map.size();
+    }
+
+    return size;
+}
+
+template<typename KeyType, typename ValueType, typename Less, typename Allocator>
+inline bool ConcurrentMap<KeyType, ValueType, Less, Allocator>::empty() const
+{
+    return size() == 0;
+}
+
+template<typename KeyType, typename ValueType, typename Less, typename Allocator>
+inline std::size_t ConcurrentMap<KeyType, ValueType, Less, Allocator>::shard_count() const
+{
+    std::shared_lock routing( m_routing );
+    return m_shards.size();
+}
+
+template<typename KeyType, typename ValueType, typename Less, typename Allocator>
+template<typename Visitor>
+inline void ConcurrentMap<KeyType, ValueType, Less, Allocator>::for_each( Visitor visit ) const
+{
+    std::shared_lock routing( m_routing );
+    for ( const auto& shard : m_shards )
+    {
+        std::shared_lock lock( shard->mutex );
+        for ( const auto& entry : shard->map )
+        {
+            visit( entry );
+        }
+    }
+}
+
+template<typename KeyType, typename ValueType, typename Less, typename Allocator>
+template<typename Visitor>
+inline void ConcurrentMap<KeyType, ValueType, Less, Allocator>::for_each_in_range( const KeyType& low, const KeyType& high, Visitor visit ) const
+{
+    if ( !m_less( low, high ) )
+    {
+        return;
+    }
+
+    std::shared_lock routing( m_routing );
+    const auto last = shardIndex_( high );
+    for ( auto index = shardIndex_( low ); index <= last; ++index )
+    {
+        const auto& shard = *m_shards[index];
+        std::shared_lock lock( shard.mutex );
+
+        const auto end = shard.map.lower_bound( high );
+        for ( auto it = shard.map.lower_bound( low ); it != end; ++it )
+        {
+            visit( *it );
+        }
+    }
+}
+
+template<typename KeyType, typename ValueType, typename Less, typename Allocator>
+inline ConcurrentMap<KeyType, ValueType, Less, Allocator>::Shard::Shard( map_type&& map, bool mergeBlocked )
+    : mutex()
+    , map( std::move( map ) )
+    , mergeBlocked{ mergeBlocked }
+{
+}
+
+template<typename KeyType, typename ValueType, typename Less, typename Allocator>
+inline std::size_t ConcurrentMap<KeyType, ValueType, Less, Allocator>::shardIndex_( const KeyType& key ) const
+{
+    return static_cast<std::size_t>( std::upper_bound( m_boundaries.begin(), m_boundaries.end(), key, m_less ) - m_boundaries.begin() );
+}
+
+template<typename KeyType, typename ValueType, typename Less, typename Allocator>
+inline bool ConcurrentMap<KeyType, ValueType, Less, Allocator>::isUnbalanced_( const Shard& shard ) const
+{
+    const auto size = shard.map.size();
+    return size > m_maxShardSize || ( size < m_maxShardSize / 4 && !shard.mergeBlocked && m_shards.size() > 1 );
+}
+
+template<typename KeyType, typename ValueType, typename Less, typename Allocator>
+template<typename Write>
+inline auto ConcurrentMap<KeyType, ValueType, Less, Allocator>::write_( const KeyType& key, Write write )
+{
+    bool unbalanced = false;
+    std::optional<decltype( write( std::declval<map_type&>() ) )> result;
+    {
+        std::shared_lock routing( m_routing );
+        auto& shard = *m_shards[shardIndex_( key )];
+        std::unique_lock lock( shard.mutex );
+
+        result.emplace( write( shard.map ) );
+        unbalanced = isUnbalanced_( shard );
+    }
+
+    if ( unbalanced )
+    {
+        rebalance_( key );
+    }
+
+    return std::move( *result );
+}
+
+template<typename KeyType, typename ValueType, typename Less, typename Allocator>
+inline void ConcurrentMap<KeyType, ValueType, Less, Allocator>::rebalance_( const KeyType& key )
+{
+    //Every other call holds the routing lock shared while it uses a shard, so no shard lock is needed here.
+    //Another writer may have rebalanced meanwhile: sizes are checked again.
+    std::unique_lock routing( m_routing );
+    const auto index = shardIndex_( key );
+    auto& shard = *m_shards[index];
+    if ( !isUnbalanced_( shard ) )
+    {
+        return;
+    }
+
+    const auto unblock = [this]()
+    {
+        for ( auto& other : m_shards )
+        {
+            other->mergeBlocked = false;
+        }
+    };
+
+    if ( shard.map.size() > m_maxShardSize )
+    {
+        const auto median = std::next( shard.map.begin(), static_cast<std::ptrdiff_t>( shard.map.size() / 2 ) )->first;
+        auto upper = shard.map.split( median );
+
+        m_shards.insert( m_shards.begin() + index + 1, std::make_unique<Shard>( std::move( upper ), false ) );
+        m_boundaries.insert( m_boundaries.begin() + index, median );
+        m_preset.insert( m_preset.begin() + index, false );
+        unblock();
+        return;
+    }
+
+    //joined with the smaller neighbour not behind a preset boundary, if the result does not need a split again soon
+    const bool withPrevious = index > 0 && !m_preset[index - 1];
+    const bool withNext = index + 1 < m_shards.size() && !m_preset[index];
+    if ( !withPrevious && !withNext )
+    {
+        shard.mergeBlocked = true;
+        return;
+    }
+
+    const std::size_t left = !withPrevious ||
+        ( withNext && m_shards[index + 1]->map.size() < m_shards[index - 1]->map.size() ) ? index : index - 1;
+    auto& lower = m_shards[left]->map;
+    auto& higher = m_shards[left + 1]->map;
+    if ( lower.size() + higher.size() > m_maxShardSize / 2 )
+    {
+        shard.mergeBlocked = true;
+        return;
+    }
+
+    lower = map_type::join( std::move( lower ), std::move( higher ) );
+    m_shards.erase( m_shards.begin() + left + 1 );
+    m_boundaries.erase( m_boundaries.begin() + left );
+    m_preset.erase( m_preset.begin() + left );
+    unblock();
+}
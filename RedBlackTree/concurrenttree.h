@@ -0,0 +1,590 @@
+#pragma once
+
+#include <atomic>
+#include <optional>
+#include <shared_mutex>
+#include "redblacktree.h"
+
+template<typename T>
+struct LockingNode;
+
+//Links and lock of a LockingNode; the head of a ConcurrentRedBlackTree is only this, its right child is the root.
+//The links of a node are guarded by its own lock, its color by the lock of its parent.
+template<typename T>
+struct LockingLinks
+{
+public:
+    LockingLinks();
+
+    Color color() const;
+    void setColor( Color color );
+
+    LockingNode<T>*& child( bool right );
+
+public:
+    LockingNode<T>* left;
+    LockingNode<T>* right;
+
+    mutable std::shared_mutex mutex;
+
+private:
+    Color m_color;
+};
+
+//Node of a ConcurrentRedBlackTree. Nodes have no parent link, so rebalancing never reaches above the nodes locked.
+template<typename T>
+struct LockingNode : LockingLinks<T>
+{
+public:
+    template<typename... Args>
+    explicit LockingNode( std::in_place_t, Args&&... args );
+
+public:
+    T value;
+};
+
+//Sorted set for any number of threads writing and reading at once, with a lock in every node.
+//insert and erase rebalance top-down in a single pass: color flips and rotations are done on the way down,
+//so a writer only changes a window of a few nodes around its position and locks them hand over hand,
+//releasing the nodes above the window as it descends. Writers in disjoint subtrees run in parallel,
+//and lookups lock one node at a time, shared.
+//
+//Locks cannot deadlock: a node is only locked while its current parent is held, and links change only under
+//the locks of every node they connect, so a thread only ever waits for a node below one it holds.
+//Rotations do put nodes locked earlier below nodes locked later, so lock-order checkers such as
+//ThreadSanitizer's report inversions that cannot form a cycle here.
+//
+//Every step keeps the tree balanced, so other threads never see it broken. Erase moves the value of the
+//removed node's in-order neighbour into the node holding the erased value, so T must be move assignable.
+//Less must not throw, and nodes are allocated from many threads, so the allocator must be thread safe.
+//clear and destruction must not overlap any other call.
+template<typename T, typename Less = std::less<T>, typename Allocator = std::allocator<T>>
+class ConcurrentRedBlackTree
+{
+private:
+    using LinksType = LockingLinks<T>;
+    using NodeType = LockingNode<T>;
+    using NodeAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<NodeType>;
+    using NodeAllocatorTraits = std::allocator_traits<NodeAllocator>;
+
+public:
+    friend class RedBlackTreeTest;
+
+    using value_type = T;
+    using allocator_type = Allocator;
+    using size_type = std::size_t;
+
+public:
+    ConcurrentRedBlackTree();
+    explicit ConcurrentRedBlackTree( const Allocator& allocator );
+    ~ConcurrentRedBlackTree();
+
+    ConcurrentRedBlackTree( const ConcurrentRedBlackTree& ) = delete;
+    ConcurrentRedBlackTree& operator=( const ConcurrentRedBlackTree& ) = delete;
+
+    allocator_type get_allocator() const;
+
+    //false if an equal value is present already
+    bool insert( const T& value );
+    bool insert( T&& value );
+
+    template<typename... Args>
+    bool emplace( Args&&... args );
+
+    bool erase( const T& value );
+
+    void clear();
+
+    //the value is returned by copy, it may be erased as soon as its node is unlocked
+    std::optional<T> find( const T& value ) const;
+    bool contains( const T& value ) const;
+
+    size_type size() const;
+    bool empty() const;
+
+private:
+    template<typename... Args>
+    NodeType* createNode_( Args&&... args );
+    void destroyNode_( NodeType* node );
+    void destroySubtree_( NodeType* node );
+
+    bool insertNode_( NodeType* node );
+
+    template<typename Found>
+    bool lookup_( const T& value, Found found ) const;
+
+    static bool isRed_( const LinksType* links );
+    static void unlock_( LinksType* links, const NodeType* kept );
+
+    //the child of node opposite to right takes its place, node goes down on the right side if right is set
+    static NodeType* rotate_( NodeType* node, bool right );
+    static NodeType* rotateTwice_( NodeType* node, bool right );
+
+private:
+    Less m_less;
+    NodeAllocator m_nodeAllocator;
+    LinksType m_head;
+    std::atomic<std::size_t> m_size;
+};
+
+
+template<typename T>
+inline LockingLinks<T>::LockingLinks()
+    : left{ nullptr }
+    , right{ nullptr }
+    , mutex()
+    , m_color{ Color::Black }
+{
+}
+
+template<typename T>
+inline Color LockingLinks<T>::color() const
+{
+    return m_color;
+}
+
+template<typename T>
+inline void LockingLinks<T>::setColor( Color color )
+{
+    m_color = color;
+}
+
+template<typename T>
+inline LockingNode<T>*& LockingLinks<T>::child( bool right )
+{
+    return right ? this->right : left;
+}
+
+template<typename T>
+template<typename... Args>
+inline LockingNode<T>::LockingNode( std::in_place_t, Args&&... args )
+    : LockingLinks<T>()
+    , value( std::forward<Args>( args )... )
+{
+    this->setColor( Color::Red );
+}
+
+template<typename T, typename Less, typename Allocator>
+inline ConcurrentRedBlackTree<T, Less, Allocator>::ConcurrentRedBlackTree()
+    : ConcurrentRedBlackTree( Allocator() )
+{
+}
+
+template<typename T, typename Less, typename Allocator>
+inline ConcurrentRedBlackTree<T, Less, Allocator>::ConcurrentRedBlackTree( const Allocator& allocator )
+    : m_less{}
+    , m_nodeAllocator{ allocator }
+    , m_head()
+    , m_size{ 0 }
+{
+}
+
+template<typename T, typename Less, typename Allocator>
+inline ConcurrentRedBlackTree<T, Less, Allocator>::~ConcurrentRedBlackTree()
+{
+    clear();
+}
+
+template<typename T, typename Less, typename Allocator>
+inline typename ConcurrentRedBlackTree<T, Less, Allocator>::allocator_type ConcurrentRedBlackTree<T, Less, Allocator>::get_allocator() const
+{
+    return allocator_type( m_nodeAllocator );
+}
+
+template<typename T, typename Less, typename Allocator>
+inline bool ConcurrentRedBlackTree<T, Less, Allocator>::insert( const T& value )
+{
+    return emplace( value );
+}
+
+template<typename T, typename Less, typename Allocator>
+inline bool ConcurrentRedBlackTree<T, Less, Allocator>::insert( T&& value )
+{
+    return emplace( std::move( value ) );
+}
+
+template<typename T, typename Less, typename Allocator>
+template<typename... Args>
+inline bool ConcurrentRedBlackTree<T, Less, Allocator>::emplace( Args&&... args )
+{
+    //allocated before any lock is taken, and freed again if the value is present
+    return insertNode_( createNode_( std::in_place, std::forward<Args>( args )... ) );
+}
+
+template<typename T, typename Less, typename Allocator>
+inline bool ConcurrentRedBlackTree<T, Less, Allocator>::erase( const T& value )
+{
+    //window locked exclusively: current, its parent and grandparent, and the node holding value once found
+    LinksType* grand = nullptr;
+    LinksType* parent = nullptr;
+    LinksType* current = &m_head;
+    NodeType* found = nullptr;
+    bool right = true;
+
+    m_head.mutex.lock();
+    while ( current->child( right ) != nullptr )
+    {
+        const bool last = right;
+        unlock_( grand, found );
+        grand = parent;
+        parent = current;
+
+        const auto node = current->child( right );
+        node->mutex.lock();
+        current = node;
+
+        //after the value is found the descent goes on to its predecessor, which is the node removed
+        right = m_less( node->value, value );
+        if ( !right && !m_less( value, node->value ) )
+        {
+            found = node;
+        }
+
+        //a red node is pushed down along the path, so that the node finally removed is red
+        if ( isRed_( node ) || isRed_( node->child( right ) ) )
+        {
+            continue;
+        }
+
+        if ( isRed_( node->child( !right ) ) )
+        {
+            const auto red = node->child( !right );
+            red->mutex.lock();
+            parent->child( last ) = rotate_( node, right );
+
+            unlock_( grand, found );
+            grand = parent;
+            parent = red;
+            continue;
+        }
+
+        //only the root has no sibling
+        const auto sibling = parent->child( !last );
+        if ( sibling == nullptr )
+        {
+            continue;
+        }
+
+        sibling->mutex.lock();
+        if ( !isRed_( sibling->left ) && !isRed_( sibling->right ) )
+        {
+            parent->setColor( Color::Black );
+            sibling->setColor( Color::Red );
+            node->setColor( Color::Red );
+            sibling->mutex.unlock();
+            continue;
+        }
+
+        const auto parentNode = static_cast<NodeType*>( parent );
+        const bool parentRight = grand->right == parentNode;
+        NodeType* top = sibling;
+        if ( isRed_( sibling->child( last ) ) )
+        {
+            top = sibling->child( last );
+            top->mutex.lock();
+            grand->child( parentRight ) = rotateTwice_( parentNode, last );
+            sibling->mutex.unlock();
+        }
+        else
+        {
+            grand->child( parentRight ) = rotate_( parentNode, last );
+        }
+
+        node->setColor( Color::Red );
+        top->setColor( grand == &m_head ? Color::Black : Color::Red );
+        top->left->setColor( Color::Black );
+        top->right->setColor( Color::Black );
+
+        //top went in between grand and parent
+        unlock_( grand, found );
+        grand = top;
+    }
+
+    NodeType* removed = nullptr;
+    if ( found != nullptr )
+    {
+        removed = static_cast<NodeType*>( current );
+        if ( removed != found )
+        {
+            found->value = std::move( removed->value );
+        }
+
+        parent->child( parent->right == removed ) = removed->child( removed->left == nullptr );
+        if ( parent == &m_head && m_head.right != nullptr )
+        {
+            m_head.right->setColor( Color::Black );
+        }
+        m_size.fetch_sub( 1, std::memory_order_relaxed );
+    }
+
+    unlock_( current, found );
+    unlock_( parent, found );
+    unlock_( grand, found );
+    if ( found != nullptr )
+    {
+        found->mutex.unlock();
+    }
+
+    //nobody can wait for the removed node: its parent was locked until it was unlinked
+    if ( removed != nullptr )
+    {
+        destroyNode_( removed );
+    }
+
+    return removed != nullptr;
+}
+
+template<typename T, typename Less, typename Allocator>
+inline void ConcurrentRedBlackTree<T, Less, Allocator>::clear()
+{
+    destroySubtree_( m_head.right );
+    m_head.right = nullptr;
+    m_size.store( 0, std::memory_order_relaxed );
+}
+
+template<typename T, typename Less, typename Allocator>
+inline std::optional<T> ConcurrentRedBlackTree<T, Less, Allocator>::find( const T& value ) const
+{
+    std::optional<T> result;
+    lookup_( value, [&result]( const T& found )
+    {
+        result = found;
+    } );
+
+    return result;
+}
+
+template<typename T, typename Less, typename Allocator>
+inline bool ConcurrentRedBlackTree<T, Less, Allocator>::contains( const T& value ) const
+{
+    return lookup_( value, []( const T& )
+    {
+    } );
+}
+
+template<typename T, typename Less, typename Allocator>
+inline typename ConcurrentRedBlackTree<T, Less, Allocator>::size_type ConcurrentRedBlackTree<T, Less, Allocator>::size() const
+{
+    return m_size.load( std::memory_order_relaxed );
+}
+
+template<typename T, typename Less, typename Allocator>
+inline bool ConcurrentRedBlackTree<T, Less, Allocator>::empty() const
+{
+    return size() == 0;
+}
+
+template<typename T, typename Less, typename Allocator>
+template<typename... Args>
+inline typename ConcurrentRedBlackTree<T, Less, Allocator>::NodeType* ConcurrentRedBlackTree<T, Less, Allocator>::createNode_( Args&&... args )
+{
+    NodeType* node = NodeAllocatorTraits::allocate( m_nodeAllocator, 1 );
+    try
+    {
+        NodeAllocatorTraits::construct( m_nodeAllocator, node, std::forward<Args>( args )... );
+    }
+    catch ( ... )
+    {
+        NodeAllocatorTraits::deallocate( m_nodeAllocator, node, 1 );
+        throw;
+    }
+
+    return node;
+}
+
+template<typename T, typename Less, typename Allocator>
+inline void ConcurrentRedBlackTree<T, Less, Allocator>::destroyNode_( NodeType* node )
+{
+    NodeAllocatorTraits::destroy( m_nodeAllocator, node );
+    NodeAllocatorTraits::deallocate( m_nodeAllocator, node, 1 );
+}
+
+template<typename T, typename Less, typename Allocator>
+inline void ConcurrentRedBlackTree<T, Less, Allocator>::destroySubtree_( NodeType* node )
+{
+    while ( node != nullptr )
+    {
+        destroySubtree_( node->left );
+        const auto right = node->right;
+        destroyNode_( node );
+        node = right;
+    }
+}
+
+template<typename T, typename Less, typename Allocator>
+inline bool ConcurrentRedBlackTree<T, Less, Allocator>::insertNode_( NodeType* node )
+{
+    //window locked exclusively: current, its parent, grandparent and great-grandparent
+    LinksType* great = nullptr;
+    LinksType* grand = nullptr;
+    LinksType* parent = &m_head;
+    bool right = true;
+    bool inserted = false;
+
+    m_head.mutex.lock();
+    NodeType* current = m_head.right;
+    if ( current != nullptr )
+    {
+        current->mutex.lock();
+    }
+
+    while ( true )
+    {
+        if ( current == nullptr )
+        {
+            //no other thread can reach the new node before parent is unlocked
+            current = node;
+            current->mutex.lock();
+            parent->child( right ) = current;
+            inserted = true;
+        }
+        else if ( isRed_( current->left ) && isRed_( current->right ) )
+        {
+            //splits a 4-node on the way down, so the node inserted below never needs to propagate a split up
+            current->setColor( Color::Red );
+            current->left->setColor( Color::Black );
+            current->right->setColor( Color::Black );
+        }
+
+        if ( parent == &m_head )
+        {
+            current->setColor( Color::Black );
+        }
+        else if ( isRed_( current ) && isRed_( parent ) )
+        {
+            //a red parent is not the root, so grand is a node and great is locked as well
+            const auto grandNode = static_cast<NodeType*>( grand );
+            const auto parentNode = static_cast<NodeType*>( parent );
+            const bool parentRight = grandNode->right == parentNode;
+            const bool grandRight = great->right == grandNode;
+
+            if ( parentNode->child( parentRight ) == current )
+            {
+                great->child( grandRight ) = rotate_( grandNode, !parentRight );
+
+                //grand went below parent, next to current
+                grand->mutex.unlock();
+                grand = great;
+                great = nullptr;
+            }
+            else
+            {
+                great->child( grandRight ) = rotateTwice_( grandNode, !parentRight );
+
+                //current went above both
+                grand->mutex.unlock();
+                parent->mutex.unlock();
+                parent = great;
+                grand = nullptr;
+                great = nullptr;
+            }
+        }
+
+        if ( inserted )
+        {
+            break;
+        }
+
+        right = m_less( current->value, node->value );
+        if ( !right && !m_less( node->value, current->value ) )
+        {
+            break;
+        }
+
+        //a rotation changes links of great at the highest, the node above it can go
+        unlock_( great, nullptr );
+        great = grand;
+        grand = parent;
+        parent = current;
+        current = current->child( right );
+        if ( current != nullptr )
+        {
+            current->mutex.lock();
+        }
+    }
+
+    unlock_( current, nullptr );
+    unlock_( parent, nullptr );
+    unlock_( grand, nullptr );
+    unlock_( great, nullptr );
+
+    if ( inserted )
+    {
+        m_size.fetch_add( 1, std::memory_order_relaxed );
+    }
+    else
+    {
+        destroyNode_( node );
+    }
+
+    return inserted;
+}
+
+template<typename T, typename Less, typename Allocator>
+template<typename Found>
+inline bool ConcurrentRedBlackTree<T, Less, Allocator>::lookup_( const T& value, Found found ) const
+{
+    //a child is locked before its parent is released, so no writer can change the link in between
+    const LinksType* parent = &m_head;
+    m_head.mutex.lock_shared();
+
+    const NodeType* node = m_head.right;
+    while ( node != nullptr )
+    {
+        node->mutex.lock_shared();
+        parent->mutex.unlock_shared();
+        parent = node;
+
+        if ( m_less( node->value, value ) )
+        {
+            node = node->right;
+        }
+        else if ( m_less( value, node->value ) )
+        {
+            node = node->left;
+        }
+        else
+        {
+            found( node->value );
+            node->mutex.unlock_shared();
+            return true;
+        }
+    }
+
+    parent->mutex.unlock_shared();
+    return false;
+}
+
+template<typename T, typename Less, typename Allocator>
+inline bool ConcurrentRedBlackTree<T, Less, Allocator>::isRed_( const LinksType* links )
+{
+    return links != nullptr && links->color() == Color::Red;
+}
+
+template<typename T, typename Less, typename Allocator>
+inline void ConcurrentRedBlackTree<T, Less, Allocator>::unlock_( LinksType* links, const NodeType* kept )
+{
+    if ( links != nullptr && links != kept )
+    {
+        links->mutex.unlock();
+    }
+}
+
+template<typename T, typename Less, typename Allocator>
+inline typename ConcurrentRedBlackTree<T, Less, Allocator>::NodeType* ConcurrentRedBlackTree<T, Less, Allocator>::rotate_( NodeType* node, bool right )
+{
+    const auto top = node->child( !right );
+    node->child( !right ) = top->child( right );
+    top->child( right ) = node;
+
+    node->setColor( Color::Red );
+    top->setColor( Color::Black );
+    return top;
+}
+
+template<typename T, typename Less, typename Allocator>
+inline typename ConcurrentRedBlackTree<T, Less, Allocator>::NodeType* ConcurrentRedBlackTree<T, Less, Allocator>::rotateTwice_( NodeType* node, bool right )
+{
+    node->child( !right ) = rotate_( node->child( !right ), !right );
+    return rotate_( node, right );
+}
@@ -0,0 +1,239 @@
+#pragma once
+
+#include "redblacktree.h"
+
+//Half-open interval [low, high). Intervals with low >= high are empty and overlap nothing.
+template<typename Point>
+struct Interval
+{
+    Interval( const Point& low, const Point& high );
+
+    bool operator==( const Interval& other ) const;
+    bool operator!=( const Interval& other ) const;
+
+    Point low;
+    Point high;
+};
+
+//Intervals are ordered by low, then by high
+template<typename Point, typename Less>
+struct IntervalComparer
+{
+    bool operator()( const Interval<Point>& left, const Interval<Point>& right ) const
+    {
+        if ( less( left.low, right.low ) )
+        {
+            return true;
+        }
+        if ( less( right.low, left.low ) )
+        {
+            return false;
+        }
+        return less( left.high, right.high );
+    }
+
+    Less less;
+};
+
+//Greatest high end in a subtree. Ends are referenced in place: nodes never move their values.
+template<typename Point, typename Less>
+struct MaxEnd
+{
+    using value_type = const Point*;
+
+    static value_type make( const Interval<Point>& interval )
+    {
+        return &interval.high;
+    }
+
+    static value_type combine( value_type left, value_type right )
+    {
+        if ( left == nullptr )
+        {
+            return right;
+        }
+        if ( right == nullptr )
+        {
+            return left;
+        }
+        return Less{}( *left, *right ) ? right : left;
+    }
+
+    static value_type identity()
+    {
+        return nullptr;
+    }
+};
+
+//Set of intervals answering overlap queries. Subtrees whose greatest end is not past the query
+//and right subtrees of nodes starting after it are skipped, so every reported interval costs O(log n).
+template<typename Point, typename Less = std::less<Point>, typename Allocator = std::allocator<Interval<Point>>>
+class IntervalTree : public RedBlackTree<Interval<Point>, IntervalComparer<Point, Less>, Allocator, MaxEnd<Point, Less>>
+{
+private:
+    using Base = RedBlackTree<Interval<Point>, IntervalComparer<Point, Less>, Allocator, MaxEnd<Point, Less>>;
+    using NodeType = Node<Interval<Point>, MaxEnd<Point, Less>>;
+
+public:
+    using size_type = typename Base::size_type;
+
+public:
+    IntervalTree();
+    explicit IntervalTree( const Allocator& allocator );
+    IntervalTree( const std::initializer_list<Interval<Point>>& values, const Allocator& allocator = Allocator() );
+
+    template<typename IterType>
+    IntervalTree( const IterType& begin, const IterType& end, const Allocator& allocator = Allocator() );
+
+    //Calls visit( interval ) for every interval overlapping [low, high), in order
+    template<typename Visitor>
+    void for_each_overlapping( const Point& low, const Point& high, Visitor visit ) const;
+
+    //Calls visit( interval ) for every interval containing point, in order
+    template<typename Visitor>
+    void for_each_containing( const Point& point, Visitor visit ) const;
+
+    std::vector<Interval<Point>> overlapping( const Point& low, const Point& high ) const;
+    std::vector<Interval<Point>> containing( const Point& point ) const;
+
+    //number of intervals containing point
+    size_type stabbing_count( const Point& point ) const;
+
+private:
+    //from: intervals must end after it; startsBefore( low ): intervals must start before the query ends
+    template<typename StartsBefore, typename Visitor>
+    static void visitOverlapping_( const NodeType* node, const Point& from, const StartsBefore& startsBefore, Visitor& visit );
+};
+
+
+template<typename Point>
+inline Interval<Point>::Interval( const Point& low, const Point& high )
+    : low{ low }
+    , high{ high }
+{
+}
+
+template<typename Point>
+inline bool Interval<Point>::operator==( const Interval& other ) const
+{
+    return low == other.low && high == other.high;
+}
+
+template<typename Point>
+inline bool Interval<Point>::operator!=( const Interval& other ) const
+{
+    return !( *this == other );
+}
+
+template<typename Point, typename Less, typename Allocator>
+inline IntervalTree<Point, Less, Allocator>::IntervalTree()
+    : Base()
+{
+}
+
+template<typename Point, typename Less, typename Allocator>
+inline IntervalTree<Point, Less, Allocator>::IntervalTree( const Allocator& allocator )
+    : Base( allocator )
+{
+}
+
+template<typename Point, typename Less, typename Allocator>
+inline IntervalTree<Point, Less, Allocator>::IntervalTree( const std::initializer_list<Interval<Point>>& values, const Allocator& allocator )
+    : Base( values, allocator )
+{
+}
+
+template<typename Point, typename Less, typename Allocator>
+template<typename IterType>
+inline IntervalTree<Point, Less, Allocator>::IntervalTree( const IterType& begin, const IterType& end, const Allocator& allocator )
+    : Base( begin, end, allocator )
+{
+}
+
+template<typename Point, typename Less, typename Allocator>
+template<typename Visitor>
+inline void IntervalTree<Point, Less, Allocator>::for_each_overlapping( const Point& low, const Point& high, Visitor visit ) const
+{
+    const Less less;
+    if ( !less( low, high ) )
+    {
+        return;
+    }
+
+    visitOverlapping_( this->root_(), low, [&less, &high]( const Point& start )
+    {
+        return less( start, high );
+    }, visit );
+}
+
+template<typename Point, typename Less, typename Allocator>
+template<typename Visitor>
+inline void IntervalTree<Point, Less, Allocator>::for_each_containing( const Point& point, Visitor visit ) const
+{
+    const Less less;
+    visitOverlapping_( this->root_(), point, [&less, &point]( const Point& start )
+    {
+        return !less( point, start );
+    }, visit );
+}
+
+template<typename Point, typename Less, typename Allocator>
+inline std::vector<Interval<Point>> IntervalTree<Point, Less, Allocator>::overlapping( const Point& low, const Point& high ) const
+{
+    std::vector<Interval<Point>> result;
+    for_each_overlapping( low, high, [&result]( const Interval<Point>& interval )
+    {
+        result.push_back( interval );
+    } );
+
+    return result;
+}
+
+template<typename Point, typename Less, typename Allocator>
+inline std::vector<Interval<Point>> IntervalTree<Point, Less, Allocator>::containing( const Point& point ) const
+{
+    std::vector<Interval<Point>> result;
+    for_each_containing( point, [&result]( const Interval<Point>& interval )
+    {
+        result.push_back( interval );
+    } );
+
+    return result;
+}
+
+template<typename Point, typename Less, typename Allocator>
+inline typename IntervalTree<Point, Less, Allocator>::size_type IntervalTree<Point, Less, Allocator>::stabbing_count( const Point& point ) const
+{
+    size_type count = 0;
+    for_each_containing( point, [&count]( const Interval<Point>& )
+    {
+        ++count;
+    } );
+
+    return count;
+}
+
+template<typename Point, typename Less, typename Allocator>
+template<typename StartsBefore, typename Visitor>
+inline void IntervalTree<Point, Less, Allocator>::visitOverlapping_( const NodeType* node, const Point& from,
+    const StartsBefore& startsBefore, Visitor& visit )
+{
+    const Less less;
+    while ( node != nullptr && less( from, *node->aggregate ) )
+    {
+        visitOverlapping_( node->left, from, startsBefore, visit );
+
+        if ( !startsBefore( node->value.low ) )
+        {
+            //right subtree starts even later
+            return;
+        }
+
+        if ( less( from, node->value.high ) )
+        {
+            visit( node->value );
+        }
+
+        node = node->right;
+    }
+}
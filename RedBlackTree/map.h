@@ -5,118 +5,303 @@
 template<typename KeyType, typename ValueType, typename Less>
 struct PairComparer
 {
+    //Bare keys are compared with stored pairs, so Map can search without building a pair.
+    //Keys of other types (e.g. std::string_view for std::string) are accepted when Less is transparent itself.
+    using is_transparent = void;
+
+    template<typename Key>
+    using EnableIfKey = std::enable_if_t<std::is_same_v<Key, KeyType> || IsTransparent<Less>::value>;
+
     bool operator()( const std::pair<const KeyType, ValueType>& left, const std::pair<const KeyType, ValueType>& right ) const
     {
         return less( left.first, right.first );
     }
 
+    template<typename Key, typename = EnableIfKey<Key>>
+    bool operator()( const Key& left, const std::pair<const KeyType, ValueType>& right ) const
+    {
+        return less( left, right.first );
+    }
+
+    template<typename Key, typename = EnableIfKey<Key>>
+    bool operator()( const std::pair<const KeyType, ValueType>& left, const Key& right ) const
+    {
+        return less( left.first, right );
+    }
+
     Less less;
 };
 
-template<typename KeyType, typename ValueType, typename Less = std::less<const KeyType>>
-class Map : public RedBlackTree<std::pair<const KeyType, ValueType>, PairComparer<KeyType, ValueType, Less>>
+//Augmentation aggregates whole pairs. When it depends on mapped values, values changed
+//through operator[] or iterators must be followed by refresh; insert_or_assign does it itself.
+template<typename KeyType, typename ValueType, typename Less = std::less<const KeyType>,
+    typename Allocator = std::allocator<std::pair<const KeyType, ValueType>>, typename Augmentation = NoAugmentation>
+class Map : public RedBlackTree<std::pair<const KeyType, ValueType>, PairComparer<KeyType, ValueType, Less>, Allocator, Augmentation>
 {
+private:
+    using Base = RedBlackTree<std::pair<const KeyType, ValueType>, PairComparer<KeyType, ValueType, Less>, Allocator, Augmentation>;
+
+public:
+    using iterator = typename Base::iterator;
+
 public:
     Map();
-    Map( const std::initializer_list<std::pair<const KeyType, ValueType>>& values );
+    explicit Map( const Allocator& allocator );
+    Map( const std::initializer_list<std::pair<const KeyType, ValueType>>& values, const Allocator& allocator = Allocator() );
 
     template<typename IterType>
-    Map( const IterType& begin, const IterType& end );
+    Map( const IterType& begin, const IterType& end, const Allocator& allocator = Allocator() );
 
-    Map( const Map<KeyType, ValueType, Less>& other );
-    Map( Map<KeyType, ValueType, Less>&& other );
+    Map( const Map<KeyType, ValueType, Less, Allocator, Augmentation>& other );
+    Map( Map<KeyType, ValueType, Less, Allocator, Augmentation>&& other );
 
-    Map& operator=( const Map<KeyType, ValueType, Less>& other );
-    Map& operator=( Map<KeyType, ValueType, Less>&& other );
+    Map& operator=( const Map<KeyType, ValueType, Less, Allocator, Augmentation>& other );
+    Map& operator=( Map<KeyType, ValueType, Less, Allocator, Augmentation>&& other );
+
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace( const KeyType& key, Args&&... args );
+
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace( KeyType&& key, Args&&... args );
+
+    template<typename MappedType>
+    std::pair<iterator, bool> insert_or_assign( const KeyType& key, MappedType&& value );
+
+    template<typename MappedType>
+    std::pair<iterator, bool> insert_or_assign( KeyType&& key, MappedType&& value );
 
     ValueType& operator[]( const KeyType& key );
+    ValueType& operator[]( KeyType&& key );
     const ValueType& operator[]( const KeyType& key ) const;
 
     const ValueType& at( const KeyType& key ) const;
 
+    //Writes a pointer to the value of every key in [first, last) to out in the same order, nullptr if absent.
+    //The lookups are batched (see RedBlackTree::find_many).
+    template<typename KeyIter, typename OutIter>
+    OutIter get_many( KeyIter first, KeyIter last, OutIter out ) const;
+
     bool operator==( const Map& other ) const;
     bool operator!=( const Map& other ) const;
 
+    //Set operations on keys (see RedBlackTree::set_union); values of equal keys are taken from left
+    static Map set_union( Map&& left, Map&& right, std::size_t threads = 1 );
+    static Map set_intersection( Map&& left, Map&& right, std::size_t threads = 1 );
+    static Map set_difference( Map&& left, Map&& right, std::size_t threads = 1 );
+
+    //Moves the entries with keys not less than key into the returned map (see RedBlackTree::split)
+    Map split( const KeyType& key );
+
+    //Concatenates maps whose keys in left are all less than those in right, in O(log n)
+    static Map join( Map&& left, Map&& right );
+
+private:
+    explicit Map( Base&& tree );
 };
 
-template<typename KeyType, typename ValueType, typename Less>
-bool Map<KeyType, ValueType, Less>::operator!=( const Map& other ) const
+template<typename KeyType, typename ValueType, typename Less, typename Allocator, typename Augmentation>
+bool Map<KeyType, ValueType, Less, Allocator, Augmentation>::operator!=( const Map& other ) const
 {
     return !( *this == other );
 }
 
-template<typename KeyType, typename ValueType, typename Less>
-bool Map<KeyType, ValueType, Less>::operator==( const Map& other ) const
+template<typename KeyType, typename ValueType, typename Less, typename Allocator, typename Augmentation>
+bool Map<KeyType, ValueType, Less, Allocator, Augmentation>::operator==( const Map& other ) const
 {
-    return std::equal( begin(), end(), other.begin(), other.end() );
+    return std::equal( this->begin(), this->end(), other.begin(), other.end() );
 }
 
-template<typename KeyType, typename ValueType, typename Less>
-inline Map<KeyType, ValueType, Less>::Map()
-    : RedBlackTree()
+template<typename KeyType, typename ValueType, typename Less, typename Allocator, typename Augmentation>
+inline Map<KeyType, ValueType, Less, Allocator, Augmentation>::Map()
+    : Base()
 {
 }
 
-template<typename KeyType, typename ValueType, typename Less>
-inline Map<KeyType, ValueType, Less>::Map( const std::initializer_list<std::pair<const KeyType, ValueType>>& values )
-    : Map( std::cbegin( values ), std::cend( values ) )
+template<typename KeyType, typename ValueType, typename Less, typename Allocator, typename Augmentation>
+inline Map<KeyType, ValueType, Less, Allocator, Augmentation>::Map( const Allocator& allocator )
+    : Base( allocator )
 {
 }
 
-template<typename KeyType, typename ValueType, typename Less>
+template<typename KeyType, typename ValueType, typename Less, typename Allocator, typename Augmentation>
+inline Map<KeyType, ValueType, Less, Allocator, Augmentation>::Map( const std::initializer_list<std::pair<const KeyType, ValueType>>& values, const Allocator& allocator )
+    : Map( std::cbegin( values ), std::cend( values ), allocator )
+{
+}
+
+template<typename KeyType, typename ValueType, typename Less, typename Allocator, typename Augmentation>
 template<typename IterType>
-inline Map<KeyType, ValueType, Less>::Map( const IterType& begin, const IterType& end )
-    : RedBlackTree( begin, end )
+inline Map<KeyType, ValueType, Less, Allocator, Augmentation>::Map( const IterType& begin, const IterType& end, const Allocator& allocator )
+    : Base( begin, end, allocator )
 {
 }
 
-template<typename KeyType, typename ValueType, typename Less>
-inline Map<KeyType, ValueType, Less>::Map( const Map<KeyType, ValueType, Less>& other )
+template<typename KeyType, typename ValueType, typename Less, typename Allocator, typename Augmentation>
+inline Map<KeyType, ValueType, Less, Allocator, Augmentation>::Map( const Map<KeyType, ValueType, Less, Allocator, Augmentation>& other )
+    : Base( other )
 {
 }
 
-template<typename KeyType, typename ValueType, typename Less>
-inline Map<KeyType, ValueType, Less>::Map( Map<KeyType, ValueType, Less>&& other )
-    : RedBlackTree( other )
+template<typename KeyType, typename ValueType, typename Less, typename Allocator, typename Augmentation>
+inline Map<KeyType, ValueType, Less, Allocator, Augmentation>::Map( Map<KeyType, ValueType, Less, Allocator, Augmentation>&& other )
+    : Base( std::move( other ) )
 {
 }
 
-template<typename KeyType, typename ValueType, typename Less>
-inline Map<KeyType, ValueType, Less>& Map<KeyType, ValueType, Less>::operator=( const Map<KeyType, ValueType, Less>& other )
+template<typename KeyType, typename ValueType, typename Less, typename Allocator, typename Augmentation>
+inline Map<KeyType, ValueType, Less, Allocator, Augmentation>& Map<KeyType, ValueType, Less, Allocator, Augmentation>::operator=( const Map<KeyType, ValueType, Less, Allocator, Augmentation>& other )
 {
-    return RedBlackTree::operator=( other );
+    Base::operator=( other );
+    return *this;
 }
 
-template<typename KeyType, typename ValueType, typename Less>
-inline Map<KeyType, ValueType, Less>& Map<KeyType, ValueType, Less>::operator=( Map<KeyType, ValueType, Less>&& other )
+template<typename KeyType, typename ValueType, typename Less, typename Allocator, typename Augmentation>
+inline Map<KeyType, ValueType, Less, Allocator, Augmentation>& Map<KeyType, ValueType, Less, Allocator, Augmentation>::operator=( Map<KeyType, ValueType, Less, Allocator, Augmentation>&& other )
 {
-    return RedBlackTree::operator=( other );
+    Base::operator=( std::move( other ) );
+    return *this;
 }
 
-template<typename KeyType, typename ValueType, typename Less>
-inline ValueType& Map<KeyType, ValueType, Less>::operator[]( const KeyType& key )
+template<typename KeyType, typename ValueType, typename Less, typename Allocator, typename Augmentation>
+inline Map<KeyType, ValueType, Less, Allocator, Augmentation>::Map( Base&& tree )
+    : Base( std::move( tree ) )
+{
+}
+
+template<typename KeyType, typename ValueType, typename Less, typename Allocator, typename Augmentation>
+inline Map<KeyType, ValueType, Less, Allocator, Augmentation> Map<KeyType, ValueType, Less, Allocator, Augmentation>::split( const KeyType& key )
+{
+    return Map( Base::split( key ) );
+}
+
+template<typename KeyType, typename ValueType, typename Less, typename Allocator, typename Augmentation>
+inline Map<KeyType, ValueType, Less, Allocator, Augmentation> Map<KeyType, ValueType, Less, Allocator, Augmentation>::join( Map&& left, Map&& right )
+{
+    return Map( Base::join( std::move( left ), std::move( right ) ) );
+}
+
+template<typename KeyType, typename ValueType, typename Less, typename Allocator, typename Augmentation>
+inline Map<KeyType, ValueType, Less, Allocator, Augmentation> Map<KeyType, ValueType, Less, Allocator, Augmentation>::set_union(
+    Map<KeyType, ValueType, Less, Allocator, Augmentation>&& left, Map<KeyType, ValueType, Less, Allocator, Augmentation>&& right, std::size_t threads )
 {
-    auto it = find( { key, {} } );
-    if ( it == cend() )
+    return Map( Base::set_union( std::move( left ), std::move( right ), threads ) );
+}
+
+template<typename KeyType, typename ValueType, typename Less, typename Allocator, typename Augmentation>
+inline Map<KeyType, ValueType, Less, Allocator, Augmentation> Map<KeyType, ValueType, Less, Allocator, Augmentation>::set_intersection(
+    Map<KeyType, ValueType, Less, Allocator, Augmentation>&& left, Map<KeyType, ValueType, Less, Allocator, Augmentation>&& right, std::size_t threads )
+{
+    return Map( Base::set_intersection( std::move( left ), std::move( right ), threads ) );
+}
+
+template<typename KeyType, typename ValueType, typename Less, typename Allocator, typename Augmentation>
+inline Map<KeyType, ValueType, Less, Allocator, Augmentation> Map<KeyType, ValueType, Less, Allocator, Augmentation>::set_difference(
+    Map<KeyType, ValueType, Less, Allocator, Augmentation>&& left, Map<KeyType, ValueType, Less, Allocator, Augmentation>&& right, std::size_t threads )
+{
+    return Map( Base::set_difference( std::move( left ), std::move( right ), threads ) );
+}
+
+template<typename KeyType, typename ValueType, typename Less, typename Allocator, typename Augmentation>
+template<typename... Args>
+inline std::pair<typename Map<KeyType, ValueType, Less, Allocator, Augmentation>::iterator, bool>
+Map<KeyType, ValueType, Less, Allocator, Augmentation>::try_emplace( const KeyType& key, Args&&... args )
+{
+    const auto position = this->findInsertPosition_( key );
+    if ( *position.link != nullptr )
     {
-        it = insert( { key, {} } );
+        return { this->makeIterator_( *position.link ), false };
     }
-    return it->second;
+
+    //the attach point found above is reused, so the tree is descended only once
+    auto node = this->insertAt_( position, std::piecewise_construct,
+        std::forward_as_tuple( key ),
+        std::forward_as_tuple( std::forward<Args>( args )... ) );
+    return { this->makeIterator_( node ), true };
 }
 
-template<typename KeyType, typename ValueType, typename Less>
-inline const ValueType& Map<KeyType, ValueType, Less>::operator[]( const KeyType& key ) const
+template<typename KeyType, typename ValueType, typename Less, typename Allocator, typename Augmentation>
+template<typename... Args>
+inline std::pair<typename Map<KeyType, ValueType, Less, Allocator, Augmentation>::iterator, bool>
+Map<KeyType, ValueType, Less, Allocator, Augmentation>::try_emplace( KeyType&& key, Args&&... args )
+{
+    const auto position = this->findInsertPosition_( key );
+    if ( *position.link != nullptr )
+    {
+        return { this->makeIterator_( *position.link ), false };
+    }
+
+    auto node = this->insertAt_( position, std::piecewise_construct,
+        std::forward_as_tuple( std::move( key ) ),
+        std::forward_as_tuple( std::forward<Args>( args )... ) );
+    return { this->makeIterator_( node ), true };
+}
+
+template<typename KeyType, typename ValueType, typename Less, typename Allocator, typename Augmentation>
+template<typename MappedType>
+inline std::pair<typename Map<KeyType, ValueType, Less, Allocator, Augmentation>::iterator, bool>
+Map<KeyType, ValueType, Less, Allocator, Augmentation>::insert_or_assign( const KeyType& key, MappedType&& value )
+{
+    auto result = try_emplace( key, std::forward<MappedType>( value ) );
+    if ( !result.second )
+    {
+        result.first->second = std::forward<MappedType>( value );
+        this->refresh( result.first );
+    }
+    return result;
+}
+
+template<typename KeyType, typename ValueType, typename Less, typename Allocator, typename Augmentation>
+template<typename MappedType>
+inline std::pair<typename Map<KeyType, ValueType, Less, Allocator, Augmentation>::iterator, bool>
+Map<KeyType, ValueType, Less, Allocator, Augmentation>::insert_or_assign( KeyType&& key, MappedType&& value )
+{
+    auto result = try_emplace( std::move( key ), std::forward<MappedType>( value ) );
+    if ( !result.second )
+    {
+        result.first->second = std::forward<MappedType>( value );
+        this->refresh( result.first );
+    }
+    return result;
+}
+
+template<typename KeyType, typename ValueType, typename Less, typename Allocator, typename Augmentation>
+inline ValueType& Map<KeyType, ValueType, Less, Allocator, Augmentation>::operator[]( const KeyType& key )
+{
+    return try_emplace( key ).first->second;
+}
+
+template<typename KeyType, typename ValueType, typename Less, typename Allocator, typename Augmentation>
+inline ValueType& Map<KeyType, ValueType, Less, Allocator, Augmentation>::operator[]( KeyType&& key )
 {
-    const auto it = find( { key, {} } );
-    if ( it == cend() )
+    return try_emplace( std::move( key ) ).first->second;
+}
+
+template<typename KeyType, typename ValueType, typename Less, typename Allocator, typename Augmentation>
+inline const ValueType& Map<KeyType, ValueType, Less, Allocator, Augmentation>::operator[]( const KeyType& key ) const
+{
+    const auto it = this->find( key );
+    if ( it == this->cend() )
     {
         throw std::out_of_range( "invalid map<K, T> key" );
     }
     return it->second;
 }
 
-template<typename KeyType, typename ValueType, typename Less>
-inline const ValueType& Map<KeyType, ValueType, Less>::at( const KeyType& key ) const
+template<typename KeyType, typename ValueType, typename Less, typename Allocator, typename Augmentation>
+inline const ValueType& Map<KeyType, ValueType, Less, Allocator, Augmentation>::at( const KeyType& key ) const
 {
     return operator[]( key );
 }
+
+template<typename KeyType, typename ValueType, typename Less, typename Allocator, typename Augmentation>
+template<typename KeyIter, typename OutIter>
+inline OutIter Map<KeyType, ValueType, Less, Allocator, Augmentation>::get_many( KeyIter first, KeyIter last, OutIter out ) const
+{
+    this->findMany_( first, last, [&out]( const auto* node )
+    {
+        *out = node == nullptr ? nullptr : &node->value.second;
+        ++out;
+    } );
+
+    return out;
+}
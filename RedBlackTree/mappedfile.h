@@ -0,0 +1,139 @@
+#pragma once
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//Read-only mapping of a whole file. Pages are loaded on first touch and shared
+//through the page cache with every other process mapping the same file.
+class MappedFile
+{
+public:
+    explicit MappedFile( const std::string& path );
+    ~MappedFile();
+
+    MappedFile( const MappedFile& ) = delete;
+    MappedFile& operator=( const MappedFile& ) = delete;
+
+    const void* data() const;
+    std::size_t size() const;
+
+private:
+    const void* m_data;
+    std::size_t m_size;
+};
+
+
+#ifdef _WIN32
+
+inline MappedFile::MappedFile( const std::string& path )
+    : m_data{ nullptr }
+    , m_size{ 0 }
+{
+    const HANDLE file = CreateFileA( path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr );
+    if ( file == INVALID_HANDLE_VALUE )
+    {
+        throw std::runtime_error( "Can not open " + path );
+    }
+
+    LARGE_INTEGER size;
+    if ( !GetFileSizeEx( file, &size ) )
+    {
+        CloseHandle( file );
+        throw std::runtime_error( "Can not read the size of " + path );
+    }
+    m_size = static_cast<std::size_t>( size.QuadPart );
+
+    if ( m_size != 0 )
+    {
+        //the view keeps the mapping alive, both handles can go
+        const HANDLE mapping = CreateFileMappingA( file, nullptr, PAGE_READONLY, 0, 0, nullptr );
+        if ( mapping != nullptr )
+        {
+            m_data = MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+            CloseHandle( mapping );
+        }
+    }
+    CloseHandle( file );
+
+    if ( m_size != 0 && m_data == nullptr )
+    {
+        throw std::runtime_error( "Can not map " + path );
+    }
+}
+
+inline MappedFile::~MappedFile()
+{
+    if ( m_data != nullptr )
+    {
+        UnmapViewOfFile( m_data );
+    }
+}
+
+#else
+
+inline MappedFile::MappedFile( const std::string& path )
+    : m_data{ nullptr }
+    , m_size{ 0 }
+{
+    const int file = ::open( path.c_str(), O_RDONLY );
+    if ( file < 0 )
+    {
+        throw std::runtime_error( "Can not open " + path );
+    }
+
+    struct stat status;
+    if ( ::fstat( file, &status ) != 0 )
+    {
+        ::close( file );
+        throw std::runtime_error( "Can not read the size of " + path );
+    }
+    m_size = static_cast<std::size_t>( status.st_size );
+
+    if ( m_size != 0 )
+    {
+        //the mapping outlives the descriptor
+        void* data = ::mmap( nullptr, m_size, PROT_READ, MAP_SHARED, file, 0 );
+        m_data = data == MAP_FAILED ? nullptr : data;
+    }
+    ::close( file );
+
+    if ( m_size != 0 && m_data == nullptr )
+    {
+        throw std::runtime_error( "Can not map " + path );
+    }
+}
+
+inline MappedFile::~MappedFile()
+{
+    if ( m_data != nullptr )
+    {
+        ::munmap( const_cast<void*>( m_data ), m_size );
+    }
+}
+
+#endif
+
+inline const void* MappedFile::data() const
+{
+    return m_data;
+}
+
+inline std::size_t MappedFile::size() const
+{
+    return m_size;
+}
@@ -1,5 +1,6 @@
 #pragma once
 #include "map.h"
+#include "poolallocator.h"
 
 class MapTest
 {
@@ -10,6 +11,13 @@ public:
 
     TEST_DECL( basicTest );
     TEST_DECL( insertTest );
+    TEST_DECL( poolAllocatorTest );
+    TEST_DECL( moveInsertTest );
+    TEST_DECL( tryEmplaceTest );
+    TEST_DECL( heterogeneousLookupTest );
+    TEST_DECL( getManyTest );
+    TEST_DECL( reduceTest );
+    TEST_DECL( setOperationsTest );
 
 #undef TEST_DECL
 };
@@ -53,3 +61,209 @@ TEST_DEF( insertTest )
 
     return test == ref;
 }
+
+
+TEST_DEF( poolAllocatorTest )
+{
+    using PoolMap = Map<std::string, int, std::less<const std::string>, PoolAllocator<std::pair<const std::string, int>>>;
+
+    PoolMap test;
+    for ( int i = 0; i < 100; ++i )
+    {
+        test[std::to_string( i )] = i;
+    }
+
+    PoolMap copy( test );
+    test.clear();
+
+    for ( int i = 0; i < 100; ++i )
+    {
+        if ( copy[std::to_string( i )] != i )
+        {
+            return false;
+        }
+    }
+
+    return test.size() == 0 && copy.size() == 100;
+}
+
+TEST_DEF( moveInsertTest )
+{
+    Map<std::string, std::vector<int>> test;
+
+    auto key = "abc"s;
+    std::vector<int> value{ 1, 2, 3 };
+    test.insert( { std::move( key ), std::move( value ) } );
+
+    std::pair<const std::string, std::vector<int>> pair{ "def"s, { 4, 5 } };
+    test.emplace( std::piecewise_construct, std::forward_as_tuple( "ghi"s ), std::forward_as_tuple( 3, 6 ) );
+    test.emplace_hint( test.cend(), std::move( pair ) );
+
+    //duplicated key must not be inserted
+    const bool duplicateRejected = test.emplace( "abc"s, std::vector<int>{ 0 } ) == test.cend();
+
+    Map<std::string, std::vector<int>> ref
+    {
+        { "abc"s, { 1, 2, 3 } },
+        { "def"s, { 4, 5 } },
+        { "ghi"s, { 6, 6, 6 } }
+    };
+
+    return duplicateRejected && test == ref && value.empty() && pair.second.empty();
+}
+
+TEST_DEF( tryEmplaceTest )
+{
+    static int constructed;
+    constructed = 0;
+
+    struct Counted
+    {
+        Counted( int value = 0 )
+            : value{ value }
+        {
+            ++constructed;
+        }
+
+        int value;
+    };
+
+    Map<std::string, Counted> test;
+
+    const bool inserted = test.try_emplace( "a"s, 1 ).second;
+    const bool notReplaced = !test.try_emplace( "a"s, 2 ).second && test["a"s].value == 1;
+    const bool constructedOnce = constructed == 1;
+
+    const bool assigned = !test.insert_or_assign( "a"s, Counted{ 3 } ).second && test["a"s].value == 3;
+    const bool assignedNew = test.insert_or_assign( "b"s, Counted{ 4 } ).second && test["b"s].value == 4;
+
+    Map<std::string, int> counter;
+    for ( const auto& word : { "x"s, "y"s, "x"s, "z"s, "x"s } )
+    {
+        counter[word]++;
+    }
+
+    Map<std::string, int> ref
+    {
+        { "x"s, 3 },
+        { "y"s, 1 },
+        { "z"s, 1 }
+    };
+
+    return inserted && notReplaced && constructedOnce && assigned && assignedNew && test.size() == 2 && counter == ref;
+}
+
+TEST_DEF( heterogeneousLookupTest )
+{
+    Map<std::string, int, std::less<>> test
+    {
+        { "abc"s, 1 },
+        { "def"s, 2 },
+        { "ghi"s, 3 }
+    };
+
+    const std::string_view key = "def"sv;
+    const auto it = test.find( key );
+    if ( it == test.cend() || it->second != 2 )
+    {
+        return false;
+    }
+
+    const bool found = test.contains( "abc" ) && test.count( "ghi"sv ) == 1 &&
+        !test.contains( "xyz"sv ) && test.find( "xyz" ) == test.cend() && test.at( "ghi"s ) == 3;
+
+    const auto window = test.range( "b"sv, "h"sv );
+    const bool bounded = test.lower_bound( "b"sv )->first == "def"s && test.upper_bound( "ghi"sv ) == test.cend() &&
+        std::distance( window.begin(), window.end() ) == 2 && window.begin()->first == "def"s;
+
+    test.erase( "abc"sv );
+    test.erase( key );
+
+    Map<std::string, int, std::less<>> ref
+    {
+        { "ghi"s, 3 }
+    };
+
+    return found && bounded && test == ref;
+}
+
+TEST_DEF( getManyTest )
+{
+    Map<std::string, int, std::less<>> test;
+    for ( int i = 0; i < 100; ++i )
+    {
+        test.try_emplace( std::to_string( i ), i );
+    }
+
+    const std::vector<std::string_view> keys{ "42"sv, "x"sv, "7"sv, "99"sv, ""sv, "0"sv };
+    std::vector<const int*> values;
+    test.get_many( keys.cbegin(), keys.cend(), std::back_inserter( values ) );
+
+    return values.size() == keys.size() &&
+        *values[0] == 42 && values[1] == nullptr && *values[2] == 7 && *values[3] == 99 && values[4] == nullptr && *values[5] == 0;
+}
+
+TEST_DEF( reduceTest )
+{
+    //order book: total volume of a price range
+    struct VolumeSum
+    {
+        using value_type = int;
+
+        static value_type make( const std::pair<const int, int>& level )
+        {
+            return level.second;
+        }
+
+        static value_type combine( value_type left, value_type right )
+        {
+            return left + right;
+        }
+
+        static value_type identity()
+        {
+            return 0;
+        }
+    };
+
+    Map<int, int, std::less<const int>, std::allocator<std::pair<const int, int>>, VolumeSum> book;
+    for ( int price = 100; price < 200; ++price )
+    {
+        book.insert_or_assign( price, 1 );
+    }
+
+    const bool initial = book.reduce( 110, 120 ) == 10 && book.reduce( 0, 1000 ) == 100 && book.reduce( 150, 150 ) == 0;
+
+    book.insert_or_assign( 115, 50 );
+    book.erase( 111 );
+    book.insert_or_assign( 300, 7 );
+    book[130] += 9;
+    book.refresh( book.find( 130 ) );
+
+    return initial && book.reduce( 110, 120 ) == 58 && book.reduce( 110, 131 ) == 78 && book.reduce( 200, 301 ) == 7;
+}
+
+TEST_DEF( setOperationsTest )
+{
+    const Map<std::string, int> first
+    {
+        { "a"s, 1 },
+        { "b"s, 2 },
+        { "c"s, 3 }
+    };
+    const Map<std::string, int> second
+    {
+        { "b"s, 20 },
+        { "d"s, 40 }
+    };
+
+    const auto both = Map<std::string, int>::set_union( Map<std::string, int>( first ), Map<std::string, int>( second ) );
+    const auto common = Map<std::string, int>::set_intersection( Map<std::string, int>( second ), Map<std::string, int>( first ) );
+    const auto onlyFirst = Map<std::string, int>::set_difference( Map<std::string, int>( first ), Map<std::string, int>( second ) );
+
+    const Map<std::string, int> bothRef{ { "a"s, 1 }, { "b"s, 2 }, { "c"s, 3 }, { "d"s, 40 } };
+    const Map<std::string, int> commonRef{ { "b"s, 20 } };
+    const Map<std::string, int> onlyFirstRef{ { "a"s, 1 }, { "c"s, 3 } };
+
+    return both == bothRef && common == commonRef && onlyFirst == onlyFirstRef && both.at( "d"s ) == 40;
+}
@@ -1,5 +1,6 @@
 #pragma once
-#include "rapidjson/document.h"
+#include <cstdint>
+#include "augmentation.h"
 
 enum class Color : bool
 {
@@ -7,53 +8,137 @@ enum class Color : bool
     Black
 };
 
-template<typename T>
-struct Node
+//Parent pointer with the node's color in its low bit. Nodes hold pointers, so they are
+//at least pointer aligned and the bit is always zero in a real address.
+//Converts to a plain pointer; assigning a pointer keeps the color.
+template<typename NodeType>
+class ParentLink
+{
+public:
+    ParentLink( NodeType* parent, Color color );
+    ParentLink( const ParentLink& other ) = default;
+
+    ParentLink& operator=( NodeType* parent );
+    ParentLink& operator=( const ParentLink& other );
+
+    operator NodeType*() const;
+    NodeType* operator->() const;
+
+    Color color() const;
+    void setColor( Color color );
+
+private:
+    static constexpr std::uintptr_t colorBit = 1;
+
+    std::uintptr_t m_bits;
+};
+
+template<typename T, typename Augmentation = NoAugmentation>
+struct Node : NodeAggregate<Augmentation>
 {
 public:
     Node( const T& value,
         const Color& color,
         Node* parent = nullptr );
 
-    std::unique_ptr<Node> copy( Node<T>* parent = nullptr ) const;
+    template<typename... Args>
+    explicit Node( std::in_place_t, Args&&... args );
 
-    bool operator==( const Node<T>& other ) const;
+    bool operator==( const Node<T, Augmentation>& other ) const;
 
-    rapidjson::Document toJson() const;
+    Color color() const;
+    void setColor( Color color );
 
 public:
     T value;
-    Color color;
 
-    std::unique_ptr<Node> left;
-    std::unique_ptr<Node> right;
-    Node* parent;
+    //links are owned by the tree, which allocates and frees nodes through its allocator
+    Node* left;
+    Node* right;
+    //carries the color too, so a node is the value and three pointers (32 bytes for Node<int> and Node<double>)
+    ParentLink<Node> parent;
 };
 
-template<typename T>
-inline Node<T>::Node( const T& value,
+template<typename NodeType>
+inline ParentLink<NodeType>::ParentLink( NodeType* parent, Color color )
+    : m_bits{ reinterpret_cast<std::uintptr_t>( parent ) | ( color == Color::Black ? colorBit : 0 ) }
+{
+}
+
+template<typename NodeType>
+inline ParentLink<NodeType>& ParentLink<NodeType>::operator=( NodeType* parent )
+{
+    ASSERT( ( reinterpret_cast<std::uintptr_t>( parent ) & colorBit ) == 0 );
+    m_bits = reinterpret_cast<std::uintptr_t>( parent ) | ( m_bits & colorBit );
+    return *this;
+}
+
+template<typename NodeType>
+inline ParentLink<NodeType>& ParentLink<NodeType>::operator=( const ParentLink& other )
+{
+    //only the pointer is taken: the color belongs to the node holding the link
+    return *this = static_cast<NodeType*>( other );
+}
+
+template<typename NodeType>
+inline ParentLink<NodeType>::operator NodeType*() const
+{
+    return reinterpret_cast<NodeType*>( m_bits & ~colorBit );
+}
+
+template<typename NodeType>
+inline NodeType* ParentLink<NodeType>::operator->() const
+{
+    return *this;
+}
+
+template<typename NodeType>
+inline Color ParentLink<NodeType>::color() const
+{
+    return ( m_bits & colorBit ) != 0 ? Color::Black : Color::Red;
+}
+
+template<typename NodeType>
+inline void ParentLink<NodeType>::setColor( Color color )
+{
+    m_bits = ( m_bits & ~colorBit ) | ( color == Color::Black ? colorBit : 0 );
+}
+
+template<typename T, typename Augmentation>
+inline Node<T, Augmentation>::Node( const T& value,
     const Color& color,
     Node* parent )
     : value{ value }
-    , color{ color }
-    , parent{ parent }
     , left{ nullptr }
     , right{ nullptr }
+    , parent{ parent, color }
+{
+}
+
+template<typename T, typename Augmentation>
+template<typename... Args>
+inline Node<T, Augmentation>::Node( std::in_place_t, Args&&... args )
+    : value( std::forward<Args>( args )... )
+    , left{ nullptr }
+    , right{ nullptr }
+    , parent{ nullptr, Color::Red }
 {
 }
 
-template<typename T>
-inline std::unique_ptr<Node<T>> Node<T>::copy( Node<T>* parentNode ) const
+template<typename T, typename Augmentation>
+inline Color Node<T, Augmentation>::color() const
 {
-    auto copyOfThis = std::make_unique<Node<T>>( value, color, parentNode );
-    copyOfThis->left = left == nullptr ? nullptr : left->copy( copyOfThis.get() );
-    copyOfThis->right = right == nullptr ? nullptr : right->copy( copyOfThis.get() );
+    return parent.color();
+}
 
-    return copyOfThis;
+template<typename T, typename Augmentation>
+inline void Node<T, Augmentation>::setColor( Color color )
+{
+    parent.setColor( color );
 }
 
-template<typename T>
-inline bool Node<T>::operator==( const Node<T>& other ) const
+template<typename T, typename Augmentation>
+inline bool Node<T, Augmentation>::operator==( const Node<T, Augmentation>& other ) const
 {
     if ( value != other.value )
     {
@@ -106,43 +191,3 @@ inline bool Node<T>::operator==( const Node<T>& other ) const
 
     return equal;
 }
-
-template<typename T>
-inline rapidjson::Document Node<T>::toJson() const
-{
-    rapidjson::Document doc;
-    auto& allocator = doc.GetAllocator();
-
-    doc.SetObject();
-
-    rapidjson::Value jsonValue;
-    jsonValue.Set( value );
-
-    doc.AddMember( "value", jsonValue, allocator );
-
-    jsonValue.SetString( color == Color::Red ? "red" : "black", allocator );
-    doc.AddMember( "color", jsonValue, allocator );
-
-    if ( left != nullptr )
-    {
-        jsonValue.CopyFrom( left->toJson(), allocator );
-    }
-    else
-    {
-        jsonValue.SetNull();
-    }
-
-    doc.AddMember( "left", jsonValue, allocator );
-
-    if ( right != nullptr )
-    {
-        jsonValue.CopyFrom( right->toJson(), allocator );
-    }
-    else
-    {
-        jsonValue.SetNull();
-    }
-
-    doc.AddMember( "right", jsonValue, allocator );
-    return doc;
-}
@@ -0,0 +1,668 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include "redblacktree.h"
+#include "mappedfile.h"
+
+//Node of a PackedTree: links are 32-bit indices into the node block instead of pointers,
+//so the block does not depend on its address.
+template<typename T>
+struct PackedNode
+{
+    static constexpr std::uint32_t none = std::numeric_limits<std::uint32_t>::max();
+
+    T value;
+    std::uint32_t left;
+    std::uint32_t right;
+    std::uint32_t parent;
+};
+
+//Start of a file written by PackedTree::save, followed by the node block at the next multiple of the node alignment
+struct PackedFileHeader
+{
+    static constexpr char expectedMagic[8] = { 'R', 'B', 'T', 'P', 'A', 'C', 'K', '\0' };
+    static constexpr std::uint32_t currentVersion = 1;
+    static constexpr std::uint32_t nativeByteOrder = 0x01020304;
+
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byteOrder;
+    std::uint32_t nodeSize;
+    std::uint32_t nodeAlign;
+    std::uint64_t count;
+    //FNV-1a of the node block
+    std::uint64_t checksum;
+};
+
+//Read-only snapshot of a sorted set in one contiguous block of PackedNode.
+//The tree is perfectly balanced and laid out breadth first, so the top levels searched
+//by every lookup share a few cache lines. The block is relocatable: it can be copied with memcpy
+//(for trivially copyable T), sent to another process and searched in place through view(),
+//or saved to a file and mapped back with open_readonly().
+template<typename T, typename Less = std::less<T>>
+class PackedTree
+{
+private:
+    class ConstIterator;
+
+public:
+    using value_type = T;
+    using const_reference = const T&;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using iterator = ConstIterator;
+    using const_iterator = ConstIterator;
+    using reverse_iterator = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+public:
+    PackedTree();
+
+    //Equal neighbours are skipped, the first of them is kept
+    template<typename IterType>
+    PackedTree( SortedRangeTag, const IterType& begin, const IterType& end );
+
+    template<typename Allocator, typename Augmentation>
+    explicit PackedTree( const RedBlackTree<T, Less, Allocator, Augmentation>& tree );
+
+    PackedTree( const PackedTree& other );
+    PackedTree( PackedTree&& other );
+
+    PackedTree& operator=( const PackedTree& other );
+    PackedTree& operator=( PackedTree&& other );
+
+    //Searches a node block owned by someone else (a copy of data(), a mapped file) without copying it.
+    //The block must outlive the returned tree.
+    static PackedTree view( const PackedNode<T>* nodes, std::size_t count );
+
+    //Binary image for trivially copyable T: header, then the node block as it is in memory.
+    //Files are only portable between builds with the same T layout and byte order, which open_readonly checks.
+    void save( const std::string& path ) const;
+
+    //Maps a file written by save and searches it in place, nothing is deserialized.
+    //The header and file size are always checked; the checksum costs a pass over the whole file, so it is optional.
+    static PackedTree open_readonly( const std::string& path, bool verifyChecksum = false );
+
+    //the node block, size() nodes with the root at index 0
+    const PackedNode<T>* data() const;
+    std::size_t size() const;
+    bool empty() const;
+
+    iterator begin() const;
+    iterator end() const;
+
+    const_iterator cbegin() const;
+    const_iterator cend() const;
+
+    reverse_iterator rbegin() const;
+    reverse_iterator rend() const;
+
+    const_iterator find( const T& value ) const;
+    bool contains( const T& value ) const;
+
+    const_iterator lower_bound( const T& value ) const;
+    const_iterator upper_bound( const T& value ) const;
+
+private:
+    void attach_( const PackedNode<T>* nodes, std::size_t count );
+    std::uint32_t extreme_( bool left ) const;
+
+    static std::size_t nodesOffset_();
+    static std::uint64_t checksum_( const void* data, std::size_t bytes );
+
+private:
+    Less m_less;
+    std::vector<PackedNode<T>> m_storage;
+    std::shared_ptr<const MappedFile> m_file;
+    const PackedNode<T>* m_nodes;
+    std::size_t m_size;
+    std::uint32_t m_leftmost;
+    std::uint32_t m_rightmost;
+
+private:
+    class ConstIterator
+    {
+        friend class PackedTree;
+    public:
+        using difference_type = std::ptrdiff_t;
+        using value_type = T;
+        using pointer = const T*;
+        using reference = const T&;
+        using iterator_category = std::bidirectional_iterator_tag;
+
+    public:
+        ConstIterator( const PackedTree* tree, std::uint32_t index = PackedNode<T>::none );
+
+        reference operator*() const;
+        pointer operator->() const;
+
+        bool operator==( const ConstIterator& other ) const;
+        bool operator!=( const ConstIterator& other ) const;
+
+        ConstIterator& operator++();
+        ConstIterator operator++( int );
+
+        ConstIterator& operator--();
+        ConstIterator operator--( int );
+
+    private:
+        std::uint32_t next_( std::uint32_t index ) const;
+        std::uint32_t prev_( std::uint32_t index ) const;
+
+    private:
+        const PackedTree* m_tree;
+        std::uint32_t m_index;
+    };
+};
+
+
+template<typename T, typename Less>
+inline PackedTree<T, Less>::PackedTree()
+    : m_less{}
+    , m_storage{}
+    , m_file{}
+    , m_nodes{ nullptr }
+    , m_size{ 0 }
+    , m_leftmost{ PackedNode<T>::none }
+    , m_rightmost{ PackedNode<T>::none }
+{
+}
+
+template<typename T, typename Less>
+template<typename IterType>
+inline PackedTree<T, Less>::PackedTree( SortedRangeTag, const IterType& begin, const IterType& end )
+    : PackedTree()
+{
+    std::vector<const T*> values;
+    for ( auto it = begin; it != end; it = std::next( it ) )
+    {
+        const T& value = *it;
+        if ( values.empty() || m_less( *values.back(), value ) )
+        {
+            values.push_back( &value );
+        }
+    }
+
+    if ( values.size() >= PackedNode<T>::none )
+    {
+        throw std::length_error( "PackedTree can not index so many nodes" );
+    }
+
+    //Ranges of in-order positions are split like in RedBlackTree::from_sorted and numbered breadth first
+    struct Subtree
+    {
+        std::size_t first;
+        std::size_t count;
+        std::uint32_t parent;
+        bool isLeft;
+    };
+
+    m_storage.reserve( values.size() );
+    std::deque<Subtree> queue;
+    if ( !values.empty() )
+    {
+        queue.push_back( { 0, values.size(), PackedNode<T>::none, false } );
+    }
+
+    while ( !queue.empty() )
+    {
+        const auto subtree = queue.front();
+        queue.pop_front();
+
+        const auto index = static_cast<std::uint32_t>( m_storage.size() );
+        const std::size_t leftCount = ( subtree.count - 1 ) / 2;
+        const std::size_t middle = subtree.first + leftCount;
+
+        m_storage.push_back( { *values[middle], PackedNode<T>::none, PackedNode<T>::none, subtree.parent } );
+        if ( subtree.parent != PackedNode<T>::none )
+        {
+            auto& parent = m_storage[subtree.parent];
+            ( subtree.isLeft ? parent.left : parent.right ) = index;
+        }
+
+        if ( leftCount != 0 )
+        {
+            queue.push_back( { subtree.first, leftCount, index, true } );
+        }
+        if ( subtree.count - 1 - leftCount != 0 )
+        {
+            queue.push_back( { middle + 1, subtree.count - 1 - leftCount, index, false } );
+        }
+    }
+
+    attach_( m_storage.data(), m_storage.size() );
+}
+
+template<typename T, typename Less>
+template<typename Allocator, typename Augmentation>
+inline PackedTree<T, Less>::PackedTree( const RedBlackTree<T, Less, Allocator, Augmentation>& tree )
+    : PackedTree( sortedRange, tree.cbegin(), tree.cend() )
+{
+}
+
+template<typename T, typename Less>
+inline PackedTree<T, Less>::PackedTree( const PackedTree& other )
+    : m_less{ other.m_less }
+    , m_storage{ other.m_storage }
+    , m_file{ other.m_file }
+    , m_nodes{ nullptr }
+    , m_size{ 0 }
+    , m_leftmost{ PackedNode<T>::none }
+    , m_rightmost{ PackedNode<T>::none }
+{
+    //a copy of a view is a view of the same block
+    attach_( m_storage.empty() ? other.m_nodes : m_storage.data(), other.m_size );
+}
+
+template<typename T, typename Less>
+inline PackedTree<T, Less>::PackedTree( PackedTree&& other )
+    : m_less{ std::move( other.m_less ) }
+    , m_storage{ std::move( other.m_storage ) }
+    , m_file{ std::move( other.m_file ) }
+    , m_nodes{ other.m_nodes }
+    , m_size{ other.m_size }
+    , m_leftmost{ other.m_leftmost }
+    , m_rightmost{ other.m_rightmost }
+{
+    other.attach_( nullptr, 0 );
+}
+
+template<typename T, typename Less>
+inline PackedTree<T, Less>& PackedTree<T, Less>::operator=( const PackedTree& other )
+{
+    if ( this != &other )
+    {
+        m_less = other.m_less;
+        m_storage = other.m_storage;
+        m_file = other.m_file;
+        attach_( m_storage.empty() ? other.m_nodes : m_storage.data(), other.m_size );
+    }
+
+    return *this;
+}
+
+template<typename T, typename Less>
+inline PackedTree<T, Less>& PackedTree<T, Less>::operator=( PackedTree&& other )
+{
+    if ( this != &other )
+    {
+        m_less = std::move( other.m_less );
+        m_storage = std::move( other.m_storage );
+        m_file = std::move( other.m_file );
+        m_nodes = other.m_nodes;
+        m_size = other.m_size;
+        m_leftmost = other.m_leftmost;
+        m_rightmost = other.m_rightmost;
+        other.attach_( nullptr, 0 );
+    }
+
+    return *this;
+}
+
+template<typename T, typename Less>
+inline PackedTree<T, Less> PackedTree<T, Less>::view( const PackedNode<T>* nodes, std::size_t count )
+{
+    PackedTree<T, Less> tree;
+    tree.attach_( nodes, count );
+    return tree;
+}
+
+template<typename T, typename Less>
+inline void PackedTree<T, Less>::save( const std::string& path ) const
+{
+    static_assert( std::is_trivially_copyable_v<T>, "Only trivially copyable values can be saved as a binary image" );
+
+    const std::size_t bytes = m_size * sizeof( PackedNode<T> );
+
+    PackedFileHeader header{};
+    std::copy( std::begin( PackedFileHeader::expectedMagic ), std::end( PackedFileHeader::expectedMagic ), header.magic );
+    header.version = PackedFileHeader::currentVersion;
+    header.byteOrder = PackedFileHeader::nativeByteOrder;
+    header.nodeSize = sizeof( PackedNode<T> );
+    header.nodeAlign = alignof( PackedNode<T> );
+    header.count = m_size;
+    header.checksum = checksum_( m_nodes, bytes );
+
+    std::ofstream file( path, std::ios::binary | std::ios::trunc );
+    const std::string padding( nodesOffset_() - sizeof( header ), '\0' );
+    file.write( reinterpret_cast<const char*>( &header ), sizeof( header ) );
+    file.write( padding.data(), padding.size() );
+    if ( bytes != 0 )
+    {
+        file.write( reinterpret_cast<const char*>( m_nodes ), bytes );
+    }
+    file.close();
+
+    if ( !file )
+    {
+        throw std::runtime_error( "Can not write " + path );
+    }
+}
+
+template<typename T, typename Less>
+inline PackedTree<T, Less> PackedTree<T, Less>::open_readonly( const std::string& path, bool verifyChecksum )
+{
+    static_assert( std::is_trivially_copyable_v<T>, "Only trivially copyable values can be mapped from a binary image" );
+
+    auto file = std::make_shared<const MappedFile>( path );
+    if ( file->size() < sizeof( PackedFileHeader ) )
+    {
+        throw std::runtime_error( path + " is not a tree image" );
+    }
+
+    PackedFileHeader header;
+    std::memcpy( &header, file->data(), sizeof( header ) );
+    if ( !std::equal( std::begin( header.magic ), std::end( header.magic ), std::begin( PackedFileHeader::expectedMagic ) ) )
+    {
+        throw std::runtime_error( path + " is not a tree image" );
+    }
+    if ( header.version != PackedFileHeader::currentVersion )
+    {
+        throw std::runtime_error( path + " has unsupported version " + std::to_string( header.version ) );
+    }
+    if ( header.byteOrder != PackedFileHeader::nativeByteOrder
+        || header.nodeSize != sizeof( PackedNode<T> ) || header.nodeAlign != alignof( PackedNode<T> ) )
+    {
+        throw std::runtime_error( path + " was saved with a different node layout" );
+    }
+    if ( header.count >= PackedNode<T>::none
+        || file->size() != nodesOffset_() + header.count * sizeof( PackedNode<T> ) )
+    {
+        throw std::runtime_error( path + " is truncated" );
+    }
+
+    const auto nodes = reinterpret_cast<const PackedNode<T>*>( static_cast<const char*>( file->data() ) + nodesOffset_() );
+    const auto count = static_cast<std::size_t>( header.count );
+    if ( verifyChecksum && checksum_( nodes, count * sizeof( PackedNode<T> ) ) != header.checksum )
+    {
+        throw std::runtime_error( path + " is corrupted" );
+    }
+
+    auto tree = view( nodes, count );
+    tree.m_file = std::move( file );
+    return tree;
+}
+
+template<typename T, typename Less>
+inline const PackedNode<T>* PackedTree<T, Less>::data() const
+{
+    return m_nodes;
+}
+
+template<typename T, typename Less>
+inline std::size_t PackedTree<T, Less>::size() const
+{
+    return m_size;
+}
+
+template<typename T, typename Less>
+inline bool PackedTree<T, Less>::empty() const
+{
+    return m_size == 0;
+}
+
+template<typename T, typename Less>
+inline typename PackedTree<T, Less>::iterator PackedTree<T, Less>::begin() const
+{
+    return { this, m_leftmost };
+}
+
+template<typename T, typename Less>
+inline typename PackedTree<T, Less>::iterator PackedTree<T, Less>::end() const
+{
+    return { this };
+}
+
+template<typename T, typename Less>
+inline typename PackedTree<T, Less>::const_iterator PackedTree<T, Less>::cbegin() const
+{
+    return begin();
+}
+
+template<typename T, typename Less>
+inline typename PackedTree<T, Less>::const_iterator PackedTree<T, Less>::cend() const
+{
+    return end();
+}
+
+template<typename T, typename Less>
+inline typename PackedTree<T, Less>::reverse_iterator PackedTree<T, Less>::rbegin() const
+{
+    return reverse_iterator{ end() };
+}
+
+template<typename T, typename Less>
+inline typename PackedTree<T, Less>::reverse_iterator PackedTree<T, Less>::rend() const
+{
+    return reverse_iterator{ begin() };
+}
+
+template<typename T, typename Less>
+inline typename PackedTree<T, Less>::const_iterator PackedTree<T, Less>::find( const T& value ) const
+{
+    const auto it = lower_bound( value );
+    return it.m_index != PackedNode<T>::none && !m_less( value, *it ) ? it : end();
+}
+
+template<typename T, typename Less>
+inline bool PackedTree<T, Less>::contains( const T& value ) const
+{
+    return find( value ) != end();
+}
+
+template<typename T, typename Less>
+inline typename PackedTree<T, Less>::const_iterator PackedTree<T, Less>::lower_bound( const T& value ) const
+{
+    auto result = PackedNode<T>::none;
+    auto current = m_size == 0 ? PackedNode<T>::none : 0;
+
+    while ( current != PackedNode<T>::none )
+    {
+        if ( m_less( m_nodes[current].value, value ) )
+        {
+            current = m_nodes[current].right;
+        }
+        else
+        {
+            result = current;
+            current = m_nodes[current].left;
+        }
+    }
+
+    return { this, result };
+}
+
+template<typename T, typename Less>
+inline typename PackedTree<T, Less>::const_iterator PackedTree<T, Less>::upper_bound( const T& value ) const
+{
+    auto result = PackedNode<T>::none;
+    auto current = m_size == 0 ? PackedNode<T>::none : 0;
+
+    while ( current != PackedNode<T>::none )
+    {
+        if ( m_less( value, m_nodes[current].value ) )
+        {
+            result = current;
+            current = m_nodes[current].left;
+        }
+        else
+        {
+            current = m_nodes[current].right;
+        }
+    }
+
+    return { this, result };
+}
+
+template<typename T, typename Less>
+inline void PackedTree<T, Less>::attach_( const PackedNode<T>* nodes, std::size_t count )
+{
+    m_nodes = count == 0 ? nullptr : nodes;
+    m_size = count;
+    m_leftmost = extreme_( true );
+    m_rightmost = extreme_( false );
+}
+
+template<typename T, typename Less>
+inline std::uint32_t PackedTree<T, Less>::extreme_( bool left ) const
+{
+    if ( m_size == 0 )
+    {
+        return PackedNode<T>::none;
+    }
+
+    std::uint32_t current = 0;
+    for ( auto next = current; next != PackedNode<T>::none; next = left ? m_nodes[current].left : m_nodes[current].right )
+    {
+        current = next;
+    }
+
+    return current;
+}
+
+template<typename T, typename Less>
+inline std::size_t PackedTree<T, Less>::nodesOffset_()
+{
+    constexpr std::size_t align = alignof( PackedNode<T> );
+    return ( sizeof( PackedFileHeader ) + align - 1 ) / align * align;
+}
+
+template<typename T, typename Less>
+inline std::uint64_t PackedTree<T, Less>::checksum_( const void* data, std::size_t bytes )
+{
+    std::uint64_t hash = 0xcbf29ce484222325ull;
+    const auto begin = static_cast<const unsigned char*>( data );
+    for ( std::size_t i = 0; i < bytes; ++i )
+    {
+        hash = ( hash ^ begin[i] ) * 0x100000001b3ull;
+    }
+
+    return hash;
+}
+
+template<typename T, typename Less>
+inline PackedTree<T, Less>::ConstIterator::ConstIterator( const PackedTree* tree, std::uint32_t index )
+    : m_tree( tree )
+    , m_index( index )
+{
+}
+
+template<typename T, typename Less>
+inline typename PackedTree<T, Less>::ConstIterator::reference PackedTree<T, Less>::ConstIterator::operator*() const
+{
+    if ( m_index == PackedNode<T>::none )
+    {
+        throw std::out_of_range( "Attempt to dereference end() iterator" );
+    }
+    return m_tree->m_nodes[m_index].value;
+}
+
+template<typename T, typename Less>
+inline typename PackedTree<T, Less>::ConstIterator::pointer PackedTree<T, Less>::ConstIterator::operator->() const
+{
+    return &**this;
+}
+
+template<typename T, typename Less>
+inline bool PackedTree<T, Less>::ConstIterator::operator==( const ConstIterator& other ) const
+{
+    return m_tree == other.m_tree && m_index == other.m_index;
+}
+
+template<typename T, typename Less>
+inline bool PackedTree<T, Less>::ConstIterator::operator!=( const ConstIterator& other ) const
+{
+    return !( *this == other );
+}
+
+template<typename T, typename Less>
+inline typename PackedTree<T, Less>::ConstIterator& PackedTree<T, Less>::ConstIterator::operator++()
+{
+    m_index = next_( m_index );
+    return *this;
+}
+
+template<typename T, typename Less>
+inline typename PackedTree<T, Less>::ConstIterator PackedTree<T, Less>::ConstIterator::operator++( int )
+{
+    auto copy = *this;
+    m_index = next_( m_index );
+    return copy;
+}
+
+template<typename T, typename Less>
+inline typename PackedTree<T, Less>::ConstIterator& PackedTree<T, Less>::ConstIterator::operator--()
+{
+    m_index = prev_( m_index );
+    return *this;
+}
+
+template<typename T, typename Less>
+inline typename PackedTree<T, Less>::ConstIterator PackedTree<T, Less>::ConstIterator::operator--( int )
+{
+    auto copy = *this;
+    m_index = prev_( m_index );
+    return copy;
+}
+
+template<typename T, typename Less>
+inline std::uint32_t PackedTree<T, Less>::ConstIterator::next_( std::uint32_t index ) const
+{
+    if ( index == PackedNode<T>::none )
+    {
+        throw std::out_of_range( "Can not increment end() iterator" );
+    }
+
+    const auto nodes = m_tree->m_nodes;
+    if ( nodes[index].right != PackedNode<T>::none )
+    {
+        index = nodes[index].right;
+        while ( nodes[index].left != PackedNode<T>::none )
+        {
+            index = nodes[index].left;
+        }
+        return index;
+    }
+
+    //climb while coming from a right child
+    auto parent = nodes[index].parent;
+    while ( parent != PackedNode<T>::none && nodes[parent].right == index )
+    {
+        index = parent;
+        parent = nodes[index].parent;
+    }
+
+    return parent;
+}
+
+template<typename T, typename Less>
+inline std::uint32_t PackedTree<T, Less>::ConstIterator::prev_( std::uint32_t index ) const
+{
+    if ( index == PackedNode<T>::none )
+    {
+        return m_tree->m_rightmost;
+    }
+
+    const auto nodes = m_tree->m_nodes;
+    if ( nodes[index].left != PackedNode<T>::none )
+    {
+        index = nodes[index].left;
+        while ( nodes[index].right != PackedNode<T>::none )
+        {
+            index = nodes[index].right;
+        }
+        return index;
+    }
+
+    auto parent = nodes[index].parent;
+    while ( parent != PackedNode<T>::none && nodes[parent].left == index )
+    {
+        index = parent;
+        parent = nodes[index].parent;
+    }
+
+    return parent;
+}
@@ -0,0 +1,884 @@
+#pragma once
+
+#include <atomic>
+#include <optional>
+#include "redblacktree.h"
+
+//Node of a PersistentRedBlackTree. Nodes may be shared by several trees and have no parent link;
+//the count includes every tree root and every parent node pointing at it.
+template<typename T>
+struct PersistentNode
+{
+public:
+    PersistentNode( const T& value, Color color, PersistentNode* left, PersistentNode* right );
+
+    template<typename... Args>
+    explicit PersistentNode( std::in_place_t, Args&&... args );
+
+    Color color() const;
+    void setColor( Color color );
+
+public:
+    T value;
+
+    PersistentNode* left;
+    PersistentNode* right;
+
+    std::atomic<std::uint32_t> references;
+
+private:
+    Color m_color;
+};
+
+//Sorted set whose copies share structure. A copy takes O(1): it only references the same root.
+//A mutation copies the nodes on its path that are shared with another tree, O(log n) of them,
+//and updates nodes it owns alone in place, so a tree that is never copied does not allocate more than RedBlackTree.
+//Balanced as a left-leaning red-black tree, whose rebalancing needs no parent links.
+//
+//Copies are independent values: snapshots can be handed to other threads while the original keeps changing.
+//Shared nodes are then freed by whichever tree drops them last, so the allocator must be thread safe,
+//and copies always keep the allocator of the tree they were copied from.
+//Mutations invalidate the iterators of the mutated tree only.
+template<typename T, typename Less = std::less<T>, typename Allocator = std::allocator<T>>
+class PersistentRedBlackTree
+{
+private:
+    class ConstIterator;
+    using NodeType = PersistentNode<T>;
+    using NodeAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<NodeType>;
+    using NodeAllocatorTraits = std::allocator_traits<NodeAllocator>;
+
+public:
+    friend class RedBlackTreeTest;
+
+    using value_type = T;
+    using allocator_type = Allocator;
+    using const_reference = const T&;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using iterator = ConstIterator;
+    using const_iterator = ConstIterator;
+    using reverse_iterator = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+public:
+    PersistentRedBlackTree();
+    explicit PersistentRedBlackTree( const Allocator& allocator );
+    PersistentRedBlackTree( const std::initializer_list<T>& values, const Allocator& allocator = Allocator() );
+
+    template<typename IterType>
+    PersistentRedBlackTree( const IterType& begin, const IterType& end, const Allocator& allocator = Allocator() );
+
+    PersistentRedBlackTree( const PersistentRedBlackTree& other );
+    PersistentRedBlackTree( PersistentRedBlackTree&& other );
+
+    PersistentRedBlackTree& operator=( const PersistentRedBlackTree& other );
+    PersistentRedBlackTree& operator=( PersistentRedBlackTree&& other );
+
+    ~PersistentRedBlackTree();
+
+    allocator_type get_allocator() const;
+
+    const_iterator insert( const T& value );
+    const_iterator insert( T&& value );
+
+    //returns the iterator following the removed value
+    iterator erase( const T& value );
+
+    void clear();
+
+    std::size_t size() const;
+    bool empty() const;
+
+    bool operator==( const PersistentRedBlackTree& other ) const;
+    bool operator!=( const PersistentRedBlackTree& other ) const;
+
+    iterator begin() const;
+    iterator end() const;
+
+    const_iterator cbegin() const;
+    const_iterator cend() const;
+
+    reverse_iterator rbegin() const;
+    reverse_iterator rend() const;
+
+    const_iterator find( const T& value ) const;
+    size_type count( const T& value ) const;
+    bool contains( const T& value ) const;
+
+    const_iterator lower_bound( const T& value ) const;
+    const_iterator upper_bound( const T& value ) const;
+
+private:
+    template<typename Value>
+    const_iterator insertValue_( Value&& value );
+
+    template<typename... Args>
+    NodeType* createNode_( Args&&... args );
+    static void retain_( NodeType* node );
+    void release_( NodeType* node );
+
+    //the node itself if this tree is its only owner, a private copy of it otherwise
+    NodeType* own_( NodeType* node );
+
+    template<typename Value>
+    NodeType* insert_( NodeType* node, Value&& value, const NodeType*& inserted );
+    NodeType* erase_( NodeType* node, const T& value );
+    NodeType* eraseMin_( NodeType* node, std::optional<T>& minimum );
+
+    static bool isRed_( const NodeType* node );
+    NodeType* rotateLeft_( NodeType* node );
+    NodeType* rotateRight_( NodeType* node );
+    void flipColors_( NodeType* node );
+    NodeType* moveRedLeft_( NodeType* node );
+    NodeType* moveRedRight_( NodeType* node );
+    NodeType* fixUp_( NodeType* node );
+    void paintRootBlack_();
+
+    template<typename IsLeft>
+    const_iterator bound_( const IsLeft& isLeft ) const;
+
+private:
+    Less m_less;
+    NodeAllocator m_nodeAllocator;
+    NodeType* m_root;
+    std::size_t m_size;
+
+private:
+    //Keeps the path from the root, as nodes have no parent links
+    class ConstIterator
+    {
+        friend class PersistentRedBlackTree;
+    public:
+        using difference_type = std::ptrdiff_t;
+        using value_type = T;
+        using pointer = const T*;
+        using reference = const T&;
+        using iterator_category = std::bidirectional_iterator_tag;
+
+    public:
+        explicit ConstIterator( const PersistentRedBlackTree* tree, std::vector<const NodeType*> path = {} );
+
+        reference operator*() const;
+        pointer operator->() const;
+
+        bool operator==( const ConstIterator& other ) const;
+        bool operator!=( const ConstIterator& other ) const;
+
+        ConstIterator& operator++();
+        ConstIterator operator++( int );
+
+        ConstIterator& operator--();
+        ConstIterator operator--( int );
+
+    private:
+        void descend_( const NodeType* node, bool left );
+
+    private:
+        const PersistentRedBlackTree* m_tree;
+        std::vector<const NodeType*> m_path;
+    };
+};
+
+
+template<typename T>
+inline PersistentNode<T>::PersistentNode( const T& value, Color color, PersistentNode* left, PersistentNode* right )
+    : value{ value }
+    , left{ left }
+    , right{ right }
+    , references{ 1 }
+    , m_color{ color }
+{
+}
+
+template<typename T>
+template<typename... Args>
+inline PersistentNode<T>::PersistentNode( std::in_place_t, Args&&... args )
+    : value( std::forward<Args>( args )... )
+    , left{ nullptr }
+    , right{ nullptr }
+    , references{ 1 }
+    , m_color{ Color::Red }
+{
+}
+
+template<typename T>
+inline Color PersistentNode<T>::color() const
+{
+    return m_color;
+}
+
+template<typename T>
+inline void PersistentNode<T>::setColor( Color color )
+{
+    m_color = color;
+}
+
+template<typename T, typename Less, typename Allocator>
+inline PersistentRedBlackTree<T, Less, Allocator>::PersistentRedBlackTree()
+    : PersistentRedBlackTree( Allocator() )
+{
+}
+
+template<typename T, typename Less, typename Allocator>
+inline PersistentRedBlackTree<T, Less, Allocator>::PersistentRedBlackTree( const Allocator& allocator )
+    : m_less{}
+    , m_nodeAllocator{ allocator }
+    , m_root{ nullptr }
+    , m_size{ 0 }
+{
+}
+
+template<typename T, typename Less, typename Allocator>
+inline PersistentRedBlackTree<T, Less, Allocator>::PersistentRedBlackTree( const std::initializer_list<T>& values, const Allocator& allocator )
+    : PersistentRedBlackTree( std::cbegin( values ), std::cend( values ), allocator )
+{
+}
+
+template<typename T, typename Less, typename Allocator>
+template<typename IterType>
+inline PersistentRedBlackTree<T, Less, Allocator>::PersistentRedBlackTree( const IterType& begin, const IterType& end, const Allocator& allocator )
+    : PersistentRedBlackTree( allocator )
+{
+    for ( auto it = begin; it != end; it = std::next( it ) )
+    {
+        insert( *it );
+    }
+}
+
+template<typename T, typename Less, typename Allocator>
+inline PersistentRedBlackTree<T, Less, Allocator>::PersistentRedBlackTree( const PersistentRedBlackTree& other )
+    : m_less{ other.m_less }
+    , m_nodeAllocator{ other.m_nodeAllocator }
+    , m_root{ other.m_root }
+    , m_size{ other.m_size }
+{
+    retain_( m_root );
+}
+
+template<typename T, typename Less, typename Allocator>
+inline PersistentRedBlackTree<T, Less, Allocator>::PersistentRedBlackTree( PersistentRedBlackTree&& other )
+    : m_less{ std::move( other.m_less ) }
+    , m_nodeAllocator{ other.m_nodeAllocator }
+    , m_root{ other.m_root }
+    , m_size{ other.m_size }
+{
+    other.m_root = nullptr;
+    other.m_size = 0;
+}
+
+template<typename T, typename Less, typename Allocator>
+inline PersistentRedBlackTree<T, Less, Allocator>& PersistentRedBlackTree<T, Less, Allocator>::operator=( const PersistentRedBlackTree& other )
+{
+    if ( this == &other )
+    {
+        return *this;
+    }
+
+    //retained before the old root is dropped, they may share nodes
+    retain_( other.m_root );
+    clear();
+    m_less = other.m_less;
+    m_nodeAllocator = other.m_nodeAllocator;
+    m_root = other.m_root;
+    m_size = other.m_size;
+
+    return *this;
+}
+
+template<typename T, typename Less, typename Allocator>
+inline PersistentRedBlackTree<T, Less, Allocator>& PersistentRedBlackTree<T, Less, Allocator>::operator=( PersistentRedBlackTree&& other )
+{
+    if ( this == &other )
+    {
+        return *this;
+    }
+
+    clear();
+    m_less = std::move( other.m_less );
+    m_nodeAllocator = other.m_nodeAllocator;
+    m_root = other.m_root;
+    m_size = other.m_size;
+    other.m_root = nullptr;
+    other.m_size = 0;
+
+    return *this;
+}
+
+template<typename T, typename Less, typename Allocator>
+inline PersistentRedBlackTree<T, Less, Allocator>::~PersistentRedBlackTree()
+{
+    clear();
+}
+
+template<typename T, typename Less, typename Allocator>
+inline typename PersistentRedBlackTree<T, Less, Allocator>::allocator_type PersistentRedBlackTree<T, Less, Allocator>::get_allocator() const
+{
+    return allocator_type( m_nodeAllocator );
+}
+
+template<typename T, typename Less, typename Allocator>
+inline typename PersistentRedBlackTree<T, Less, Allocator>::const_iterator PersistentRedBlackTree<T, Less, Allocator>::insert( const T& value )
+{
+    return insertValue_( value );
+}
+
+template<typename T, typename Less, typename Allocator>
+inline typename PersistentRedBlackTree<T, Less, Allocator>::const_iterator PersistentRedBlackTree<T, Less, Allocator>::insert( T&& value )
+{
+    return insertValue_( std::move( value ) );
+}
+
+template<typename T, typename Less, typename Allocator>
+inline typename PersistentRedBlackTree<T, Less, Allocator>::iterator PersistentRedBlackTree<T, Less, Allocator>::erase( const T& value )
+{
+    //checked first: the descent below copies shared nodes and would do it for nothing
+    if ( !contains( value ) )
+    {
+        return upper_bound( value );
+    }
+
+    m_root = erase_( m_root, value );
+    --m_size;
+    paintRootBlack_();
+
+    return upper_bound( value );
+}
+
+template<typename T, typename Less, typename Allocator>
+inline void PersistentRedBlackTree<T, Less, Allocator>::clear()
+{
+    release_( m_root );
+    m_root = nullptr;
+    m_size = 0;
+}
+
+template<typename T, typename Less, typename Allocator>
+inline std::size_t PersistentRedBlackTree<T, Less, Allocator>::size() const
+{
+    return m_size;
+}
+
+template<typename T, typename Less, typename Allocator>
+inline bool PersistentRedBlackTree<T, Less, Allocator>::empty() const
+{
+    return m_size == 0;
+}
+
+template<typename T, typename Less, typename Allocator>
+inline bool PersistentRedBlackTree<T, Less, Allocator>::operator==( const PersistentRedBlackTree& other ) const
+{
+    return size() == other.size() && ( m_root == other.m_root || std::equal( begin(), end(), other.begin() ) );
+}
+
+template<typename T, typename Less, typename Allocator>
+inline bool PersistentRedBlackTree<T, Less, Allocator>::operator!=( const PersistentRedBlackTree& other ) const
+{
+    return !( *this == other );
+}
+
+template<typename T, typename Less, typename Allocator>
+inline typename PersistentRedBlackTree<T, Less, Allocator>::iterator PersistentRedBlackTree<T, Less, Allocator>::begin() const
+{
+    ConstIterator it( this );
+    it.descend_( m_root, true );
+    return it;
+}
+
+template<typename T, typename Less, typename Allocator>
+inline typename PersistentRedBlackTree<T, Less, Allocator>::iterator PersistentRedBlackTree<T, Less, Allocator>::end() const
+{
+    return ConstIterator( this );
+}
+
+template<typename T, typename Less, typename Allocator>
+inline typename PersistentRedBlackTree<T, Less, Allocator>::const_iterator PersistentRedBlackTree<T, Less, Allocator>::cbegin() const
+{
+    return begin();
+}
+
+template<typename T, typename Less, typename Allocator>
+inline typename PersistentRedBlackTree<T, Less, Allocator>::const_iterator PersistentRedBlackTree<T, Less, Allocator>::cend() const
+{
+    return end();
+}
+
+template<typename T, typename Less, typename Allocator>
+inline typename PersistentRedBlackTree<T, Less, Allocator>::reverse_iterator PersistentRedBlackTree<T, Less, Allocator>::rbegin() const
+{
+    return reverse_iterator{ end() };
+}
+
+template<typename T, typename Less, typename Allocator>
+inline typename PersistentRedBlackTree<T, Less, Allocator>::reverse_iterator PersistentRedBlackTree<T, Less, Allocator>::rend() const
+{
+    return reverse_iterator{ begin() };
+}
+
+template<typename T, typename Less, typename Allocator>
+inline typename PersistentRedBlackTree<T, Less, Allocator>::const_iterator PersistentRedBlackTree<T, Less, Allocator>::find( const T& value ) const
+{
+    const auto it = lower_bound( value );
+    return it != end() && !m_less( value, *it ) ? it : end();
+}
+
+template<typename T, typename Less, typename Allocator>
+inline typename PersistentRedBlackTree<T, Less, Allocator>::size_type PersistentRedBlackTree<T, Less, Allocator>::count( const T& value ) const
+{
+    return contains( value ) ? 1 : 0;
+}
+
+template<typename T, typename Less, typename Allocator>
+inline bool PersistentRedBlackTree<T, Less, Allocator>::contains( const T& value ) const
+{
+    const NodeType* node = m_root;
+    while ( node != nullptr )
+    {
+        if ( m_less( value, node->value ) )
+        {
+            node = node->left;
+        }
+        else if ( m_less( node->value, value ) )
+        {
+            node = node->right;
+        }
+        else
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+template<typename T, typename Less, typename Allocator>
+inline typename PersistentRedBlackTree<T, Less, Allocator>::const_iterator PersistentRedBlackTree<T, Less, Allocator>::lower_bound( const T& value ) const
+{
+    return bound_( [this, &value]( const T& current )
+    {
+        return !m_less( current, value );
+    } );
+}
+
+template<typename T, typename Less, typename Allocator>
+inline typename PersistentRedBlackTree<T, Less, Allocator>::const_iterator PersistentRedBlackTree<T, Less, Allocator>::upper_bound( const T& value ) const
+{
+    return bound_( [this, &value]( const T& current )
+    {
+        return m_less( value, current );
+    } );
+}
+
+template<typename T, typename Less, typename Allocator>
+template<typename IsLeft>
+inline typename PersistentRedBlackTree<T, Less, Allocator>::const_iterator PersistentRedBlackTree<T, Less, Allocator>::bound_( const IsLeft& isLeft ) const
+{
+    //the bound is the last node where the descent turned left; the path is cut right below it
+    std::vector<const NodeType*> path;
+    std::size_t boundDepth = 0;
+
+    for ( const NodeType* node = m_root; node != nullptr; )
+    {
+        path.push_back( node );
+        if ( isLeft( node->value ) )
+        {
+            boundDepth = path.size();
+            node = node->left;
+        }
+        else
+        {
+            node = node->right;
+        }
+    }
+
+    path.resize( boundDepth );
+    return ConstIterator( this, std::move( path ) );
+}
+
+template<typename T, typename Less, typename Allocator>
+template<typename Value>
+inline typename PersistentRedBlackTree<T, Less, Allocator>::const_iterator PersistentRedBlackTree<T, Less, Allocator>::insertValue_( Value&& value )
+{
+    //checked first: the descent below copies shared nodes and would do it for nothing
+    auto existing = find( value );
+    if ( existing != end() )
+    {
+        return existing;
+    }
+
+    //the new node keeps its address through the rebalancing: it is owned by this tree alone
+    const NodeType* inserted = nullptr;
+    m_root = insert_( m_root, std::forward<Value>( value ), inserted );
+    ++m_size;
+    paintRootBlack_();
+
+    return find( inserted->value );
+}
+
+template<typename T, typename Less, typename Allocator>
+template<typename... Args>
+inline typename PersistentRedBlackTree<T, Less, Allocator>::NodeType* PersistentRedBlackTree<T, Less, Allocator>::createNode_( Args&&... args )
+{
+    NodeType* node = NodeAllocatorTraits::allocate( m_nodeAllocator, 1 );
+    try
+    {
+        NodeAllocatorTraits::construct( m_nodeAllocator, node, std::forward<Args>( args )... );
+    }
+    catch ( ... )
+    {
+        NodeAllocatorTraits::deallocate( m_nodeAllocator, node, 1 );
+        throw;
+    }
+
+    return node;
+}
+
+template<typename T, typename Less, typename Allocator>
+inline void PersistentRedBlackTree<T, Less, Allocator>::retain_( NodeType* node )
+{
+    if ( node != nullptr )
+    {
+        node->references.fetch_add( 1, std::memory_order_relaxed );
+    }
+}
+
+template<typename T, typename Less, typename Allocator>
+inline void PersistentRedBlackTree<T, Less, Allocator>::release_( NodeType* node )
+{
+    //the last owner of a node frees it and drops its references to the children
+    while ( node != nullptr && node->references.fetch_sub( 1, std::memory_order_acq_rel ) == 1 )
+    {
+        release_( node->left );
+        auto right = node->right;
+
+        NodeAllocatorTraits::destroy( m_nodeAllocator, node );
+        NodeAllocatorTraits::deallocate( m_nodeAllocator, node, 1 );
+
+        node = right;
+    }
+}
+
+template<typename T, typename Less, typename Allocator>
+inline typename PersistentRedBlackTree<T, Less, Allocator>::NodeType* PersistentRedBlackTree<T, Less, Allocator>::own_( NodeType* node )
+{
+    //A count of one can not grow behind our back: no other tree reaches the node
+    if ( node == nullptr || node->references.load( std::memory_order_acquire ) == 1 )
+    {
+        return node;
+    }
+
+    auto copy = createNode_( node->value, node->color(), node->left, node->right );
+    retain_( copy->left );
+    retain_( copy->right );
+    release_( node );
+
+    return copy;
+}
+
+template<typename T, typename Less, typename Allocator>
+template<typename Value>
+inline typename PersistentRedBlackTree<T, Less, Allocator>::NodeType* PersistentRedBlackTree<T, Less, Allocator>::insert_( NodeType* node,
+    Value&& value, const NodeType*& inserted )
+{
+    if ( node == nullptr )
+    {
+        auto leaf = createNode_( std::in_place, std::forward<Value>( value ) );
+        inserted = leaf;
+        return leaf;
+    }
+
+    node = own_( node );
+    if ( m_less( value, node->value ) )
+    {
+        node->left = insert_( node->left, std::forward<Value>( value ), inserted );
+    }
+    else
+    {
+        node->right = insert_( node->right, std::forward<Value>( value ), inserted );
+    }
+
+    return fixUp_( node );
+}
+
+template<typename T, typename Less, typename Allocator>
+inline typename PersistentRedBlackTree<T, Less, Allocator>::NodeType* PersistentRedBlackTree<T, Less, Allocator>::erase_( NodeType* node, const T& value )
+{
+    //value is known to be in the subtree. Every step keeps the current node or its left child red,
+    //so the removed leaf is red and no black height changes.
+    node = own_( node );
+
+    if ( m_less( value, node->value ) )
+    {
+        if ( !isRed_( node->left ) && !isRed_( node->left->left ) )
+        {
+            node = moveRedLeft_( node );
+        }
+        node->left = erase_( node->left, value );
+        return fixUp_( node );
+    }
+
+    if ( isRed_( node->left ) )
+    {
+        node = rotateRight_( node );
+    }
+    if ( !m_less( node->value, value ) && node->right == nullptr )
+    {
+        release_( node );
+        return nullptr;
+    }
+    if ( !isRed_( node->right ) && !isRed_( node->right->left ) )
+    {
+        node = moveRedRight_( node );
+    }
+
+    if ( !m_less( node->value, value ) )
+    {
+        //replaced by its successor, which is removed from the right subtree instead
+        std::optional<T> successor;
+        node->right = eraseMin_( node->right, successor );
+        node->value = std::move( *successor );
+    }
+    else
+    {
+        node->right = erase_( node->right, value );
+    }
+
+    return fixUp_( node );
+}
+
+template<typename T, typename Less, typename Allocator>
+inline typename PersistentRedBlackTree<T, Less, Allocator>::NodeType* PersistentRedBlackTree<T, Less, Allocator>::eraseMin_( NodeType* node,
+    std::optional<T>& minimum )
+{
+    node = own_( node );
+    if ( node->left == nullptr )
+    {
+        minimum.emplace( std::move( node->value ) );
+        release_( node );
+        return nullptr;
+    }
+
+    if ( !isRed_( node->left ) && !isRed_( node->left->left ) )
+    {
+        node = moveRedLeft_( node );
+    }
+    node->left = eraseMin_( node->left, minimum );
+
+    return fixUp_( node );
+}
+
+template<typename T, typename Less, typename Allocator>
+inline bool PersistentRedBlackTree<T, Less, Allocator>::isRed_( const NodeType* node )
+{
+    return node != nullptr && node->color() == Color::Red;
+}
+
+template<typename T, typename Less, typename Allocator>
+inline typename PersistentRedBlackTree<T, Less, Allocator>::NodeType* PersistentRedBlackTree<T, Less, Allocator>::rotateLeft_( NodeType* node )
+{
+    //node is owned; its right child changes links, so it is owned too
+    auto right = own_( node->right );
+    node->right = right->left;
+    right->left = node;
+    right->setColor( node->color() );
+    node->setColor( Color::Red );
+
+    return right;
+}
+
+template<typename T, typename Less, typename Allocator>
+inline typename PersistentRedBlackTree<T, Less, Allocator>::NodeType* PersistentRedBlackTree<T, Less, Allocator>::rotateRight_( NodeType* node )
+{
+    auto left = own_( node->left );
+    node->left = left->right;
+    left->right = node;
+    left->setColor( node->color() );
+    node->setColor( Color::Red );
+
+    return left;
+}
+
+template<typename T, typename Less, typename Allocator>
+inline void PersistentRedBlackTree<T, Less, Allocator>::flipColors_( NodeType* node )
+{
+    const auto flip = []( NodeType* flipped )
+    {
+        flipped->setColor( flipped->color() == Color::Red ? Color::Black : Color::Red );
+    };
+
+    node->left = own_( node->left );
+    node->right = own_( node->right );
+    flip( node );
+    flip( node->left );
+    flip( node->right );
+}
+
+template<typename T, typename Less, typename Allocator>
+inline typename PersistentRedBlackTree<T, Less, Allocator>::NodeType* PersistentRedBlackTree<T, Less, Allocator>::moveRedLeft_( NodeType* node )
+{
+    flipColors_( node );
+    if ( isRed_( node->right->left ) )
+    {
+        node->right = rotateRight_( node->right );
+        node = rotateLeft_( node );
+        flipColors_( node );
+    }
+
+    return node;
+}
+
+template<typename T, typename Less, typename Allocator>
+inline typename PersistentRedBlackTree<T, Less, Allocator>::NodeType* PersistentRedBlackTree<T, Less, Allocator>::moveRedRight_( NodeType* node )
+{
+    flipColors_( node );
+    if ( isRed_( node->left->left ) )
+    {
+        node = rotateRight_( node );
+        flipColors_( node );
+    }
+
+    return node;
+}
+
+template<typename T, typename Less, typename Allocator>
+inline typename PersistentRedBlackTree<T, Less, Allocator>::NodeType* PersistentRedBlackTree<T, Less, Allocator>::fixUp_( NodeType* node )
+{
+    if ( isRed_( node->right ) && !isRed_( node->left ) )
+    {
+        node = rotateLeft_( node );
+    }
+    if ( isRed_( node->left ) && isRed_( node->left->left ) )
+    {
+        node = rotateRight_( node );
+    }
+    if ( isRed_( node->left ) && isRed_( node->right ) )
+    {
+        flipColors_( node );
+    }
+
+    return node;
+}
+
+template<typename T, typename Less, typename Allocator>
+inline void PersistentRedBlackTree<T, Less, Allocator>::paintRootBlack_()
+{
+    if ( isRed_( m_root ) )
+    {
+        m_root = own_( m_root );
+        m_root->setColor( Color::Black );
+    }
+}
+
+template<typename T, typename Less, typename Allocator>
+inline PersistentRedBlackTree<T, Less, Allocator>::ConstIterator::ConstIterator( const PersistentRedBlackTree* tree, std::vector<const NodeType*> path )
+    : m_tree( tree )
+    , m_path( std::move( path ) )
+{
+}
+
+template<typename T, typename Less, typename Allocator>
+inline typename PersistentRedBlackTree<T, Less, Allocator>::ConstIterator::reference PersistentRedBlackTree<T, Less, Allocator>::ConstIterator::operator*() const
+{
+    if ( m_path.empty() )
+    {
+        throw std::out_of_range( "Attempt to dereference end() iterator" );
+    }
+    return m_path.back()->value;
+}
+
+template<typename T, typename Less, typename Allocator>
+inline typename PersistentRedBlackTree<T, Less, Allocator>::ConstIterator::pointer PersistentRedBlackTree<T, Less, Allocator>::ConstIterator::operator->() const
+{
+    return &**this;
+}
+
+template<typename T, typename Less, typename Allocator>
+inline bool PersistentRedBlackTree<T, Less, Allocator>::ConstIterator::operator==( const ConstIterator& other ) const
+{
+    const NodeType* node = m_path.empty() ? nullptr : m_path.back();
+    const NodeType* otherNode = other.m_path.empty() ? nullptr : other.m_path.back();
+    return m_tree == other.m_tree && node == otherNode;
+}
+
+template<typename T, typename Less, typename Allocator>
+inline bool PersistentRedBlackTree<T, Less, Allocator>::ConstIterator::operator!=( const ConstIterator& other ) const
+{
+    return !( *this == other );
+}
+
+template<typename T, typename Less, typename Allocator>
+inline typename PersistentRedBlackTree<T, Less, Allocator>::ConstIterator& PersistentRedBlackTree<T, Less, Allocator>::ConstIterator::operator++()
+{
+    if ( m_path.empty() )
+    {
+        throw std::out_of_range( "Can not increment end() iterator" );
+    }
+
+    if ( m_path.back()->right != nullptr )
+    {
+        descend_( m_path.back()->right, true );
+        return *this;
+    }
+
+    //climb while coming from a right child
+    const NodeType* child;
+    do
+    {
+        child = m_path.back();
+        m_path.pop_back();
+    }
+    while ( !m_path.empty() && m_path.back()->right == child );
+
+    return *this;
+}
+
+template<typename T, typename Less, typename Allocator>
+inline typename PersistentRedBlackTree<T, Less, Allocator>::ConstIterator PersistentRedBlackTree<T, Less, Allocator>::ConstIterator::operator++( int )
+{
+    auto copy = *this;
+    ++*this;
+    return copy;
+}
+
+template<typename T, typename Less, typename Allocator>
+inline typename PersistentRedBlackTree<T, Less, Allocator>::ConstIterator& PersistentRedBlackTree<T, Less, Allocator>::ConstIterator::operator--()
+{
+    if ( m_path.empty() )
+    {
+        descend_( m_tree->m_root, false );
+        return *this;
+    }
+
+    if ( m_path.back()->left != nullptr )
+    {
+        descend_( m_path.back()->left, false );
+        return *this;
+    }
+
+    const NodeType* child;
+    do
+    {
+        child = m_path.back();
+        m_path.pop_back();
+    }
+    while ( !m_path.empty() && m_path.back()->left == child );
+
+    return *this;
+}
+
+template<typename T, typename Less, typename Allocator>
+inline typename PersistentRedBlackTree<T, Less, Allocator>::ConstIterator PersistentRedBlackTree<T, Less, Allocator>::ConstIterator::operator--( int )
+{
+    auto copy = *this;
+    --*this;
+    return copy;
+}
+
+template<typename T, typename Less, typename Allocator>
+inline void PersistentRedBlackTree<T, Less, Allocator>::ConstIterator::descend_( const NodeType* node, bool left )
+{
+    for ( ; node != nullptr; node = left ? node->left : node->right )
+    {
+        m_path.push_back( node );
+    }
+}
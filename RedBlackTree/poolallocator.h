@@ -0,0 +1,324 @@
+#pragma once
+#include <memory>
+#include <vector>
+#include <new>
+
+//Storage shared by all rebound copies of one PoolAllocator.
+//Blocks of a single size are carved from contiguous chunks and recycled through an intrusive free list.
+class Pool
+{
+public:
+    explicit Pool( std::size_t blocksPerChunk );
+    ~Pool();
+
+    Pool( const Pool& ) = delete;
+    Pool& operator=( const Pool& ) = delete;
+
+    bool owns( std::size_t blockSize, std::size_t blockAlign ) const;
+    std::size_t blocksPerChunk() const;
+
+    void* allocate( std::size_t blockSize, std::size_t blockAlign );
+    void deallocate( void* block );
+
+    void reserve( std::size_t blockSize, std::size_t blockAlign, std::size_t count );
+    void release();
+
+    std::size_t allocated() const;
+
+private:
+    struct FreeBlock
+    {
+        FreeBlock* next;
+    };
+
+    struct Chunk
+    {
+        void* memory;
+        std::size_t bytes;
+    };
+
+    void setBlockSize_( std::size_t blockSize, std::size_t blockAlign );
+    void addChunk_( std::size_t blocks );
+
+private:
+    std::size_t m_blocksPerChunk;
+    std::size_t m_objectSize;
+    std::size_t m_objectAlign;
+    std::size_t m_blockSize;
+    std::size_t m_blockAlign;
+
+    std::vector<Chunk> m_chunks;
+    FreeBlock* m_freeList;
+    char* m_cursor;
+    char* m_end;
+
+    std::size_t m_allocated;
+};
+
+//Slab allocator for tree nodes.
+//Single-object allocations are served from the pool, everything else goes to the global operator new.
+//Not thread safe: every tree should own its own pool.
+template<typename T>
+class PoolAllocator
+{
+    template<typename U>
+    friend class PoolAllocator;
+
+public:
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::false_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+    using is_always_equal = std::false_type;
+
+    static constexpr std::size_t defaultBlocksPerChunk = 4096;
+
+public:
+    explicit PoolAllocator( std::size_t blocksPerChunk = defaultBlocksPerChunk );
+    PoolAllocator( const PoolAllocator& other ) = default;
+
+    template<typename U>
+    PoolAllocator( const PoolAllocator<U>& other );
+
+    PoolAllocator& operator=( const PoolAllocator& other ) = default;
+
+    T* allocate( std::size_t n );
+    void deallocate( T* pointer, std::size_t n );
+
+    //Makes room for count single-object allocations in one contiguous chunk.
+    void reserve( std::size_t count );
+
+    //Frees every chunk at once. Blocks handed out before the call become dangling,
+    //so the caller must have destroyed all objects living in them.
+    void release();
+
+    //Number of blocks currently handed out by the pool.
+    std::size_t allocated() const;
+
+    //Whether single objects of T are served from the pool; false once its block size was claimed by another type.
+    bool owns() const;
+
+    PoolAllocator select_on_container_copy_construction() const;
+
+    template<typename U>
+    bool operator==( const PoolAllocator<U>& other ) const;
+
+    template<typename U>
+    bool operator!=( const PoolAllocator<U>& other ) const;
+
+private:
+    std::shared_ptr<Pool> m_pool;
+};
+
+
+inline Pool::Pool( std::size_t blocksPerChunk )
+    : m_blocksPerChunk{ blocksPerChunk == 0 ? 1 : blocksPerChunk }
+    , m_objectSize{ 0 }
+    , m_objectAlign{ 0 }
+    , m_blockSize{ 0 }
+    , m_blockAlign{ 0 }
+    , m_freeList{ nullptr }
+    , m_cursor{ nullptr }
+    , m_end{ nullptr }
+    , m_allocated{ 0 }
+{
+}
+
+inline Pool::~Pool()
+{
+    release();
+}
+
+inline bool Pool::owns( std::size_t blockSize, std::size_t blockAlign ) const
+{
+    return m_objectSize == 0 || ( m_objectSize == blockSize && m_objectAlign == blockAlign );
+}
+
+inline std::size_t Pool::blocksPerChunk() const
+{
+    return m_blocksPerChunk;
+}
+
+inline void* Pool::allocate( std::size_t blockSize, std::size_t blockAlign )
+{
+    setBlockSize_( blockSize, blockAlign );
+    ++m_allocated;
+
+    if ( m_freeList != nullptr )
+    {
+        auto block = m_freeList;
+        m_freeList = block->next;
+        return block;
+    }
+
+    if ( m_cursor == m_end )
+    {
+        addChunk_( m_blocksPerChunk );
+    }
+
+    auto block = m_cursor;
+    m_cursor += m_blockSize;
+    return block;
+}
+
+inline void Pool::deallocate( void* block )
+{
+    ASSERT( m_allocated > 0 );
+    --m_allocated;
+
+    auto freeBlock = static_cast<FreeBlock*>( block );
+    freeBlock->next = m_freeList;
+    m_freeList = freeBlock;
+}
+
+inline void Pool::reserve( std::size_t blockSize, std::size_t blockAlign, std::size_t count )
+{
+    setBlockSize_( blockSize, blockAlign );
+
+    const std::size_t available = static_cast<std::size_t>( m_end - m_cursor ) / m_blockSize;
+    if ( available >= count )
+    {
+        return;
+    }
+
+    //Blocks left in the current chunk are handed to the free list, so the new chunk can be used from its start
+    while ( m_cursor != m_end )
+    {
+        auto freeBlock = reinterpret_cast<FreeBlock*>( m_cursor );
+        freeBlock->next = m_freeList;
+        m_freeList = freeBlock;
+        m_cursor += m_blockSize;
+    }
+
+    addChunk_( count );
+}
+
+inline void Pool::release()
+{
+    for ( const auto& chunk : m_chunks )
+    {
+        ::operator delete( chunk.memory, chunk.bytes, std::align_val_t{ m_blockAlign } );
+    }
+
+    m_chunks.clear();
+    m_freeList = nullptr;
+    m_cursor = m_end = nullptr;
+    m_allocated = 0;
+}
+
+inline std::size_t Pool::allocated() const
+{
+    return m_allocated;
+}
+
+inline void Pool::setBlockSize_( std::size_t blockSize, std::size_t blockAlign )
+{
+    if ( m_objectSize != 0 )
+    {
+        ASSERT( owns( blockSize, blockAlign ) );
+        return;
+    }
+
+    m_objectSize = blockSize;
+    m_objectAlign = blockAlign;
+
+    //every block must be able to hold a free list link
+    m_blockAlign = std::max( blockAlign, alignof( FreeBlock ) );
+    m_blockSize = std::max( blockSize, sizeof( FreeBlock ) );
+    m_blockSize = ( m_blockSize + m_blockAlign - 1 ) / m_blockAlign * m_blockAlign;
+}
+
+inline void Pool::addChunk_( std::size_t blocks )
+{
+    const std::size_t bytes = blocks * m_blockSize;
+    auto memory = ::operator new( bytes, std::align_val_t{ m_blockAlign } );
+    m_chunks.push_back( { memory, bytes } );
+
+    m_cursor = static_cast<char*>( memory );
+    m_end = m_cursor + bytes;
+}
+
+
+template<typename T>
+inline PoolAllocator<T>::PoolAllocator( std::size_t blocksPerChunk )
+    : m_pool{ std::make_shared<Pool>( blocksPerChunk ) }
+{
+}
+
+template<typename T>
+template<typename U>
+inline PoolAllocator<T>::PoolAllocator( const PoolAllocator<U>& other )
+    : m_pool{ other.m_pool }
+{
+}
+
+template<typename T>
+inline T* PoolAllocator<T>::allocate( std::size_t n )
+{
+    if ( n != 1 || !m_pool->owns( sizeof( T ), alignof( T ) ) )
+    {
+        return static_cast<T*>( ::operator new( n * sizeof( T ), std::align_val_t{ alignof( T ) } ) );
+    }
+
+    return static_cast<T*>( m_pool->allocate( sizeof( T ), alignof( T ) ) );
+}
+
+template<typename T>
+inline void PoolAllocator<T>::deallocate( T* pointer, std::size_t n )
+{
+    if ( n != 1 || !m_pool->owns( sizeof( T ), alignof( T ) ) )
+    {
+        ::operator delete( pointer, n * sizeof( T ), std::align_val_t{ alignof( T ) } );
+        return;
+    }
+
+    m_pool->deallocate( pointer );
+}
+
+template<typename T>
+inline void PoolAllocator<T>::reserve( std::size_t count )
+{
+    if ( m_pool->owns( sizeof( T ), alignof( T ) ) )
+    {
+        m_pool->reserve( sizeof( T ), alignof( T ), count );
+    }
+}
+
+template<typename T>
+inline void PoolAllocator<T>::release()
+{
+    m_pool->release();
+}
+
+template<typename T>
+inline std::size_t PoolAllocator<T>::allocated() const
+{
+    return m_pool->allocated();
+}
+
+template<typename T>
+inline bool PoolAllocator<T>::owns() const
+{
+    return m_pool->owns( sizeof( T ), alignof( T ) );
+}
+
+template<typename T>
+inline PoolAllocator<T> PoolAllocator<T>::select_on_container_copy_construction() const
+{
+    //a copy of a container gets a pool of its own
+    return PoolAllocator<T>{ m_pool->blocksPerChunk() };
+}
+
+template<typename T>
+template<typename U>
+inline bool PoolAllocator<T>::operator==( const PoolAllocator<U>& other ) const
+{
+    return m_pool == other.m_pool;
+}
+
+template<typename T>
+template<typename U>
+inline bool PoolAllocator<T>::operator!=( const PoolAllocator<U>& other ) const
+{
+    return !( *this == other );
+}
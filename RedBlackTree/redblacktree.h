@@ -1,19 +1,82 @@
 #pragma once
+#include <array>
+#include <execution>
+#include <future>
+#include <thread>
+#include <atomic>
+#include <optional>
+#include <string_view>
+#if defined( _MSC_VER ) && ( defined( _M_X64 ) || defined( _M_IX86 ) )
+#include <xmmintrin.h>
+#endif
 #include "node.h"
-#include "rapidjson/document.h"
 #include "rapidjson/stringbuffer.h"
+#include "rapidjson/ostreamwrapper.h"
+#include "rapidjson/reader.h"
+#include "rapidjson/memorystream.h"
+#include "rapidjson/istreamwrapper.h"
+#include "rapidjson/error/en.h"
 #include "rapidjson/prettywriter.h"
 
-template<typename T, typename Less = std::less<T>>
+//Allocators which can free all their memory at once (see PoolAllocator)
+template<typename Allocator, typename = void>
+struct SupportsBulkRelease : std::false_type
+{
+};
+
+template<typename Allocator>
+struct SupportsBulkRelease<Allocator, std::void_t<
+    decltype( std::declval<Allocator&>().release() ),
+    decltype( std::declval<const Allocator&>().allocated() ),
+    decltype( std::declval<const Allocator&>().owns() )>> : std::true_type
+{
+};
+
+//Allocators which can provide room for many nodes in one allocation (see PoolAllocator)
+template<typename Allocator, typename = void>
+struct SupportsReserve : std::false_type
+{
+};
+
+template<typename Allocator>
+struct SupportsReserve<Allocator, std::void_t<
+    decltype( std::declval<Allocator&>().reserve( std::size_t{} ) )>> : std::true_type
+{
+};
+
+//Comparers which accept keys of any type comparable with the stored values
+template<typename Comparer, typename = void>
+struct IsTransparent : std::false_type
+{
+};
+
+template<typename Comparer>
+struct IsTransparent<Comparer, std::void_t<typename Comparer::is_transparent>> : std::true_type
+{
+};
+
+//Tag for constructors taking a range already sorted by the tree's comparer (duplicates are allowed)
+struct SortedRangeTag
+{
+};
+
+inline constexpr SortedRangeTag sortedRange{};
+
+template<typename T, typename Less = std::less<T>, typename Allocator = std::allocator<T>, typename Augmentation = NoAugmentation>
 class RedBlackTree
 {
 private:
     class ConstIterator;
+    class ConstRange;
+
+    using NodeAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<Node<T, Augmentation>>;
+    using NodeAllocatorTraits = std::allocator_traits<NodeAllocator>;
 
 public:
     friend class RedBlackTreeTest;
 
     using value_type = T;
+    using allocator_type = Allocator;
     using reference = T&;
     using const_reference = const T&;
     using size_type = std::size_t;
@@ -22,27 +85,75 @@ public:
     using const_iterator = ConstIterator;
     using reverse_iterator = std::reverse_iterator<iterator>;
     using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+    using const_range = ConstRange;
+    using aggregate_type = typename Augmentation::value_type;
 
 public:
     RedBlackTree();
-    RedBlackTree( const std::initializer_list<T>& values );
+    explicit RedBlackTree( const Allocator& allocator );
+    RedBlackTree( const std::initializer_list<T>& values, const Allocator& allocator = Allocator() );
+
+    template<typename IterType>
+    RedBlackTree( const IterType& begin, const IterType& end, const Allocator& allocator = Allocator() );
+
+    template<typename IterType>
+    RedBlackTree( SortedRangeTag, const IterType& begin, const IterType& end, const Allocator& allocator = Allocator() );
+
+    //Builds a balanced tree from a sorted range in linear time
+    template<typename IterType>
+    static RedBlackTree from_sorted( const IterType& begin, const IterType& end, const Allocator& allocator = Allocator() );
 
+    //Sorts and deduplicates a forward range in parallel, then builds independent subtrees on up to threads threads.
+    //The first of equal elements is kept, as with a loop of insert calls.
     template<typename IterType>
-    RedBlackTree( const IterType& begin, const IterType& end );
+    static RedBlackTree from_unsorted( const IterType& begin, const IterType& end,
+        std::size_t threads = std::thread::hardware_concurrency(), const Allocator& allocator = Allocator() );
+
+    //Copies allocate all nodes up front and, for large trees, clone subtrees on up to threads threads.
+    //The copy constructor and copy assignment use every hardware thread.
+    RedBlackTree( const RedBlackTree<T, Less, Allocator, Augmentation>& other );
+    RedBlackTree( const RedBlackTree<T, Less, Allocator, Augmentation>& other, std::size_t threads );
+    RedBlackTree( RedBlackTree<T, Less, Allocator, Augmentation>&& other );
 
-    RedBlackTree( const RedBlackTree<T, Less>& other );
-    RedBlackTree( RedBlackTree<T, Less>&& other );
+    RedBlackTree& operator=( const RedBlackTree<T, Less, Allocator, Augmentation>& other );
+    RedBlackTree& operator=( RedBlackTree<T, Less, Allocator, Augmentation>&& other );
 
-    RedBlackTree& operator=( const RedBlackTree<T, Less>& other );
-    RedBlackTree& operator=( RedBlackTree<T, Less>&& other );
+    ~RedBlackTree();
+
+    allocator_type get_allocator() const;
 
     std::size_t size() const;
 
     const_iterator insert( const T& value );
+    const_iterator insert( T&& value );
+
+    //hint is the position the value is expected to precede: the value is attached next to it
+    //without a descent from the root when it fits there
+    const_iterator insert( const const_iterator& hint, const T& value );
+    const_iterator insert( const const_iterator& hint, T&& value );
+
+    //Attaches a value greater than all others after the cached rightmost node.
+    //Smaller values are inserted normally.
+    const_iterator append_max( const T& value );
+    const_iterator append_max( T&& value );
+
+    template<typename... Args>
+    const_iterator emplace( Args&&... args );
+
+    template<typename... Args>
+    const_iterator emplace_hint( const const_iterator& hint, Args&&... args );
 
     void clear();
 
-    bool operator==( const RedBlackTree<T, Less>& other ) const;
+    //Smallest and greatest elements in O(1). Throw std::out_of_range for an empty tree.
+    const_reference front() const;
+    const_reference back() const;
+
+    //Erase the smallest or the greatest element in amortized O(1), nothing for an empty tree
+    void pop_front();
+    void pop_back();
+
+    bool operator==( const RedBlackTree<T, Less, Allocator, Augmentation>& other ) const;
 
     iterator begin() const;
     iterator end() const;
@@ -58,24 +169,272 @@ public:
 
     const_iterator find( const T& value ) const;
 
+    template<typename Key, typename = std::enable_if_t<IsTransparent<Less>::value, Key>>
+    const_iterator find( const Key& key ) const;
+
+    size_type count( const T& value ) const;
+
+    template<typename Key, typename = std::enable_if_t<IsTransparent<Less>::value, Key>>
+    size_type count( const Key& key ) const;
+
+    bool contains( const T& value ) const;
+
+    template<typename Key, typename = std::enable_if_t<IsTransparent<Less>::value, Key>>
+    bool contains( const Key& key ) const;
+
+    //Looks up every key of [first, last) and writes its iterator, end() if absent, to out in the same order.
+    //Up to findBatchSize descents advance in lockstep, and the next node of each is prefetched before the others
+    //take their step, so the cache misses of independent lookups overlap instead of following one another.
+    //Keys are read several times, so KeyIter must be a forward iterator.
+    template<typename KeyIter, typename OutIter>
+    OutIter find_many( KeyIter first, KeyIter last, OutIter out ) const;
+
+    //first element not less than value
+    const_iterator lower_bound( const T& value ) const;
+
+    template<typename Key, typename = std::enable_if_t<IsTransparent<Less>::value, Key>>
+    const_iterator lower_bound( const Key& key ) const;
+
+    //first element greater than value
+    const_iterator upper_bound( const T& value ) const;
+
+    template<typename Key, typename = std::enable_if_t<IsTransparent<Less>::value, Key>>
+    const_iterator upper_bound( const Key& key ) const;
+
+    std::pair<const_iterator, const_iterator> equal_range( const T& value ) const;
+
+    template<typename Key, typename = std::enable_if_t<IsTransparent<Less>::value, Key>>
+    std::pair<const_iterator, const_iterator> equal_range( const Key& key ) const;
+
+    //Elements in [low, high), found in O(log n) and iterated in O(k)
+    const_range range( const T& low, const T& high ) const;
+
+    template<typename Key, typename = std::enable_if_t<IsTransparent<Less>::value, Key>>
+    const_range range( const Key& low, const Key& high ) const;
+
+    //Order statistics, available with an augmentation counting subtree sizes (see SubtreeSize).
+    //k-th smallest element (counting from 0), end() if k >= size()
+    const_iterator nth( size_type k ) const;
+
+    //number of elements less than value
+    size_type rank( const T& value ) const;
+
+    template<typename Key, typename = std::enable_if_t<IsTransparent<Less>::value, Key>>
+    size_type rank( const Key& key ) const;
+
+    //number of elements in [low, high)
+    size_type count_between( const T& low, const T& high ) const;
+
+    template<typename Key, typename = std::enable_if_t<IsTransparent<Less>::value, Key>>
+    size_type count_between( const Key& low, const Key& high ) const;
+
+    //Augmentation's aggregate of the elements in [low, high) in O(log n), identity() for an empty range
+    aggregate_type reduce( const T& low, const T& high ) const;
+
+    template<typename Key, typename = std::enable_if_t<IsTransparent<Less>::value, Key>>
+    aggregate_type reduce( const Key& low, const Key& high ) const;
+
+    //Recomputes aggregates after the element at where was modified in place
+    //(only parts of it ignored by the comparer may be modified, e.g. mapped values of Map)
+    void refresh( const const_iterator& where );
+
+    //Moves the elements not less than key into the returned tree in O(log n); smaller ones stay.
+    //Without subtree sizes in the augmentation the smaller part is counted, O(min(k, n - k)).
+    RedBlackTree split( const T& key );
+
+    template<typename Key, typename = std::enable_if_t<IsTransparent<Less>::value, Key>>
+    RedBlackTree split( const Key& key );
+
+    //Concatenates trees holding values less than pivot and greater than pivot in O(log n).
+    //Nodes are moved, so both trees must use equal allocators.
+    static RedBlackTree join( RedBlackTree&& left, const T& pivot, RedBlackTree&& right );
+    static RedBlackTree join( RedBlackTree&& left, T&& pivot, RedBlackTree&& right );
+
+    //Same, with the maximum of left as the pivot
+    static RedBlackTree join( RedBlackTree&& left, RedBlackTree&& right );
+
+    //Join-based set operations in O(m log(n / m + 1)) for sizes m <= n. Both trees are consumed
+    //and must share an allocator: nodes are relinked, never copied, and equal elements are taken from left.
+    //With threads > 1 independent halves are processed concurrently; dropped nodes are freed afterwards
+    //on the calling thread, so the allocator needs no synchronization.
+    static RedBlackTree set_union( RedBlackTree&& left, RedBlackTree&& right, std::size_t threads = 1 );
+    static RedBlackTree set_intersection( RedBlackTree&& left, RedBlackTree&& right, std::size_t threads = 1 );
+    static RedBlackTree set_difference( RedBlackTree&& left, RedBlackTree&& right, std::size_t threads = 1 );
+
     iterator erase( const T& value );
     iterator erase( const const_iterator& where );
 
+    template<typename Key, typename = std::enable_if_t<IsTransparent<Less>::value &&
+        !std::is_convertible_v<const Key&, const_iterator>, Key>>
+    iterator erase( const Key& key );
+
+    //Nested objects { "value", "color", "left", "right" } from the root, "Null" for an empty tree.
+    //Values must be arithmetic or convertible to std::string_view.
     std::string serialize( bool compact = false ) const;
+    void serialize( std::ostream& stream, bool compact = false ) const;
+
+    //Streams the same document as SAX events into a rapidjson handler (Writer, PrettyWriter, ...)
+    template<typename Handler>
+    void write_json( Handler& handler ) const;
+
+    //Inverse of serialize: rebuilds the exact shape and colors in one pass, without rebalancing.
+    //Throws std::invalid_argument if the input is not valid JSON of that form, if keys are out of order
+    //or if the colors break the red-black rules.
+    static RedBlackTree deserialize( std::string_view json, const Allocator& allocator = Allocator() );
+    static RedBlackTree deserialize( std::istream& stream, const Allocator& allocator = Allocator() );
+
+protected:
+    //Place where a node with the given key is attached. If the key is already present,
+    //link points to the node holding it.
+    struct InsertPosition
+    {
+        Node<T, Augmentation>* parent;
+        Node<T, Augmentation>** link;
+    };
+
+    template<typename Key>
+    InsertPosition findInsertPosition_( const Key& key );
+
+    template<typename... Args>
+    Node<T, Augmentation>* insertAt_( const InsertPosition& position, Args&&... args );
+
+    iterator makeIterator_( Node<T, Augmentation>* node ) const;
+
+    //for queries of derived containers which descend by aggregates (see IntervalTree)
+    const Node<T, Augmentation>* root_() const;
+
+    //Batched lookup behind find_many: calls visit( node ) for every key in order, nullptr if absent
+    template<typename KeyIter, typename Visitor>
+    void findMany_( KeyIter first, KeyIter last, Visitor visit ) const;
 
 private:
-    void rotateLeft_( std::unique_ptr<Node<T>>& node );
-    void rotateRight_( std::unique_ptr<Node<T>>& node );
+    template<typename... Args>
+    Node<T, Augmentation>* createNode_( Args&&... args );
+    void destroyNode_( Node<T, Augmentation>* node );
+    void destroySubtree_( Node<T, Augmentation>* node, bool deallocate = true );
+
+    //Nodes of a copy are allocated before any is constructed and handed out in batches,
+    //so threads cloning different subtrees never touch the allocator
+    struct CopyState
+    {
+        std::vector<Node<T, Augmentation>*> nodes;
+        std::vector<char> constructed;
+        std::atomic<std::size_t> claimed{ 0 };
+    };
+
+    struct CopyBatch
+    {
+        std::size_t next = 0;
+        std::size_t end = 0;
+    };
+
+    void copyFrom_( const RedBlackTree& other, std::size_t threads );
+    Node<T, Augmentation>* copyParallelSubtree_( const Node<T, Augmentation>* node, Node<T, Augmentation>* parent,
+        CopyState& state, CopyBatch& batch, std::size_t depth, std::size_t forkDepth );
+    //threads copyParallelSubtree_ forks for the same arguments
+    static std::size_t copyForks_( const Node<T, Augmentation>* node, std::size_t depth, std::size_t forkDepth );
+    Node<T, Augmentation>* copySubtree_( const Node<T, Augmentation>* node, Node<T, Augmentation>* parent,
+        CopyState& state, CopyBatch& batch );
+    Node<T, Augmentation>* copyNode_( const Node<T, Augmentation>* node, Node<T, Augmentation>* parent,
+        CopyState& state, CopyBatch& batch );
+
+    template<typename IterType>
+    void buildFromSorted_( const IterType& begin, const IterType& end );
+    template<typename IterType>
+    Node<T, Augmentation>* buildSortedSubtree_( IterType& current, const IterType& end, std::size_t count,
+        std::size_t depth, std::size_t redDepth, Node<T, Augmentation>* parent );
+    void buildFromSortedParallel_( const std::vector<const T*>& values, std::size_t threads );
+    Node<T, Augmentation>* buildParallelSubtree_( const std::vector<const T*>& values, const std::vector<Node<T, Augmentation>*>& nodes,
+        std::vector<char>& constructed, std::size_t first, std::size_t count,
+        std::size_t depth, std::size_t redDepth, std::size_t forkDepth );
+    static std::size_t redDepth_( std::size_t count );
+
+    static void rotateLeft_( Node<T, Augmentation>*& node );
+    static void rotateRight_( Node<T, Augmentation>*& node );
+
+    void attachNode_( const InsertPosition& position, Node<T, Augmentation>* node );
+
+    template<typename Key>
+    InsertPosition findHintedPosition_( Node<T, Augmentation>* hint, const Key& key );
+
+    template<typename Key>
+    Node<T, Augmentation>* findNode_( const Key& key ) const;
+    static void prefetch_( const void* address );
+    template<typename Key>
+    Node<T, Augmentation>* lowerBoundNode_( const Key& key ) const;
+    template<typename Key>
+    Node<T, Augmentation>* upperBoundNode_( const Key& key ) const;
+
+    static Node<T, Augmentation>* leftmost_( Node<T, Augmentation>* node );
+    static Node<T, Augmentation>* rightmost_( Node<T, Augmentation>* node );
+
+    void unlinkNode_( Node<T, Augmentation>* node );
+
+    template<typename Key>
+    RedBlackTree split_( const Key& key );
+    template<typename Key>
+    std::pair<Node<T, Augmentation>*, Node<T, Augmentation>*> splitSubtree_( Node<T, Augmentation>* node, const Key& key,
+        Node<T, Augmentation>** found = nullptr ) const;
+    static Node<T, Augmentation>* joinSubtrees_( Node<T, Augmentation>* left, Node<T, Augmentation>* right );
+    static Node<T, Augmentation>* joinSubtrees_( Node<T, Augmentation>* left, Node<T, Augmentation>* pivot, Node<T, Augmentation>* right );
+    void joinWith_( Node<T, Augmentation>* pivot, RedBlackTree&& right );
+    static std::pair<Node<T, Augmentation>*, Node<T, Augmentation>*> splitLast_( Node<T, Augmentation>* node );
+    static std::size_t blackHeight_( const Node<T, Augmentation>* node );
+
+    enum class SetOperation
+    {
+        Union,
+        Intersection,
+        Difference
+    };
+
+    static RedBlackTree applySetOperation_( SetOperation operation, RedBlackTree&& left, RedBlackTree&& right, std::size_t threads );
+    Node<T, Augmentation>* setOperationSubtree_( SetOperation operation, Node<T, Augmentation>* left, Node<T, Augmentation>* right,
+        std::vector<Node<T, Augmentation>*>& dropped, std::size_t depth, std::size_t forkDepth ) const;
+    static void collectSubtree_( Node<T, Augmentation>* node, std::vector<Node<T, Augmentation>*>& nodes );
+
+    template<typename Key>
+    size_type rank_( const Key& key ) const;
+    static size_type subtreeSize_( const Node<T, Augmentation>* node );
+
+    template<typename Key>
+    aggregate_type reduce_( const Key& low, const Key& high ) const;
+    static aggregate_type aggregate_( const Node<T, Augmentation>* node );
+
+    static void updateAggregate_( Node<T, Augmentation>* node );
+    static void updateAggregatesToRoot_( Node<T, Augmentation>* node );
+
+    static void fixAfterInsert_( Node<T, Augmentation>* insertedNode, Node<T, Augmentation>*& root );
+    void fixAfterErase_( Node<T, Augmentation>* parent, bool removedNodeIsLeft );
 
-    Node<T>* insertAsBST_( const T& value );
-    void fixAfterInsert_( Node<T>* insertedNode );
-    void fixAfterErase_( Node<T>* parent, bool removedNodeIsLeft );
+    template<typename Handler>
+    static void writeJsonValue_( Handler& handler, const T& value );
+    template<typename Stream>
+    static RedBlackTree readJson_( Stream& stream, const Allocator& allocator );
 
-    std::unique_ptr<Node<T>>& getStorage_( Node<T>& node );
+    Node<T, Augmentation>*& getStorage_( Node<T, Augmentation>& node );
+    void swapNodes_( Node<T, Augmentation>* upper, Node<T, Augmentation>* lower );
 
 private:
+    //subtrees smaller than this are not worth a thread
+    static constexpr std::size_t parallelBuildCutoff = 1 << 14;
+    //the same for set operations, by black height: a subtree has at least 2^height - 1 nodes
+    static constexpr std::size_t parallelSetOperationHeight = 14;
+    //and for copies
+    static constexpr std::size_t parallelCopyHeight = 14;
+    //nodes a copying thread claims at once
+    static constexpr std::size_t copyBatchSize = 1024;
+    //batches of a tree per copying thread at least
+    static constexpr std::size_t copyBatchesPerThread = 8;
+    //lookups find_many keeps in flight, about the cache misses a core can have outstanding
+    static constexpr std::size_t findBatchSize = 16;
+
     Less m_less;
-    std::unique_ptr<Node<T>> m_root;
+    NodeAllocator m_nodeAllocator;
+    Node<T, Augmentation>* m_root;
+    //cached extremes for O(1) begin(), --end() and appends at either end
+    Node<T, Augmentation>* m_leftmost;
+    Node<T, Augmentation>* m_rightmost;
     std::size_t m_size;
 
 private:
@@ -91,7 +450,7 @@ private:
         using const_pointer = const T*;
 
     public:
-        ConstIterator( Node<T>* const root, Node<T>* node = nullptr );
+        ConstIterator( const RedBlackTree* tree, Node<T, Augmentation>* node = nullptr );
         ConstIterator( const ConstIterator& other );
         ConstIterator& operator=( const ConstIterator& other );
 
@@ -110,428 +469,2376 @@ private:
         ConstIterator operator--( int );
 
     private:
-        Node<T>* next_( Node<T>* node ) const;
-        Node<T>* prev_( Node<T>* node ) const;
+        Node<T, Augmentation>* next_( Node<T, Augmentation>* node ) const;
+        Node<T, Augmentation>* prev_( Node<T, Augmentation>* node ) const;
+
+    private:
+        //the tree, not its root: iterators stay comparable through rotations, and --end() uses the cached maximum
+        const RedBlackTree* m_tree;
+        Node<T, Augmentation>* m_node;
+    };
+
+    class ConstRange
+    {
+    public:
+        ConstRange( const const_iterator& first, const const_iterator& last );
+
+        const_iterator begin() const;
+        const_iterator end() const;
+
+        bool empty() const;
+
+    private:
+        const_iterator m_first;
+        const_iterator m_last;
+    };
+
+    //SAX handler for deserialize. Every object becomes a node once its closing brace is read,
+    //so children always exist before their parent and the checks are local to the node.
+    class JsonReader
+    {
+    public:
+        explicit JsonReader( RedBlackTree& tree );
+        ~JsonReader();
+
+        JsonReader( const JsonReader& ) = delete;
+        JsonReader& operator=( const JsonReader& ) = delete;
+
+        bool Null();
+        bool Bool( bool value );
+        bool Int( int value );
+        bool Uint( unsigned value );
+        bool Int64( std::int64_t value );
+        bool Uint64( std::uint64_t value );
+        bool Double( double value );
+        bool RawNumber( const char* text, rapidjson::SizeType length, bool copy );
+        bool String( const char* text, rapidjson::SizeType length, bool copy );
+        bool StartObject();
+        bool Key( const char* text, rapidjson::SizeType length, bool copy );
+        bool EndObject( rapidjson::SizeType memberCount );
+        bool StartArray();
+        bool EndArray( rapidjson::SizeType elementCount );
+
+        bool done() const;
+        const std::string& error() const;
+
+    private:
+        enum class Field
+        {
+            None,
+            Value,
+            Color,
+            Left,
+            Right
+        };
+
+        struct Subtree
+        {
+            Node<T, Augmentation>* root = nullptr;
+            Node<T, Augmentation>* leftmost = nullptr;
+            Node<T, Augmentation>* rightmost = nullptr;
+            std::size_t blackHeight = 0;
+        };
+
+        struct Frame
+        {
+            Field field = Field::None;
+            std::optional<T> value;
+            std::optional<Color> color;
+            std::optional<Subtree> left;
+            std::optional<Subtree> right;
+        };
+
+        template<typename Number>
+        bool number_( Number number );
+        bool value_( T&& value );
+        bool subtree_( const Subtree& subtree );
+        bool fail_( const char* message );
 
     private:
-        Node<T>* m_node;
-        Node<T>* m_root;
+        RedBlackTree& m_tree;
+        std::vector<Frame> m_frames;
+        bool m_done;
+        std::string m_error;
     };
 };
 
 
-template<typename T, typename Less>
-inline RedBlackTree<T, Less>::RedBlackTree()
-    : m_root{ nullptr }
-    , m_less{}
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline RedBlackTree<T, Less, Allocator, Augmentation>::RedBlackTree()
+    : RedBlackTree( Allocator() )
+{
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline RedBlackTree<T, Less, Allocator, Augmentation>::RedBlackTree( const Allocator& allocator )
+    : m_less{}
+    , m_nodeAllocator{ allocator }
+    , m_root{ nullptr }
+    , m_leftmost{ nullptr }
+    , m_rightmost{ nullptr }
     , m_size{ 0 }
 {
 }
 
-template<typename T, typename Less>
+template<typename T, typename Less, typename Allocator, typename Augmentation>
 template<typename IterType>
-inline RedBlackTree<T, Less>::RedBlackTree( const IterType& begin, const IterType& end )
-    : m_size{ 0 }
+inline RedBlackTree<T, Less, Allocator, Augmentation>::RedBlackTree( const IterType& begin, const IterType& end, const Allocator& allocator )
+    : RedBlackTree( allocator )
 {
     static_assert( std::is_same_v<decltype( *begin ), T&> || std::is_same_v<decltype( *begin ), const T&> );
+
+    using Category = typename std::iterator_traits<IterType>::iterator_category;
+    if constexpr ( std::is_base_of_v<std::forward_iterator_tag, Category> )
+    {
+        //already sorted input (snapshots, other ordered containers) is built bottom-up
+        if ( std::is_sorted( begin, end, m_less ) )
+        {
+            buildFromSorted_( begin, end );
+            return;
+        }
+    }
+
     for ( auto it = begin; it != end; it = std::next( it ) )
     {
         insert( *it );
     }
 }
 
-template<typename T, typename Less>
-inline RedBlackTree<T, Less>::RedBlackTree( const std::initializer_list<T>& values )
-    : RedBlackTree( std::cbegin( values ), std::cend( values ) )
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+template<typename IterType>
+inline RedBlackTree<T, Less, Allocator, Augmentation>::RedBlackTree( SortedRangeTag, const IterType& begin, const IterType& end, const Allocator& allocator )
+    : RedBlackTree( allocator )
 {
+    static_assert( std::is_same_v<decltype( *begin ), T&> || std::is_same_v<decltype( *begin ), const T&> );
+    ASSERT( std::is_sorted( begin, end, m_less ) );
+
+    buildFromSorted_( begin, end );
 }
 
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+template<typename IterType>
+inline RedBlackTree<T, Less, Allocator, Augmentation> RedBlackTree<T, Less, Allocator, Augmentation>::from_unsorted( const IterType& begin, const IterType& end,
+    std::size_t threads, const Allocator& allocator )
+{
+    static_assert( std::is_same_v<decltype( *begin ), T&> || std::is_same_v<decltype( *begin ), const T&> );
+    static_assert( std::is_base_of_v<std::forward_iterator_tag, typename std::iterator_traits<IterType>::iterator_category> );
+
+    RedBlackTree<T, Less, Allocator, Augmentation> tree( allocator );
+    const auto less = [&tree]( const T* left, const T* right )
+    {
+        return tree.m_less( *left, *right );
+    };
 
-template<typename T, typename Less>
-inline RedBlackTree<T, Less>::RedBlackTree( const RedBlackTree<T, Less>& other )
-    : m_root{ other.m_root->copy() }
-    , m_size{ other.m_size }
-    , m_less{ other.m_less }
+    //Pointers are sorted instead of values: no copies are made and values with const members (Map) can be used
+    std::vector<const T*> values;
+    for ( auto it = begin; it != end; it = std::next( it ) )
+    {
+        values.push_back( &*it );
+    }
+
+    std::stable_sort( std::execution::par, values.begin(), values.end(), less );
+    values.erase( std::unique( std::execution::par, values.begin(), values.end(),
+        [&less]( const T* left, const T* right )
+    {
+        return !less( left, right );
+    } ), values.end() );
+
+    tree.buildFromSortedParallel_( values, threads );
+    return tree;
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+template<typename IterType>
+inline RedBlackTree<T, Less, Allocator, Augmentation> RedBlackTree<T, Less, Allocator, Augmentation>::from_sorted( const IterType& begin, const IterType& end, const Allocator& allocator )
+{
+    return RedBlackTree<T, Less, Allocator, Augmentation>( sortedRange, begin, end, allocator );
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline RedBlackTree<T, Less, Allocator, Augmentation>::RedBlackTree( const std::initializer_list<T>& values, const Allocator& allocator )
+    : RedBlackTree( std::cbegin( values ), std::cend( values ), allocator )
+{
+}
+
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline RedBlackTree<T, Less, Allocator, Augmentation>::RedBlackTree( const RedBlackTree<T, Less, Allocator, Augmentation>& other )
+    : m_less{ other.m_less }
+    , m_nodeAllocator{ NodeAllocatorTraits::select_on_container_copy_construction( other.m_nodeAllocator ) }
+    , m_root{ nullptr }
+    , m_leftmost{ nullptr }
+    , m_rightmost{ nullptr }
+    , m_size{ 0 }
 {
+    copyFrom_( other, std::thread::hardware_concurrency() );
+}
 
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline RedBlackTree<T, Less, Allocator, Augmentation>::RedBlackTree( const RedBlackTree<T, Less, Allocator, Augmentation>& other, std::size_t threads )
+    : m_less{ other.m_less }
+    , m_nodeAllocator{ NodeAllocatorTraits::select_on_container_copy_construction( other.m_nodeAllocator ) }
+    , m_root{ nullptr }
+    , m_leftmost{ nullptr }
+    , m_rightmost{ nullptr }
+    , m_size{ 0 }
+{
+    copyFrom_( other, threads );
 }
 
-template<typename T, typename Less>
-inline RedBlackTree<T, Less>::RedBlackTree( RedBlackTree<T, Less>&& other )
-    : m_root{ std::move( other.m_root ) }
-    , m_size{ std::move( other.m_size ) }
-    , m_less{ std::move( other.m_less ) }
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline RedBlackTree<T, Less, Allocator, Augmentation>::RedBlackTree( RedBlackTree<T, Less, Allocator, Augmentation>&& other )
+    : m_less{ std::move( other.m_less ) }
+    , m_nodeAllocator{ std::move( other.m_nodeAllocator ) }
+    , m_root{ other.m_root }
+    , m_leftmost{ other.m_leftmost }
+    , m_rightmost{ other.m_rightmost }
+    , m_size{ other.m_size }
 {
-    other.clear();
+    other.m_root = other.m_leftmost = other.m_rightmost = nullptr;
+    other.m_size = 0;
 }
 
-template<typename T, typename Less>
-inline RedBlackTree<T, Less>& RedBlackTree<T, Less>::operator=( const RedBlackTree<T, Less>& other )
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline RedBlackTree<T, Less, Allocator, Augmentation>& RedBlackTree<T, Less, Allocator, Augmentation>::operator=( const RedBlackTree<T, Less, Allocator, Augmentation>& other )
 {
     if ( this == &other )
     {
         return *this;
     }
     clear();
-    m_root = other.m_root->copy();
-    m_size = other.m_size;
+    if constexpr ( NodeAllocatorTraits::propagate_on_container_copy_assignment::value )
+    {
+        m_nodeAllocator = other.m_nodeAllocator;
+    }
     m_less = other.m_less;
+    copyFrom_( other, std::thread::hardware_concurrency() );
 
     return *this;
 }
 
-template<typename T, typename Less>
-inline RedBlackTree<T, Less>& RedBlackTree<T, Less>::operator=( RedBlackTree<T, Less>&& other )
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline RedBlackTree<T, Less, Allocator, Augmentation>& RedBlackTree<T, Less, Allocator, Augmentation>::operator=( RedBlackTree<T, Less, Allocator, Augmentation>&& other )
 {
     if ( this == &other )
     {
         return *this;
     }
     clear();
-    m_root = std::move( other.m_root );
-    m_size = std::move( other.m_size );
     m_less = std::move( other.m_less );
-    other.clear();
+
+    if constexpr ( !NodeAllocatorTraits::propagate_on_container_move_assignment::value )
+    {
+        if ( m_nodeAllocator != other.m_nodeAllocator )
+        {
+            //nodes of other can not be freed by our allocator, so they are copied
+            copyFrom_( other, std::thread::hardware_concurrency() );
+            other.clear();
+
+            return *this;
+        }
+    }
+    else
+    {
+        m_nodeAllocator = std::move( other.m_nodeAllocator );
+    }
+
+    m_root = other.m_root;
+    m_leftmost = other.m_leftmost;
+    m_rightmost = other.m_rightmost;
+    m_size = other.m_size;
+    other.m_root = other.m_leftmost = other.m_rightmost = nullptr;
+    other.m_size = 0;
 
     return *this;
 }
 
-template<typename T, typename Less>
-inline std::size_t RedBlackTree<T, Less>::size() const
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline RedBlackTree<T, Less, Allocator, Augmentation>::~RedBlackTree()
 {
-    return m_size;
+    clear();
 }
 
-template<typename T, typename Less>
-inline typename RedBlackTree<T, Less>::const_iterator RedBlackTree<T, Less>::insert( const T& value )
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::allocator_type RedBlackTree<T, Less, Allocator, Augmentation>::get_allocator() const
 {
-    auto insertedNode = insertAsBST_( value );
-
-    if ( insertedNode != nullptr )
-    {
-        ++m_size;
-        fixAfterInsert_( insertedNode );
-    }
-
-    return { m_root.get(), insertedNode };
+    return allocator_type( m_nodeAllocator );
 }
 
-template<typename T, typename Less>
-inline void RedBlackTree<T, Less>::clear()
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline std::size_t RedBlackTree<T, Less, Allocator, Augmentation>::size() const
 {
-    m_root.reset();
-    m_size = 0;
+    return m_size;
 }
 
-template<typename T, typename Less>
-inline bool RedBlackTree<T, Less>::operator==( const RedBlackTree<T, Less>& other ) const
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::const_iterator RedBlackTree<T, Less, Allocator, Augmentation>::insert( const T& value )
 {
-    if ( size() != other.size() )
+    const auto position = findInsertPosition_( value );
+    if ( *position.link != nullptr )
     {
-        return false;
+        return end();
     }
 
-    if ( size() == 0 )
+    auto insertedNode = insertAt_( position, value );
+    return { this, insertedNode };
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::const_iterator RedBlackTree<T, Less, Allocator, Augmentation>::insert( T&& value )
+{
+    const auto position = findInsertPosition_( value );
+    if ( *position.link != nullptr )
     {
-        return true;
+        return end();
     }
 
-    return *m_root == *other.m_root;
+    //value is moved into the node only when the key is known to be absent
+    auto insertedNode = insertAt_( position, std::move( value ) );
+    return { this, insertedNode };
 }
 
-template<typename T, typename Less>
-inline typename RedBlackTree<T, Less>::iterator RedBlackTree<T, Less>::begin() const
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+template<typename... Args>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::const_iterator RedBlackTree<T, Less, Allocator, Augmentation>::emplace( Args&&... args )
 {
-    Node<T>* current = m_root.get();
-    if ( current == nullptr )
+    if constexpr ( sizeof...( Args ) == 1 && ( std::is_same_v<std::decay_t<Args>, T> && ... ) )
     {
-        return { m_root.get() };
+        return insert( std::forward<Args>( args )... );
     }
-
-    while ( current->left != nullptr )
+    else
     {
-        current = current->left.get();
-    }
+        //key can not be extracted from arbitrary arguments, so the node is built first
+        auto node = createNode_( std::in_place, std::forward<Args>( args )... );
 
-    return { m_root.get(), current };
-}
+        const auto position = findInsertPosition_( node->value );
+        if ( *position.link != nullptr )
+        {
+            destroyNode_( node );
+            return end();
+        }
 
-template<typename T, typename Less>
-inline typename RedBlackTree<T, Less>::iterator RedBlackTree<T, Less>::end() const
-{
-    return { m_root.get() };
+        attachNode_( position, node );
+        return { this, node };
+    }
 }
 
-template<typename T, typename Less>
-inline typename RedBlackTree<T, Less>::const_iterator RedBlackTree<T, Less>::cbegin() const
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+template<typename... Args>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::const_iterator RedBlackTree<T, Less, Allocator, Augmentation>::emplace_hint( const const_iterator& hint, Args&&... args )
 {
-    return begin();
-}
+    if constexpr ( sizeof...( Args ) == 1 && ( std::is_same_v<std::decay_t<Args>, T> && ... ) )
+    {
+        return insert( hint, std::forward<Args>( args )... );
+    }
+    else
+    {
+        auto node = createNode_( std::in_place, std::forward<Args>( args )... );
 
-template<typename T, typename Less>
-inline typename RedBlackTree<T, Less>::const_iterator RedBlackTree<T, Less>::cend() const
-{
-    return end();
+        const auto position = findHintedPosition_( hint.m_node, node->value );
+        if ( *position.link != nullptr )
+        {
+            destroyNode_( node );
+            return end();
+        }
+
+        attachNode_( position, node );
+        return { this, node };
+    }
 }
 
-template<typename T, typename Less>
-inline typename RedBlackTree<T, Less>::reverse_iterator RedBlackTree<T, Less>::rbegin() const
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::const_iterator RedBlackTree<T, Less, Allocator, Augmentation>::insert( const const_iterator& hint, const T& value )
 {
-    return end();
+    const auto position = findHintedPosition_( hint.m_node, value );
+    if ( *position.link != nullptr )
+    {
+        return end();
+    }
+
+    auto insertedNode = insertAt_( position, value );
+    return { this, insertedNode };
 }
 
-template<typename T, typename Less>
-inline typename RedBlackTree<T, Less>::reverse_iterator RedBlackTree<T, Less>::rend() const
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::const_iterator RedBlackTree<T, Less, Allocator, Augmentation>::insert( const const_iterator& hint, T&& value )
 {
-    return begin();
+    const auto position = findHintedPosition_( hint.m_node, value );
+    if ( *position.link != nullptr )
+    {
+        return end();
+    }
+
+    auto insertedNode = insertAt_( position, std::move( value ) );
+    return { this, insertedNode };
 }
 
-template<typename T, typename Less>
-inline typename RedBlackTree<T, Less>::const_reverse_iterator RedBlackTree<T, Less>::crbegin() const
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::const_iterator RedBlackTree<T, Less, Allocator, Augmentation>::append_max( const T& value )
 {
-    return RedBlackTree<T, Less>::const_reverse_iterator{ cend() };
+    return insert( end(), value );
 }
 
-template<typename T, typename Less>
-inline typename RedBlackTree<T, Less>::const_reverse_iterator RedBlackTree<T, Less>::crend() const
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::const_iterator RedBlackTree<T, Less, Allocator, Augmentation>::append_max( T&& value )
 {
-    return RedBlackTree<T, Less>::const_reverse_iterator{ cbegin() };
+    return insert( end(), std::move( value ) );
 }
 
-template<typename T, typename Less>
-inline typename RedBlackTree<T, Less>::const_iterator RedBlackTree<T, Less>::find( const T& value ) const
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline void RedBlackTree<T, Less, Allocator, Augmentation>::clear()
 {
-    auto current = m_root.get();
-
-    while ( current != nullptr )
+    if constexpr ( SupportsBulkRelease<NodeAllocator>::value )
     {
-        if ( m_less( value, current->value ) )
-        {
-            current = current->left.get();
-        }
-        else if ( m_less( current->value, value ) )
+        //if nodes come from the pool and every block it handed out belongs to this tree, all chunks are dropped
+        //at once and nodes are visited only when values have destructors to run. Nodes of a pool whose block size
+        //was claimed by another type come from operator new and are not counted, so they must be freed one by one.
+        if ( m_root != nullptr && m_nodeAllocator.owns() && m_nodeAllocator.allocated() == m_size )
         {
-            current = current->right.get();
-        }
-        else
-        {
-            return { m_root.get(), current };
+            if constexpr ( !std::is_trivially_destructible_v<Node<T, Augmentation>> )
+            {
+                destroySubtree_( m_root, false );
+            }
+            m_nodeAllocator.release();
+            m_root = m_leftmost = m_rightmost = nullptr;
+            m_size = 0;
+            return;
         }
     }
-    return m_root.get();
+
+    destroySubtree_( m_root );
+    m_root = m_leftmost = m_rightmost = nullptr;
+    m_size = 0;
 }
 
-template<typename T, typename Less>
-inline typename RedBlackTree<T, Less>::iterator RedBlackTree<T, Less>::erase( const T& value )
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::const_reference RedBlackTree<T, Less, Allocator, Augmentation>::front() const
 {
-    return erase( find( value ) );
+    if ( m_leftmost == nullptr )
+    {
+        throw std::out_of_range( "front() called for an empty tree" );
+    }
+    return m_leftmost->value;
 }
 
-template<typename T, typename Less>
-inline typename RedBlackTree<T, Less>::iterator RedBlackTree<T, Less>::erase( const const_iterator& where )
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::const_reference RedBlackTree<T, Less, Allocator, Augmentation>::back() const
 {
-    if ( where == end() )
+    if ( m_rightmost == nullptr )
     {
-        return end();
+        throw std::out_of_range( "back() called for an empty tree" );
     }
-    --m_size;
-    auto node = const_cast<Node<T>*>( where.m_node );
-    iterator next = std::next( where ); //next will be return value
-
-    auto current = node;
+    return m_rightmost->value;
+}
 
-    if ( node->left != nullptr )
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline void RedBlackTree<T, Less, Allocator, Augmentation>::pop_front()
+{
+    if ( m_leftmost != nullptr )
     {
-        current = node->left.get();
-        while ( current->right != nullptr )
-        {
-            current = current->right.get();
-        }
-        //current is the rightmost child of left node's child
+        auto node = m_leftmost;
+        unlinkNode_( node );
+        destroyNode_( node );
     }
-    else if ( node->right != nullptr )
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline void RedBlackTree<T, Less, Allocator, Augmentation>::pop_back()
+{
+    if ( m_rightmost != nullptr )
     {
-        current = node->right.get();
-        while ( current->left != nullptr )
-        {
-            current = current->left.get();
-        }
-        //current is the leftmost child of right node's child
-        next = where;
+        auto node = m_rightmost;
+        unlinkNode_( node );
+        destroyNode_( node );
     }
+}
 
-    node->value = current->value;
-    auto currentsParent = current->parent;
-    const bool removedNodeIsLeft = currentsParent == nullptr ? true :
-        current == currentsParent->left.get();
-    decltype( auto ) currentUnique = getStorage_( *current );
-
-    if ( current->color == Color::Red )
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline bool RedBlackTree<T, Less, Allocator, Augmentation>::operator==( const RedBlackTree<T, Less, Allocator, Augmentation>& other ) const
+{
+    if ( size() != other.size() )
     {
-        //Current's color is Red and it has maximum one child and color of this child must be Black.
-        //So, both child of current are null (because of equal blackLength for current node).
-        ASSERT_NULL( current->left );
-        ASSERT_NULL( current->right );
-        currentUnique.reset();
-        return next;
+        return false;
     }
-    //current->color == Color::Black
-
-    std::unique_ptr<Node<T>> currentsChildUnique =
-        current->left == nullptr ?
-        std::move( current->right ) :
-        std::move( current->left );
 
-    if ( currentsChildUnique != nullptr && currentsChildUnique->color == Color::Red )
+    if ( size() == 0 )
     {
-        currentsChildUnique->color = Color::Black;
-        currentUnique = std::move( currentsChildUnique );
-        currentUnique->parent = currentsParent;
-        return next;
+        return true;
     }
-    //currentsChild == nullptr because of equal blackLength for current node.
-    //So, current is a Black leaf
+
+    return *m_root == *other.m_root;
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::iterator RedBlackTree<T, Less, Allocator, Augmentation>::begin() const
+{
+    return { this, m_leftmost };
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::iterator RedBlackTree<T, Less, Allocator, Augmentation>::end() const
+{
+    return { this };
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::const_iterator RedBlackTree<T, Less, Allocator, Augmentation>::cbegin() const
+{
+    return begin();
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::const_iterator RedBlackTree<T, Less, Allocator, Augmentation>::cend() const
+{
+    return end();
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::reverse_iterator RedBlackTree<T, Less, Allocator, Augmentation>::rbegin() const
+{
+    return reverse_iterator{ end() };
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::reverse_iterator RedBlackTree<T, Less, Allocator, Augmentation>::rend() const
+{
+    return reverse_iterator{ begin() };
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::const_reverse_iterator RedBlackTree<T, Less, Allocator, Augmentation>::crbegin() const
+{
+    return RedBlackTree<T, Less, Allocator, Augmentation>::const_reverse_iterator{ cend() };
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::const_reverse_iterator RedBlackTree<T, Less, Allocator, Augmentation>::crend() const
+{
+    return RedBlackTree<T, Less, Allocator, Augmentation>::const_reverse_iterator{ cbegin() };
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::const_iterator RedBlackTree<T, Less, Allocator, Augmentation>::find( const T& value ) const
+{
+    return { this, findNode_( value ) };
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+template<typename Key, typename>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::const_iterator RedBlackTree<T, Less, Allocator, Augmentation>::find( const Key& key ) const
+{
+    return { this, findNode_( key ) };
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+template<typename KeyIter, typename OutIter>
+inline OutIter RedBlackTree<T, Less, Allocator, Augmentation>::find_many( KeyIter first, KeyIter last, OutIter out ) const
+{
+    findMany_( first, last, [this, &out]( Node<T, Augmentation>* node )
+    {
+        *out = const_iterator{ this, node };
+        ++out;
+    } );
+
+    return out;
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::size_type RedBlackTree<T, Less, Allocator, Augmentation>::count( const T& value ) const
+{
+    return findNode_( value ) == nullptr ? 0 : 1;
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+template<typename Key, typename>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::size_type RedBlackTree<T, Less, Allocator, Augmentation>::count( const Key& key ) const
+{
+    return findNode_( key ) == nullptr ? 0 : 1;
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline bool RedBlackTree<T, Less, Allocator, Augmentation>::contains( const T& value ) const
+{
+    return findNode_( value ) != nullptr;
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+template<typename Key, typename>
+inline bool RedBlackTree<T, Less, Allocator, Augmentation>::contains( const Key& key ) const
+{
+    return findNode_( key ) != nullptr;
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::const_iterator RedBlackTree<T, Less, Allocator, Augmentation>::lower_bound( const T& value ) const
+{
+    return { this, lowerBoundNode_( value ) };
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+template<typename Key, typename>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::const_iterator RedBlackTree<T, Less, Allocator, Augmentation>::lower_bound( const Key& key ) const
+{
+    return { this, lowerBoundNode_( key ) };
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::const_iterator RedBlackTree<T, Less, Allocator, Augmentation>::upper_bound( const T& value ) const
+{
+    return { this, upperBoundNode_( value ) };
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+template<typename Key, typename>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::const_iterator RedBlackTree<T, Less, Allocator, Augmentation>::upper_bound( const Key& key ) const
+{
+    return { this, upperBoundNode_( key ) };
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline std::pair<typename RedBlackTree<T, Less, Allocator, Augmentation>::const_iterator, typename RedBlackTree<T, Less, Allocator, Augmentation>::const_iterator>
+RedBlackTree<T, Less, Allocator, Augmentation>::equal_range( const T& value ) const
+{
+    return { lower_bound( value ), upper_bound( value ) };
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+template<typename Key, typename>
+inline std::pair<typename RedBlackTree<T, Less, Allocator, Augmentation>::const_iterator, typename RedBlackTree<T, Less, Allocator, Augmentation>::const_iterator>
+RedBlackTree<T, Less, Allocator, Augmentation>::equal_range( const Key& key ) const
+{
+    return { lower_bound( key ), upper_bound( key ) };
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::const_range RedBlackTree<T, Less, Allocator, Augmentation>::range( const T& low, const T& high ) const
+{
+    const auto first = lower_bound( low );
+    return { first, m_less( low, high ) ? lower_bound( high ) : first };
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+template<typename Key, typename>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::const_range RedBlackTree<T, Less, Allocator, Augmentation>::range( const Key& low, const Key& high ) const
+{
+    const auto first = lower_bound( low );
+    //low and high are not required to be comparable with each other, only with stored values
+    return { first, first.m_node != nullptr && m_less( first.m_node->value, high ) ? lower_bound( high ) : first };
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::const_iterator RedBlackTree<T, Less, Allocator, Augmentation>::nth( size_type k ) const
+{
+    static_assert( HasSubtreeSize<Augmentation>::value, "nth requires an augmentation counting subtree sizes" );
+
+    auto current = m_root;
+    while ( current != nullptr )
+    {
+        const auto leftSize = subtreeSize_( current->left );
+        if ( k < leftSize )
+        {
+            current = current->left;
+        }
+        else if ( k > leftSize )
+        {
+            k -= leftSize + 1;
+            current = current->right;
+        }
+        else
+        {
+            return { this, current };
+        }
+    }
+
+    return end();
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::size_type RedBlackTree<T, Less, Allocator, Augmentation>::rank( const T& value ) const
+{
+    return rank_( value );
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+template<typename Key, typename>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::size_type RedBlackTree<T, Less, Allocator, Augmentation>::rank( const Key& key ) const
+{
+    return rank_( key );
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::size_type RedBlackTree<T, Less, Allocator, Augmentation>::count_between( const T& low, const T& high ) const
+{
+    const auto lowRank = rank_( low );
+    const auto highRank = rank_( high );
+    return highRank > lowRank ? highRank - lowRank : 0;
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+template<typename Key, typename>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::size_type RedBlackTree<T, Less, Allocator, Augmentation>::count_between( const Key& low, const Key& high ) const
+{
+    const auto lowRank = rank_( low );
+    const auto highRank = rank_( high );
+    return highRank > lowRank ? highRank - lowRank : 0;
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::aggregate_type RedBlackTree<T, Less, Allocator, Augmentation>::reduce( const T& low, const T& high ) const
+{
+    return reduce_( low, high );
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+template<typename Key, typename>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::aggregate_type RedBlackTree<T, Less, Allocator, Augmentation>::reduce( const Key& low, const Key& high ) const
+{
+    return reduce_( low, high );
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline void RedBlackTree<T, Less, Allocator, Augmentation>::refresh( const const_iterator& where )
+{
+    if ( where.m_node != nullptr )
+    {
+        updateAggregatesToRoot_( where.m_node );
+    }
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline RedBlackTree<T, Less, Allocator, Augmentation> RedBlackTree<T, Less, Allocator, Augmentation>::split( const T& key )
+{
+    return split_( key );
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+template<typename Key, typename>
+inline RedBlackTree<T, Less, Allocator, Augmentation> RedBlackTree<T, Less, Allocator, Augmentation>::split( const Key& key )
+{
+    return split_( key );
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+template<typename Key>
+inline RedBlackTree<T, Less, Allocator, Augmentation> RedBlackTree<T, Less, Allocator, Augmentation>::split_( const Key& key )
+{
+    //the upper part shares the allocator: its nodes come from ours
+    RedBlackTree<T, Less, Allocator, Augmentation> upper{ allocator_type( m_nodeAllocator ) };
+    upper.m_less = m_less;
+
+    const auto [lowerRoot, upperRoot] = splitSubtree_( m_root, key );
+    for ( auto root : { lowerRoot, upperRoot } )
+    {
+        if ( root != nullptr )
+        {
+            root->setColor( Color::Black );
+        }
+    }
+
+    std::size_t upperSize = 0;
+    if constexpr ( HasSubtreeSize<Augmentation>::value )
+    {
+        upperSize = subtreeSize_( upperRoot );
+    }
+    else
+    {
+        //the walk stops at the end of the smaller part
+        std::size_t visited = 0;
+        auto lowerIt = makeIterator_( leftmost_( lowerRoot ) );
+        auto upperIt = makeIterator_( leftmost_( upperRoot ) );
+        while ( lowerIt.m_node != nullptr && upperIt.m_node != nullptr )
+        {
+            ++lowerIt;
+            ++upperIt;
+            ++visited;
+        }
+        upperSize = upperIt.m_node == nullptr ? visited : m_size - visited;
+    }
+
+    m_root = lowerRoot;
+    m_leftmost = leftmost_( m_root );
+    m_rightmost = rightmost_( m_root );
+    m_size -= upperSize;
+
+    upper.m_root = upperRoot;
+    upper.m_leftmost = leftmost_( upperRoot );
+    upper.m_rightmost = rightmost_( upperRoot );
+    upper.m_size = upperSize;
+
+    return upper;
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline RedBlackTree<T, Less, Allocator, Augmentation> RedBlackTree<T, Less, Allocator, Augmentation>::join(
+    RedBlackTree<T, Less, Allocator, Augmentation>&& left, const T& pivot, RedBlackTree<T, Less, Allocator, Augmentation>&& right )
+{
+    RedBlackTree<T, Less, Allocator, Augmentation> result( std::move( left ) );
+    result.joinWith_( result.createNode_( std::in_place, pivot ), std::move( right ) );
+    return result;
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline RedBlackTree<T, Less, Allocator, Augmentation> RedBlackTree<T, Less, Allocator, Augmentation>::join(
+    RedBlackTree<T, Less, Allocator, Augmentation>&& left, T&& pivot, RedBlackTree<T, Less, Allocator, Augmentation>&& right )
+{
+    RedBlackTree<T, Less, Allocator, Augmentation> result( std::move( left ) );
+    result.joinWith_( result.createNode_( std::in_place, std::move( pivot ) ), std::move( right ) );
+    return result;
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline RedBlackTree<T, Less, Allocator, Augmentation> RedBlackTree<T, Less, Allocator, Augmentation>::join(
+    RedBlackTree<T, Less, Allocator, Augmentation>&& left, RedBlackTree<T, Less, Allocator, Augmentation>&& right )
+{
+    RedBlackTree<T, Less, Allocator, Augmentation> result( std::move( left ) );
+    if ( result.m_root == nullptr )
+    {
+        result = std::move( right );
+        return result;
+    }
+
+    auto pivot = result.m_rightmost;
+    result.unlinkNode_( pivot );
+    result.joinWith_( pivot, std::move( right ) );
+    return result;
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline RedBlackTree<T, Less, Allocator, Augmentation> RedBlackTree<T, Less, Allocator, Augmentation>::set_union(
+    RedBlackTree<T, Less, Allocator, Augmentation>&& left, RedBlackTree<T, Less, Allocator, Augmentation>&& right, std::size_t threads )
+{
+    return applySetOperation_( SetOperation::Union, std::move( left ), std::move( right ), threads );
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline RedBlackTree<T, Less, Allocator, Augmentation> RedBlackTree<T, Less, Allocator, Augmentation>::set_intersection(
+    RedBlackTree<T, Less, Allocator, Augmentation>&& left, RedBlackTree<T, Less, Allocator, Augmentation>&& right, std::size_t threads )
+{
+    return applySetOperation_( SetOperation::Intersection, std::move( left ), std::move( right ), threads );
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline RedBlackTree<T, Less, Allocator, Augmentation> RedBlackTree<T, Less, Allocator, Augmentation>::set_difference(
+    RedBlackTree<T, Less, Allocator, Augmentation>&& left, RedBlackTree<T, Less, Allocator, Augmentation>&& right, std::size_t threads )
+{
+    return applySetOperation_( SetOperation::Difference, std::move( left ), std::move( right ), threads );
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::iterator RedBlackTree<T, Less, Allocator, Augmentation>::erase( const T& value )
+{
+    return erase( find( value ) );
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+template<typename Key, typename>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::iterator RedBlackTree<T, Less, Allocator, Augmentation>::erase( const Key& key )
+{
+    return erase( find( key ) );
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::iterator RedBlackTree<T, Less, Allocator, Augmentation>::erase( const const_iterator& where )
+{
+    if ( where == end() )
+    {
+        return end();
+    }
+    auto current = const_cast<Node<T, Augmentation>*>( where.m_node );
+    auto next = std::next( where ).m_node; //next will be return value
+
+    unlinkNode_( current );
+    destroyNode_( current );
+    return { this, next };
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline void RedBlackTree<T, Less, Allocator, Augmentation>::unlinkNode_( Node<T, Augmentation>* current )
+{
+    --m_size;
+
+    if ( current == m_leftmost )
+    {
+        m_leftmost = current->right != nullptr ? leftmost_( current->right ) : current->parent;
+    }
+    if ( current == m_rightmost )
+    {
+        //rightmost node has no right child, so its predecessor is the maximum of the left subtree or the parent
+        m_rightmost = current->left != nullptr ? rightmost_( current->left ) : current->parent;
+    }
+
+    if ( current->left != nullptr && current->right != nullptr )
+    {
+        auto predecessor = current->left;
+        while ( predecessor->right != nullptr )
+        {
+            predecessor = predecessor->right;
+        }
+        //predecessor is the rightmost child of left node's child.
+        //Nodes are relinked instead of copying values, so iterators to other nodes stay valid
+        //and values are never assigned.
+        swapNodes_( current, predecessor );
+    }
+    //now current has at most one child
+
+    auto currentsParent = current->parent;
+    const bool removedNodeIsLeft = currentsParent == nullptr ? true :
+        current == currentsParent->left;
+    decltype( auto ) currentStorage = getStorage_( *current );
+
+    if ( current->color() == Color::Red )
+    {
+        //Current's color is Red and it has maximum one child and color of this child must be Black.
+        //So, both child of current are null (because of equal blackLength for current node).
+        ASSERT_NULL( current->left );
+        ASSERT_NULL( current->right );
+        currentStorage = nullptr;
+        updateAggregatesToRoot_( currentsParent );
+        return;
+    }
+    //current->color() == Color::Black
+
+    Node<T, Augmentation>* currentsChild = current->left == nullptr ? current->right : current->left;
+
+    if ( currentsChild != nullptr && currentsChild->color() == Color::Red )
+    {
+        currentsChild->setColor( Color::Black );
+        currentStorage = currentsChild;
+        currentsChild->parent = currentsParent;
+        updateAggregatesToRoot_( currentsParent );
+        return;
+    }
+    //currentsChild == nullptr because of equal blackLength for current node.
+    //So, current is a Black leaf
     ASSERT_NULL( current->left );
     ASSERT_NULL( current->right );
 
-    currentUnique.reset();
+    currentStorage = nullptr;
+    updateAggregatesToRoot_( currentsParent );
 
+    //rotations below keep the aggregates of the subtrees they restructure
     fixAfterErase_( currentsParent, removedNodeIsLeft );
-    return next;
 }
 
-template<typename T, typename Less>
-inline std::string RedBlackTree<T, Less>::serialize( bool compact ) const
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline std::string RedBlackTree<T, Less, Allocator, Augmentation>::serialize( bool compact ) const
 {
     if ( !m_root )
     {
         return "Null";
     }
 
-    auto doc = m_root->toJson();
     rapidjson::StringBuffer buffer;
 
     if ( compact )
     {
         rapidjson::Writer<rapidjson::StringBuffer> writer( buffer );
-        doc.Accept( writer );
+        write_json( writer );
     }
     else
     {
         rapidjson::PrettyWriter<rapidjson::StringBuffer> writer( buffer );
-        doc.Accept( writer );
+        write_json( writer );
+    }
+
+    return buffer.GetString();
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline void RedBlackTree<T, Less, Allocator, Augmentation>::serialize( std::ostream& stream, bool compact ) const
+{
+    if ( !m_root )
+    {
+        stream << "Null";
+        return;
+    }
+
+    rapidjson::OStreamWrapper wrapper( stream );
+
+    if ( compact )
+    {
+        rapidjson::Writer<rapidjson::OStreamWrapper> writer( wrapper );
+        write_json( writer );
+    }
+    else
+    {
+        rapidjson::PrettyWriter<rapidjson::OStreamWrapper> writer( wrapper );
+        write_json( writer );
+    }
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+template<typename Handler>
+inline void RedBlackTree<T, Less, Allocator, Augmentation>::write_json( Handler& handler ) const
+{
+    if ( !m_root )
+    {
+        handler.Null();
+        return;
+    }
+
+    //Walks the parent links instead of recursing: a node is opened on the way down,
+    //its right member is written when climbing back from the left subtree, and it is closed when climbing from the right one
+    const Node<T, Augmentation>* node = m_root;
+    bool descending = true;
+    while ( node != nullptr )
+    {
+        if ( descending )
+        {
+            handler.StartObject();
+            handler.Key( "value" );
+            writeJsonValue_( handler, node->value );
+            handler.Key( "color" );
+            handler.String( node->color() == Color::Red ? "red" : "black" );
+            handler.Key( "left" );
+
+            if ( node->left != nullptr )
+            {
+                node = node->left;
+                continue;
+            }
+            handler.Null();
+        }
+
+        handler.Key( "right" );
+        if ( node->right != nullptr )
+        {
+            node = node->right;
+            descending = true;
+            continue;
+        }
+        handler.Null();
+
+        //close every node whose right subtree is done
+        const Node<T, Augmentation>* child;
+        do
+        {
+            handler.EndObject();
+            child = node;
+            node = node->parent;
+        }
+        while ( node != nullptr && node->right == child );
+
+        descending = false;
+    }
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline RedBlackTree<T, Less, Allocator, Augmentation> RedBlackTree<T, Less, Allocator, Augmentation>::deserialize( std::string_view json, const Allocator& allocator )
+{
+    const auto first = json.find_first_not_of( " \t\r\n" );
+    const auto last = json.find_last_not_of( " \t\r\n" );
+    if ( first != std::string_view::npos && json.substr( first, last - first + 1 ) == "Null" )
+    {
+        return RedBlackTree( allocator );
+    }
+
+    rapidjson::MemoryStream stream( json.data(), json.size() );
+    return readJson_( stream, allocator );
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline RedBlackTree<T, Less, Allocator, Augmentation> RedBlackTree<T, Less, Allocator, Augmentation>::deserialize( std::istream& stream, const Allocator& allocator )
+{
+    //"Null", written by serialize for an empty tree, is not JSON
+    stream >> std::ws;
+    if ( stream.peek() == 'N' )
+    {
+        std::string word;
+        stream >> word;
+        if ( word != "Null" || !( stream >> std::ws ).eof() )
+        {
+            throw std::invalid_argument( "Invalid JSON: unexpected " + word );
+        }
+        return RedBlackTree( allocator );
+    }
+
+    rapidjson::IStreamWrapper wrapper( stream );
+    return readJson_( wrapper, allocator );
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+template<typename Stream>
+inline RedBlackTree<T, Less, Allocator, Augmentation> RedBlackTree<T, Less, Allocator, Augmentation>::readJson_( Stream& stream, const Allocator& allocator )
+{
+    RedBlackTree tree( allocator );
+    {
+        //frees the nodes of unfinished objects if parsing stops early
+        JsonReader handler( tree );
+        rapidjson::Reader reader;
+        const rapidjson::ParseResult result = reader.Parse( stream, handler );
+
+        if ( !handler.error().empty() )
+        {
+            throw std::invalid_argument( "Invalid tree at offset " + std::to_string( result.Offset() ) + ": " + handler.error() );
+        }
+        if ( result.IsError() || !handler.done() )
+        {
+            throw std::invalid_argument( std::string( "Invalid JSON at offset " ) + std::to_string( result.Offset() ) + ": "
+                + rapidjson::GetParseError_En( result.Code() ) );
+        }
+    }
+
+    return tree;
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+template<typename Handler>
+inline void RedBlackTree<T, Less, Allocator, Augmentation>::writeJsonValue_( Handler& handler, const T& value )
+{
+    if constexpr ( std::is_same_v<T, bool> )
+    {
+        handler.Bool( value );
+    }
+    else if constexpr ( std::is_integral_v<T> && std::is_signed_v<T> )
+    {
+        handler.Int64( static_cast<std::int64_t>( value ) );
+    }
+    else if constexpr ( std::is_integral_v<T> )
+    {
+        handler.Uint64( static_cast<std::uint64_t>( value ) );
+    }
+    else if constexpr ( std::is_floating_point_v<T> )
+    {
+        handler.Double( static_cast<double>( value ) );
+    }
+    else
+    {
+        static_assert( std::is_convertible_v<const T&, std::string_view>, "Values must be arithmetic or strings to be written as JSON" );
+        const std::string_view text = value;
+        handler.String( text.data(), static_cast<rapidjson::SizeType>( text.size() ) );
+    }
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+template<typename... Args>
+inline Node<T, Augmentation>* RedBlackTree<T, Less, Allocator, Augmentation>::createNode_( Args&&... args )
+{
+    Node<T, Augmentation>* node = NodeAllocatorTraits::allocate( m_nodeAllocator, 1 );
+    try
+    {
+        NodeAllocatorTraits::construct( m_nodeAllocator, node, std::forward<Args>( args )... );
+    }
+    catch ( ... )
+    {
+        NodeAllocatorTraits::deallocate( m_nodeAllocator, node, 1 );
+        throw;
+    }
+
+    return node;
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline void RedBlackTree<T, Less, Allocator, Augmentation>::destroyNode_( Node<T, Augmentation>* node )
+{
+    NodeAllocatorTraits::destroy( m_nodeAllocator, node );
+    NodeAllocatorTraits::deallocate( m_nodeAllocator, node, 1 );
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline void RedBlackTree<T, Less, Allocator, Augmentation>::destroySubtree_( Node<T, Augmentation>* node, bool deallocate )
+{
+    while ( node != nullptr )
+    {
+        destroySubtree_( node->left, deallocate );
+        auto right = node->right;
+
+        if ( deallocate )
+        {
+            destroyNode_( node );
+        }
+        else
+        {
+            NodeAllocatorTraits::destroy( m_nodeAllocator, node );
+        }
+
+        node = right;
+    }
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline void RedBlackTree<T, Less, Allocator, Augmentation>::copyFrom_( const RedBlackTree& other, std::size_t threads )
+{
+    ASSERT_NULL( m_root );
+    if ( other.m_root == nullptr )
+    {
+        return;
+    }
+
+    //a thread is worth it only with several batches to copy, which also keeps the unused slack below a fraction of the tree
+    threads = std::min( threads, other.m_size / ( copyBatchSize * copyBatchesPerThread ) );
+
+    std::size_t forkDepth = 0;
+    while ( ( std::size_t{ 1 } << forkDepth ) < threads )
+    {
+        ++forkDepth;
+    }
+    if ( blackHeight_( other.m_root ) < parallelCopyHeight )
+    {
+        forkDepth = 0;
+    }
+
+    //every thread actually forked, and the calling one, may leave part of its last batch unused
+    const std::size_t forks = copyForks_( other.m_root, 0, forkDepth );
+    const std::size_t count = other.m_size + ( forks == 0 ? 0 : ( forks + 1 ) * copyBatchSize );
+    if constexpr ( SupportsReserve<NodeAllocator>::value )
+    {
+        m_nodeAllocator.reserve( count );
+    }
+
+    CopyState state;
+    state.nodes.reserve( count );
+    state.constructed.assign( count, 0 );
+
+    try
+    {
+        for ( std::size_t i = 0; i < count; ++i )
+        {
+            state.nodes.push_back( NodeAllocatorTraits::allocate( m_nodeAllocator, 1 ) );
+        }
+
+        CopyBatch batch;
+        m_root = copyParallelSubtree_( other.m_root, nullptr, state, batch, 0, forkDepth );
+    }
+    catch ( ... )
+    {
+        for ( std::size_t i = 0; i < state.nodes.size(); ++i )
+        {
+            if ( state.constructed[i] )
+            {
+                NodeAllocatorTraits::destroy( m_nodeAllocator, state.nodes[i] );
+            }
+            NodeAllocatorTraits::deallocate( m_nodeAllocator, state.nodes[i], 1 );
+        }
+        m_root = nullptr;
+        throw;
+    }
+
+    for ( std::size_t i = 0; i < count; ++i )
+    {
+        if ( !state.constructed[i] )
+        {
+            NodeAllocatorTraits::deallocate( m_nodeAllocator, state.nodes[i], 1 );
+        }
+    }
+
+    m_leftmost = leftmost_( m_root );
+    m_rightmost = rightmost_( m_root );
+    m_size = other.m_size;
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline Node<T, Augmentation>* RedBlackTree<T, Less, Allocator, Augmentation>::copyParallelSubtree_( const Node<T, Augmentation>* node,
+    Node<T, Augmentation>* parent, CopyState& state, CopyBatch& batch, std::size_t depth, std::size_t forkDepth )
+{
+    if ( node == nullptr || depth >= forkDepth || blackHeight_( node ) < parallelCopyHeight )
+    {
+        return copySubtree_( node, parent, state, batch );
+    }
+
+    auto copy = copyNode_( node, parent, state, batch );
+
+    //the left subtree is cloned on another thread with batches of its own
+    auto leftTask = std::async( std::launch::async, [&]()
+    {
+        CopyBatch leftBatch;
+        return copyParallelSubtree_( node->left, copy, state, leftBatch, depth + 1, forkDepth );
+    } );
+    copy->right = copyParallelSubtree_( node->right, copy, state, batch, depth + 1, forkDepth );
+    copy->left = leftTask.get();
+    updateAggregate_( copy );
+
+    return copy;
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline std::size_t RedBlackTree<T, Less, Allocator, Augmentation>::copyForks_( const Node<T, Augmentation>* node,
+    std::size_t depth, std::size_t forkDepth )
+{
+    if ( node == nullptr || depth >= forkDepth || blackHeight_( node ) < parallelCopyHeight )
+    {
+        return 0;
+    }
+
+    return 1 + copyForks_( node->left, depth + 1, forkDepth ) + copyForks_( node->right, depth + 1, forkDepth );
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline Node<T, Augmentation>* RedBlackTree<T, Less, Allocator, Augmentation>::copySubtree_( const Node<T, Augmentation>* node,
+    Node<T, Augmentation>* parent, CopyState& state, CopyBatch& batch )
+{
+    if ( node == nullptr )
+    {
+        return nullptr;
+    }
+
+    //Pre-order walk over the parent links of both trees: a child is copied when its link in the copy is still empty,
+    //and a node is finished (its aggregate computed) when both links are done
+    const Node<T, Augmentation>* const top = node;
+    auto copy = copyNode_( node, parent, state, batch );
+    const auto root = copy;
+
+    while ( true )
+    {
+        if ( node->left != nullptr && copy->left == nullptr )
+        {
+            copy->left = copyNode_( node->left, copy, state, batch );
+            node = node->left;
+            copy = copy->left;
+        }
+        else if ( node->right != nullptr && copy->right == nullptr )
+        {
+            copy->right = copyNode_( node->right, copy, state, batch );
+            node = node->right;
+            copy = copy->right;
+        }
+        else
+        {
+            updateAggregate_( copy );
+            if ( node == top )
+            {
+                return root;
+            }
+            node = node->parent;
+            copy = copy->parent;
+        }
+    }
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline Node<T, Augmentation>* RedBlackTree<T, Less, Allocator, Augmentation>::copyNode_( const Node<T, Augmentation>* node,
+    Node<T, Augmentation>* parent, CopyState& state, CopyBatch& batch )
+{
+    if ( batch.next == batch.end )
+    {
+        batch.next = state.claimed.fetch_add( copyBatchSize );
+        batch.end = std::min( batch.next + copyBatchSize, state.nodes.size() );
+        ASSERT( batch.next < batch.end );
+    }
+
+    const auto index = batch.next++;
+    NodeAllocatorTraits::construct( m_nodeAllocator, state.nodes[index], node->value, node->color(), parent );
+    state.constructed[index] = 1;
+
+    return state.nodes[index];
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+template<typename IterType>
+inline void RedBlackTree<T, Less, Allocator, Augmentation>::buildFromSorted_( const IterType& begin, const IterType& end )
+{
+    ASSERT_NULL( m_root );
+
+    std::size_t count = 0;
+    for ( auto it = begin; it != end; ++count )
+    {
+        auto previous = it;
+        it = std::next( it );
+        while ( it != end && !m_less( *previous, *it ) )
+        {
+            it = std::next( it );
+        }
+    }
+
+    if constexpr ( SupportsReserve<NodeAllocator>::value )
+    {
+        m_nodeAllocator.reserve( count );
+    }
+
+    auto current = begin;
+    m_root = buildSortedSubtree_( current, end, count, 0, redDepth_( count ), nullptr );
+    m_leftmost = leftmost_( m_root );
+    m_rightmost = rightmost_( m_root );
+    m_size = count;
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline std::size_t RedBlackTree<T, Less, Allocator, Augmentation>::redDepth_( std::size_t count )
+{
+    //Halves differ by at most one node, so every leaf is at depth redDepth - 1 or redDepth.
+    //Painting the nodes of the incomplete last level red makes all black lengths equal.
+    std::size_t redDepth = 0;
+    while ( ( std::size_t{ 2 } << redDepth ) <= count + 1 )
+    {
+        ++redDepth;
+    }
+
+    return redDepth;
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline void RedBlackTree<T, Less, Allocator, Augmentation>::buildFromSortedParallel_( const std::vector<const T*>& values, std::size_t threads )
+{
+    ASSERT_NULL( m_root );
+    const std::size_t count = values.size();
+
+    //Allocators are not required to be thread safe, so all nodes are allocated up front
+    //and the threads only construct values and link nodes.
+    if constexpr ( SupportsReserve<NodeAllocator>::value )
+    {
+        m_nodeAllocator.reserve( count );
+    }
+
+    std::vector<Node<T, Augmentation>*> nodes;
+    nodes.reserve( count );
+    std::vector<char> constructed( count, 0 );
+
+    try
+    {
+        for ( std::size_t i = 0; i < count; ++i )
+        {
+            nodes.push_back( NodeAllocatorTraits::allocate( m_nodeAllocator, 1 ) );
+        }
+
+        std::size_t forkDepth = 0;
+        while ( ( std::size_t{ 1 } << forkDepth ) < threads )
+        {
+            ++forkDepth;
+        }
+
+        m_root = buildParallelSubtree_( values, nodes, constructed, 0, count, 0, redDepth_( count ), forkDepth );
+        m_leftmost = leftmost_( m_root );
+        m_rightmost = rightmost_( m_root );
+        m_size = count;
+    }
+    catch ( ... )
+    {
+        for ( std::size_t i = 0; i < nodes.size(); ++i )
+        {
+            if ( constructed[i] )
+            {
+                NodeAllocatorTraits::destroy( m_nodeAllocator, nodes[i] );
+            }
+            NodeAllocatorTraits::deallocate( m_nodeAllocator, nodes[i], 1 );
+        }
+        m_root = nullptr;
+        throw;
+    }
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline Node<T, Augmentation>* RedBlackTree<T, Less, Allocator, Augmentation>::buildParallelSubtree_( const std::vector<const T*>& values, const std::vector<Node<T, Augmentation>*>& nodes,
+    std::vector<char>& constructed, std::size_t first, std::size_t count,
+    std::size_t depth, std::size_t redDepth, std::size_t forkDepth )
+{
+    if ( count == 0 )
+    {
+        return nullptr;
+    }
+
+    //same shape as buildSortedSubtree_: the i-th smallest value goes to nodes[i]
+    const std::size_t leftCount = ( count - 1 ) / 2;
+    const std::size_t middle = first + leftCount;
+
+    auto node = nodes[middle];
+    NodeAllocatorTraits::construct( m_nodeAllocator, node, *values[middle], depth == redDepth ? Color::Red : Color::Black );
+    constructed[middle] = 1;
+
+    Node<T, Augmentation>* left = nullptr;
+    Node<T, Augmentation>* right = nullptr;
+
+    if ( depth < forkDepth && count >= parallelBuildCutoff )
+    {
+        //left and right halves touch disjoint nodes, so the left one is built on another thread
+        auto leftTask = std::async( std::launch::async, [&]()
+        {
+            return buildParallelSubtree_( values, nodes, constructed, first, leftCount, depth + 1, redDepth, forkDepth );
+        } );
+        right = buildParallelSubtree_( values, nodes, constructed, middle + 1, count - 1 - leftCount, depth + 1, redDepth, forkDepth );
+        left = leftTask.get();
+    }
+    else
+    {
+        left = buildParallelSubtree_( values, nodes, constructed, first, leftCount, depth + 1, redDepth, forkDepth );
+        right = buildParallelSubtree_( values, nodes, constructed, middle + 1, count - 1 - leftCount, depth + 1, redDepth, forkDepth );
+    }
+
+    node->left = left;
+    node->right = right;
+    if ( left != nullptr )
+    {
+        left->parent = node;
+    }
+    if ( right != nullptr )
+    {
+        right->parent = node;
+    }
+    updateAggregate_( node );
+
+    return node;
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+template<typename IterType>
+inline Node<T, Augmentation>* RedBlackTree<T, Less, Allocator, Augmentation>::buildSortedSubtree_( IterType& current, const IterType& end, std::size_t count,
+    std::size_t depth, std::size_t redDepth, Node<T, Augmentation>* parent )
+{
+    if ( count == 0 )
+    {
+        return nullptr;
+    }
+
+    const std::size_t leftCount = ( count - 1 ) / 2;
+    Node<T, Augmentation>* left = buildSortedSubtree_( current, end, leftCount, depth + 1, redDepth, nullptr );
+
+    Node<T, Augmentation>* node = nullptr;
+    try
+    {
+        node = createNode_( *current, depth == redDepth ? Color::Red : Color::Black, parent );
+    }
+    catch ( ... )
+    {
+        destroySubtree_( left );
+        throw;
+    }
+
+    node->left = left;
+    if ( left != nullptr )
+    {
+        left->parent = node;
+    }
+
+    auto previous = current;
+    current = std::next( current );
+    while ( current != end && !m_less( *previous, *current ) )
+    {
+        current = std::next( current );
+    }
+
+    try
+    {
+        node->right = buildSortedSubtree_( current, end, count - 1 - leftCount, depth + 1, redDepth, node );
+    }
+    catch ( ... )
+    {
+        destroySubtree_( node );
+        throw;
+    }
+    updateAggregate_( node );
+
+    return node;
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline void RedBlackTree<T, Less, Allocator, Augmentation>::rotateLeft_( Node<T, Augmentation>*& node )
+{
+    ASSERT_NOT_NULL( node->right );
+    if ( node->right == nullptr )
+    {
+        return;
+    }
+
+    node->right->parent = node->parent;
+
+    Node<T, Augmentation>* rightNode = node->right;
+
+    node->right = rightNode->left;
+    if ( node->right != nullptr )
+    {
+        node->right->parent = node;
+    }
+
+    rightNode->left = node;
+    rightNode->left->parent = rightNode;
+
+    //the lowered node first: it is a child of the new subtree root
+    updateAggregate_( node );
+    updateAggregate_( rightNode );
+
+    node = rightNode;
+}
+
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline void RedBlackTree<T, Less, Allocator, Augmentation>::rotateRight_( Node<T, Augmentation>*& node )
+{
+    ASSERT_NOT_NULL( node->left );
+    if ( node->left == nullptr )
+    {
+        return;
+    }
+
+    node->left->parent = node->parent;
+    Node<T, Augmentation>* leftNode = node->left;
+
+    node->left = leftNode->right;
+    if ( node->left != nullptr )
+    {
+        node->left->parent = node;
+    }
+
+    leftNode->right = node;
+    leftNode->right->parent = leftNode;
+
+    updateAggregate_( node );
+    updateAggregate_( leftNode );
+
+    node = leftNode;
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+template<typename Key>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::InsertPosition RedBlackTree<T, Less, Allocator, Augmentation>::findInsertPosition_( const Key& key )
+{
+    Node<T, Augmentation>* parent = nullptr;
+    Node<T, Augmentation>** link = &m_root;
+
+    while ( *link != nullptr )
+    {
+        if ( m_less( key, ( *link )->value ) )
+        {
+            parent = *link;
+            link = &parent->left;
+        }
+        else if ( m_less( ( *link )->value, key ) )
+        {
+            parent = *link;
+            link = &parent->right;
+        }
+        else //( *link )->value == key
+        {
+            break;
+        }
+    }
+
+    return { parent, link };
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+template<typename... Args>
+inline Node<T, Augmentation>* RedBlackTree<T, Less, Allocator, Augmentation>::insertAt_( const InsertPosition& position, Args&&... args )
+{
+    auto node = createNode_( std::in_place, std::forward<Args>( args )... );
+    attachNode_( position, node );
+
+    return node;
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+template<typename Key>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::InsertPosition RedBlackTree<T, Less, Allocator, Augmentation>::findHintedPosition_( Node<T, Augmentation>* hint, const Key& key )
+{
+    if ( hint == nullptr )
+    {
+        //end() hint: appending after the rightmost node is the common case for ascending streams
+        if ( m_rightmost == nullptr )
+        {
+            return { nullptr, &m_root };
+        }
+
+        if ( m_less( m_rightmost->value, key ) )
+        {
+            return { m_rightmost, &m_rightmost->right };
+        }
+
+        return findInsertPosition_( key );
+    }
+
+    if ( m_less( key, hint->value ) )
+    {
+        auto it = makeIterator_( hint );
+        auto previous = ( --it ).m_node; //nullptr if hint is the leftmost node
+
+        if ( previous == nullptr || m_less( previous->value, key ) )
+        {
+            //key fits between previous and hint. One of them has a free link on the adjacent side:
+            //either hint has no left child, or previous is the maximum of hint's left subtree.
+            if ( hint->left == nullptr )
+            {
+                return { hint, &hint->left };
+            }
+
+            ASSERT_NULL( previous->right );
+            return { previous, &previous->right };
+        }
+    }
+    else if ( m_less( hint->value, key ) )
+    {
+        auto it = makeIterator_( hint );
+        auto next = ( ++it ).m_node;
+
+        if ( next == nullptr || m_less( key, next->value ) )
+        {
+            if ( hint->right == nullptr )
+            {
+                return { hint, &hint->right };
+            }
+
+            ASSERT_NULL( next->left );
+            return { next, &next->left };
+        }
+    }
+    else //hint->value == key
+    {
+        return { hint->parent, &getStorage_( *hint ) };
+    }
+
+    //hint is not adjacent to key
+    return findInsertPosition_( key );
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+template<typename Key>
+inline Node<T, Augmentation>* RedBlackTree<T, Less, Allocator, Augmentation>::lowerBoundNode_( const Key& key ) const
+{
+    Node<T, Augmentation>* result = nullptr;
+    auto current = m_root;
+
+    while ( current != nullptr )
+    {
+        if ( m_less( current->value, key ) )
+        {
+            current = current->right;
+        }
+        else
+        {
+            result = current;
+            current = current->left;
+        }
+    }
+
+    return result;
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+template<typename Key>
+inline Node<T, Augmentation>* RedBlackTree<T, Less, Allocator, Augmentation>::upperBoundNode_( const Key& key ) const
+{
+    Node<T, Augmentation>* result = nullptr;
+    auto current = m_root;
+
+    while ( current != nullptr )
+    {
+        if ( m_less( key, current->value ) )
+        {
+            result = current;
+            current = current->left;
+        }
+        else
+        {
+            current = current->right;
+        }
+    }
+
+    return result;
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline Node<T, Augmentation>* RedBlackTree<T, Less, Allocator, Augmentation>::leftmost_( Node<T, Augmentation>* node )
+{
+    if ( node == nullptr )
+    {
+        return nullptr;
+    }
+
+    while ( node->left != nullptr )
+    {
+        node = node->left;
+    }
+
+    return node;
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+template<typename Key>
+inline std::pair<Node<T, Augmentation>*, Node<T, Augmentation>*> RedBlackTree<T, Less, Allocator, Augmentation>::splitSubtree_( Node<T, Augmentation>* node, const Key& key,
+    Node<T, Augmentation>** found ) const
+{
+    if ( node == nullptr )
+    {
+        return { nullptr, nullptr };
+    }
+
+    auto left = node->left;
+    auto right = node->right;
+    for ( auto child : { left, right } )
+    {
+        if ( child != nullptr )
+        {
+            child->parent = nullptr;
+        }
+    }
+
+    //Joins along the way cost the difference of black heights of their parts, which telescopes to O(log n)
+    if ( m_less( node->value, key ) )
+    {
+        const auto [lower, upper] = splitSubtree_( right, key, found );
+        return { joinSubtrees_( left, node, lower ), upper };
+    }
+
+    if ( found != nullptr && !m_less( key, node->value ) )
+    {
+        //the node equal to key is taken out of both parts
+        *found = node;
+        return { left, right };
+    }
+
+    const auto [lower, upper] = splitSubtree_( left, key, found );
+    return { lower, joinSubtrees_( upper, node, right ) };
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline Node<T, Augmentation>* RedBlackTree<T, Less, Allocator, Augmentation>::joinSubtrees_( Node<T, Augmentation>* left,
+    Node<T, Augmentation>* pivot, Node<T, Augmentation>* right )
+{
+    //Subtrees are joined as standalone trees: red roots are painted black.
+    //Only nodes of the three parts are touched, so disjoint parts can be joined concurrently.
+    for ( auto root : { left, right } )
+    {
+        if ( root != nullptr )
+        {
+            root->parent = nullptr;
+            root->setColor( Color::Black );
+        }
+    }
+
+    const auto leftHeight = blackHeight_( left );
+    const auto rightHeight = blackHeight_( right );
+
+    if ( leftHeight == rightHeight )
+    {
+        pivot->left = left;
+        pivot->right = right;
+        pivot->parent = nullptr;
+        pivot->setColor( Color::Black );
+        for ( auto child : { left, right } )
+        {
+            if ( child != nullptr )
+            {
+                child->parent = pivot;
+            }
+        }
+        updateAggregate_( pivot );
+        return pivot;
+    }
+
+    //Pivot becomes a red node between the taller tree's spine and the black node of the shorter tree's height.
+    //Both its children then have equal black heights, so only a red parent is to be fixed, as after insertion.
+    const bool leftIsTaller = leftHeight > rightHeight;
+    const auto shorterHeight = std::min( leftHeight, rightHeight );
+    auto current = leftIsTaller ? left : right;
+    auto height = std::max( leftHeight, rightHeight );
+    Node<T, Augmentation>* parent = nullptr;
+
+    while ( current != nullptr && ( current->color() == Color::Red || height != shorterHeight ) )
+    {
+        if ( current->color() == Color::Black )
+        {
+            --height;
+        }
+        parent = current;
+        current = leftIsTaller ? current->right : current->left;
+    }
+    ASSERT_NOT_NULL( parent );
+
+    auto root = leftIsTaller ? left : right;
+    pivot->parent = parent;
+    pivot->setColor( Color::Red );
+    if ( leftIsTaller )
+    {
+        parent->right = pivot;
+        pivot->left = current;
+        pivot->right = right;
+    }
+    else
+    {
+        parent->left = pivot;
+        pivot->left = left;
+        pivot->right = current;
+    }
+    for ( auto child : { pivot->left, pivot->right } )
+    {
+        if ( child != nullptr )
+        {
+            child->parent = pivot;
+        }
+    }
+
+    updateAggregatesToRoot_( pivot );
+    fixAfterInsert_( pivot, root );
+    return root;
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline void RedBlackTree<T, Less, Allocator, Augmentation>::joinWith_( Node<T, Augmentation>* pivot, RedBlackTree&& right )
+{
+    ASSERT( m_nodeAllocator == right.m_nodeAllocator );
+    ASSERT( m_rightmost == nullptr || m_less( m_rightmost->value, pivot->value ) );
+    ASSERT( right.m_root == nullptr || m_less( pivot->value, right.m_leftmost->value ) );
+
+    m_leftmost = m_root != nullptr ? m_leftmost : pivot;
+    m_root = joinSubtrees_( m_root, pivot, right.m_root );
+    m_rightmost = right.m_root != nullptr ? right.m_rightmost : pivot;
+    m_size += right.m_size + 1;
+
+    right.m_root = right.m_leftmost = right.m_rightmost = nullptr;
+    right.m_size = 0;
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline Node<T, Augmentation>* RedBlackTree<T, Less, Allocator, Augmentation>::joinSubtrees_( Node<T, Augmentation>* left, Node<T, Augmentation>* right )
+{
+    if ( left == nullptr )
+    {
+        if ( right != nullptr )
+        {
+            right->parent = nullptr;
+            right->setColor( Color::Black );
+        }
+        return right;
+    }
+
+    const auto [rest, last] = splitLast_( left );
+    return joinSubtrees_( rest, last, right );
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline std::pair<Node<T, Augmentation>*, Node<T, Augmentation>*> RedBlackTree<T, Less, Allocator, Augmentation>::splitLast_( Node<T, Augmentation>* node )
+{
+    //detaches the maximum of a subtree, rejoining the left parts on the way back
+    auto left = node->left;
+    auto right = node->right;
+    if ( right == nullptr )
+    {
+        if ( left != nullptr )
+        {
+            left->parent = nullptr;
+        }
+        return { left, node };
+    }
+
+    const auto [rest, last] = splitLast_( right );
+    return { joinSubtrees_( left, node, rest ), last };
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline RedBlackTree<T, Less, Allocator, Augmentation> RedBlackTree<T, Less, Allocator, Augmentation>::applySetOperation_( SetOperation operation,
+    RedBlackTree<T, Less, Allocator, Augmentation>&& left, RedBlackTree<T, Less, Allocator, Augmentation>&& right, std::size_t threads )
+{
+    ASSERT( left.m_nodeAllocator == right.m_nodeAllocator );
+
+    RedBlackTree<T, Less, Allocator, Augmentation> result( std::move( left ) );
+    const auto size = result.m_size + right.m_size;
+
+    std::size_t forkDepth = 0;
+    while ( ( std::size_t{ 1 } << forkDepth ) < threads )
+    {
+        ++forkDepth;
+    }
+
+    std::vector<Node<T, Augmentation>*> dropped;
+    result.m_root = result.setOperationSubtree_( operation, result.m_root, right.m_root, dropped, 0, forkDepth );
+    right.m_root = right.m_leftmost = right.m_rightmost = nullptr;
+    right.m_size = 0;
+
+    if ( result.m_root != nullptr )
+    {
+        result.m_root->parent = nullptr;
+        result.m_root->setColor( Color::Black );
+    }
+    result.m_leftmost = leftmost_( result.m_root );
+    result.m_rightmost = rightmost_( result.m_root );
+    //every node of both trees is either kept or dropped
+    result.m_size = size - dropped.size();
+
+    for ( auto node : dropped )
+    {
+        result.destroyNode_( node );
+    }
+
+    return result;
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline Node<T, Augmentation>* RedBlackTree<T, Less, Allocator, Augmentation>::setOperationSubtree_( SetOperation operation,
+    Node<T, Augmentation>* left, Node<T, Augmentation>* right, std::vector<Node<T, Augmentation>*>& dropped,
+    std::size_t depth, std::size_t forkDepth ) const
+{
+    if ( left == nullptr || right == nullptr )
+    {
+        switch ( operation )
+        {
+        case SetOperation::Union:
+            return left != nullptr ? left : right;
+        case SetOperation::Intersection:
+            collectSubtree_( left, dropped );
+            collectSubtree_( right, dropped );
+            return nullptr;
+        case SetOperation::Difference:
+            collectSubtree_( right, dropped );
+            return left;
+        }
+    }
+
+    //Union and intersection split right by the root of left, difference splits left by the root of right
+    const bool exposeLeft = operation != SetOperation::Difference;
+    auto pivot = exposeLeft ? left : right;
+    const bool fork = depth < forkDepth && blackHeight_( pivot ) >= parallelSetOperationHeight;
+
+    auto pivotLeft = pivot->left;
+    auto pivotRight = pivot->right;
+    for ( auto child : { pivotLeft, pivotRight } )
+    {
+        if ( child != nullptr )
+        {
+            child->parent = nullptr;
+        }
+    }
+
+    Node<T, Augmentation>* found = nullptr;
+    const auto [lower, upper] = splitSubtree_( exposeLeft ? right : left, pivot->value, &found );
+
+    Node<T, Augmentation>* resultLeft = nullptr;
+    Node<T, Augmentation>* resultRight = nullptr;
+    const auto leftOperand = exposeLeft ? pivotLeft : lower;
+    const auto leftOther = exposeLeft ? lower : pivotLeft;
+    const auto rightOperand = exposeLeft ? pivotRight : upper;
+    const auto rightOther = exposeLeft ? upper : pivotRight;
+
+    if ( fork )
+    {
+        //halves own disjoint nodes; each collects its dropped nodes separately
+        std::vector<Node<T, Augmentation>*> leftDropped;
+        auto leftTask = std::async( std::launch::async, [&]()
+        {
+            return setOperationSubtree_( operation, leftOperand, leftOther, leftDropped, depth + 1, forkDepth );
+        } );
+        resultRight = setOperationSubtree_( operation, rightOperand, rightOther, dropped, depth + 1, forkDepth );
+        resultLeft = leftTask.get();
+        dropped.insert( dropped.end(), leftDropped.cbegin(), leftDropped.cend() );
+    }
+    else
+    {
+        resultLeft = setOperationSubtree_( operation, leftOperand, leftOther, dropped, depth + 1, forkDepth );
+        resultRight = setOperationSubtree_( operation, rightOperand, rightOther, dropped, depth + 1, forkDepth );
+    }
+
+    if ( found != nullptr )
+    {
+        dropped.push_back( found );
+    }
+
+    const bool keepPivot = operation == SetOperation::Union || ( operation == SetOperation::Intersection && found != nullptr );
+    if ( keepPivot )
+    {
+        return joinSubtrees_( resultLeft, pivot, resultRight );
+    }
+
+    dropped.push_back( pivot );
+    return joinSubtrees_( resultLeft, resultRight );
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline void RedBlackTree<T, Less, Allocator, Augmentation>::collectSubtree_( Node<T, Augmentation>* node, std::vector<Node<T, Augmentation>*>& nodes )
+{
+    while ( node != nullptr )
+    {
+        collectSubtree_( node->left, nodes );
+        nodes.push_back( node );
+        node = node->right;
+    }
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline std::size_t RedBlackTree<T, Less, Allocator, Augmentation>::blackHeight_( const Node<T, Augmentation>* node )
+{
+    std::size_t height = 0;
+    for ( ; node != nullptr; node = node->left )
+    {
+        if ( node->color() == Color::Black )
+        {
+            ++height;
+        }
+    }
+
+    return height;
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline Node<T, Augmentation>* RedBlackTree<T, Less, Allocator, Augmentation>::rightmost_( Node<T, Augmentation>* node )
+{
+    if ( node == nullptr )
+    {
+        return nullptr;
+    }
+
+    while ( node->right != nullptr )
+    {
+        node = node->right;
+    }
+
+    return node;
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+template<typename Key>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::size_type RedBlackTree<T, Less, Allocator, Augmentation>::rank_( const Key& key ) const
+{
+    static_assert( HasSubtreeSize<Augmentation>::value, "rank requires an augmentation counting subtree sizes" );
+
+    size_type rank = 0;
+    auto current = m_root;
+
+    while ( current != nullptr )
+    {
+        if ( m_less( current->value, key ) )
+        {
+            rank += subtreeSize_( current->left ) + 1;
+            current = current->right;
+        }
+        else
+        {
+            current = current->left;
+        }
+    }
+
+    return rank;
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::size_type RedBlackTree<T, Less, Allocator, Augmentation>::subtreeSize_( const Node<T, Augmentation>* node )
+{
+    return node == nullptr ? 0 : Augmentation::size( node->aggregate );
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+template<typename Key>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::aggregate_type RedBlackTree<T, Less, Allocator, Augmentation>::reduce_( const Key& low, const Key& high ) const
+{
+    static_assert( !std::is_same_v<Augmentation, NoAugmentation>, "reduce requires an augmentation" );
+
+    //the highest node inside the range splits it into a suffix of its left subtree and a prefix of its right one
+    auto split = m_root;
+    while ( split != nullptr )
+    {
+        if ( m_less( split->value, low ) )
+        {
+            split = split->right;
+        }
+        else if ( !m_less( split->value, high ) )
+        {
+            split = split->left;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    if ( split == nullptr )
+    {
+        return Augmentation::identity();
+    }
+
+    //combine is not required to be commutative, so both sides are accumulated in order
+    auto left = Augmentation::identity();
+    for ( auto current = split->left; current != nullptr; )
+    {
+        if ( m_less( current->value, low ) )
+        {
+            current = current->right;
+        }
+        else
+        {
+            left = Augmentation::combine( Augmentation::combine( Augmentation::make( current->value ), aggregate_( current->right ) ), left );
+            current = current->left;
+        }
+    }
+
+    auto right = Augmentation::identity();
+    for ( auto current = split->right; current != nullptr; )
+    {
+        if ( m_less( current->value, high ) )
+        {
+            right = Augmentation::combine( right, Augmentation::combine( aggregate_( current->left ), Augmentation::make( current->value ) ) );
+            current = current->right;
+        }
+        else
+        {
+            current = current->left;
+        }
     }
 
-    return buffer.GetString();
+    return Augmentation::combine( Augmentation::combine( left, Augmentation::make( split->value ) ), right );
 }
 
-template<typename T, typename Less>
-inline void RedBlackTree<T, Less>::rotateLeft_( std::unique_ptr<Node<T>>& node )
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::aggregate_type RedBlackTree<T, Less, Allocator, Augmentation>::aggregate_( const Node<T, Augmentation>* node )
 {
-    ASSERT_NOT_NULL( node->right );
-    if ( node->right == nullptr )
+    if constexpr ( !std::is_same_v<Augmentation, NoAugmentation> )
     {
-        return;
+        return node == nullptr ? Augmentation::identity() : node->aggregate;
     }
+}
 
-    node->right->parent = node->parent;
-
-    std::unique_ptr<Node<T>> rightNode = std::move( node->right );
-
-    node->right = std::move( rightNode->left );
-    if ( node->right != nullptr )
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline void RedBlackTree<T, Less, Allocator, Augmentation>::updateAggregate_( Node<T, Augmentation>* node )
+{
+    if constexpr ( !std::is_same_v<Augmentation, NoAugmentation> )
     {
-        node->right->parent = node.get();
+        node->aggregate = Augmentation::combine(
+            Augmentation::combine( aggregate_( node->left ), Augmentation::make( node->value ) ),
+            aggregate_( node->right ) );
     }
-
-    rightNode->left = std::move( node );
-    rightNode->left->parent = rightNode.get();
-
-    node = std::move( rightNode );
 }
 
-
-template<typename T, typename Less>
-inline void RedBlackTree<T, Less>::rotateRight_( std::unique_ptr<Node<T>>& node )
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline void RedBlackTree<T, Less, Allocator, Augmentation>::updateAggregatesToRoot_( Node<T, Augmentation>* node )
 {
-    ASSERT_NOT_NULL( node->left );
-    if ( node->left == nullptr )
+    if constexpr ( !std::is_same_v<Augmentation, NoAugmentation> )
     {
-        return;
+        for ( ; node != nullptr; node = node->parent )
+        {
+            updateAggregate_( node );
+        }
     }
+}
 
-    node->left->parent = node->parent;
-    std::unique_ptr<Node<T>> leftNode = std::move( node->left );
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+template<typename Key>
+inline Node<T, Augmentation>* RedBlackTree<T, Less, Allocator, Augmentation>::findNode_( const Key& key ) const
+{
+    auto current = m_root;
 
-    node->left = std::move( leftNode->right );
-    if ( node->left != nullptr )
+    while ( current != nullptr )
     {
-        node->left->parent = node.get();
+        if ( m_less( key, current->value ) )
+        {
+            current = current->left;
+        }
+        else if ( m_less( current->value, key ) )
+        {
+            current = current->right;
+        }
+        else
+        {
+            return current;
+        }
     }
+    return nullptr;
+}
 
-    leftNode->right = std::move( node );
-    leftNode->right->parent = leftNode.get();
-
-    node = std::move( leftNode );
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline void RedBlackTree<T, Less, Allocator, Augmentation>::prefetch_( const void* address )
+{
+#if defined( _MSC_VER ) && ( defined( _M_X64 ) || defined( _M_IX86 ) )
+    _mm_prefetch( static_cast<const char*>( address ), _MM_HINT_T0 );
+#elif defined( __GNUC__ )
+    __builtin_prefetch( address );
+#else
+    static_cast<void>( address );
+#endif
 }
 
-template<typename T, typename Less>
-inline Node<T>* RedBlackTree<T, Less>::insertAsBST_( const T& value )
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+template<typename KeyIter, typename Visitor>
+inline void RedBlackTree<T, Less, Allocator, Augmentation>::findMany_( KeyIter first, KeyIter last, Visitor visit ) const
 {
-    if ( m_root == nullptr )
-    {
-        m_root = std::make_unique<Node<T>>( value, Color::Black );
-        return m_root.get();
-    }
+    std::array<KeyIter, findBatchSize> keys;
+    std::array<Node<T, Augmentation>*, findBatchSize> nodes;
+    std::array<Node<T, Augmentation>*, findBatchSize> found;
+    //indices of the descents still going, the finished ones are swapped out
+    std::array<std::size_t, findBatchSize> pending;
 
-    auto* current = m_root.get();
-    while ( true )
+    while ( first != last )
     {
-        if ( m_less( value, current->value ) )
+        std::size_t count = 0;
+        for ( ; count < findBatchSize && first != last; ++count, ++first )
         {
-            if ( current->left == nullptr )
-            {
-                current->left = std::make_unique<Node<T>>( value, Color::Red, current );
-                current = current->left.get();
-                break;
-            }
-            else
-            {
-                current = current->left.get();
-            }
+            keys[count] = first;
+            nodes[count] = m_root;
+            found[count] = nullptr;
+            pending[count] = count;
         }
-        else if ( m_less( current->value, value ) )
+
+        //one level of every descent per round: by the time a descent is back, its node has had a whole round to arrive
+        std::size_t active = m_root == nullptr ? 0 : count;
+        while ( active > 0 )
         {
-            if ( current->right == nullptr )
+            for ( std::size_t i = 0; i < active; )
             {
-                current->right = std::make_unique<Node<T>>( value, Color::Red, current );
-                current = current->right.get();
-                break;
-            }
-            else
-            {
-                current = current->right.get();
+                const auto index = pending[i];
+                auto node = nodes[index];
+                const auto& key = *keys[index];
+
+                if ( m_less( key, node->value ) )
+                {
+                    node = node->left;
+                }
+                else if ( m_less( node->value, key ) )
+                {
+                    node = node->right;
+                }
+                else
+                {
+                    found[index] = node;
+                    node = nullptr;
+                }
+
+                if ( node == nullptr )
+                {
+                    pending[i] = pending[--active];
+                    continue;
+                }
+
+                prefetch_( node );
+                nodes[index] = node;
+                ++i;
             }
         }
-        else //current->value == value
+
+        for ( std::size_t i = 0; i < count; ++i )
         {
-            return nullptr;
+            visit( found[i] );
         }
     }
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::iterator RedBlackTree<T, Less, Allocator, Augmentation>::makeIterator_( Node<T, Augmentation>* node ) const
+{
+    return { this, node };
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline const Node<T, Augmentation>* RedBlackTree<T, Less, Allocator, Augmentation>::root_() const
+{
+    return m_root;
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline void RedBlackTree<T, Less, Allocator, Augmentation>::attachNode_( const InsertPosition& position, Node<T, Augmentation>* node )
+{
+    ASSERT_NULL( *position.link );
+
+    node->parent = position.parent;
+    node->setColor( Color::Red );
+    *position.link = node;
+
+    if ( position.parent == nullptr || ( position.parent == m_leftmost && position.link == &m_leftmost->left ) )
+    {
+        m_leftmost = node;
+    }
+    if ( position.parent == nullptr || ( position.parent == m_rightmost && position.link == &m_rightmost->right ) )
+    {
+        m_rightmost = node;
+    }
 
-    return current;
+    ++m_size;
+    updateAggregatesToRoot_( node );
+    fixAfterInsert_( node, m_root );
 }
 
-template<typename T, typename Less>
-inline void RedBlackTree<T, Less>::fixAfterInsert_( Node<T>* insertedNode )
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline void RedBlackTree<T, Less, Allocator, Augmentation>::fixAfterInsert_( Node<T, Augmentation>* insertedNode, Node<T, Augmentation>*& root )
 {
     if ( insertedNode->parent == nullptr )
     {
-        insertedNode->color = Color::Black;
+        insertedNode->setColor( Color::Black );
         return;
     }
 
-    if ( insertedNode->parent->color == Color::Black )
+    if ( insertedNode->parent->color() == Color::Black )
     {
         return;
     }
@@ -539,43 +2846,44 @@ inline void RedBlackTree<T, Less>::fixAfterInsert_( Node<T>* insertedNode )
     //parent is red
     auto parent = insertedNode->parent;
     auto grandParent = parent->parent;
-    auto uncle = grandParent->left.get() == parent ? grandParent->right.get() : grandParent->left.get();
+    auto uncle = grandParent->left == parent ? grandParent->right : grandParent->left;
 
-    if ( uncle != nullptr && uncle->color == Color::Red )
+    if ( uncle != nullptr && uncle->color() == Color::Red )
     {
-        parent->color = uncle->color = Color::Black;
-        grandParent->color = Color::Red;
-        fixAfterInsert_( grandParent );
+        parent->setColor( Color::Black );
+        uncle->setColor( Color::Black );
+        grandParent->setColor( Color::Red );
+        fixAfterInsert_( grandParent, root );
         return;
     }
 
     //uncle has black color or it is nullptr
-    if ( insertedNode == parent->right.get() && parent == grandParent->left.get() )
+    if ( insertedNode == parent->right && parent == grandParent->left )
     {
         rotateLeft_( grandParent->left );
         parent = insertedNode;
-        insertedNode = insertedNode->left.get();
+        insertedNode = insertedNode->left;
     }
-    else if ( insertedNode == parent->left.get() && parent == grandParent->right.get() )
+    else if ( insertedNode == parent->left && parent == grandParent->right )
     {
         rotateRight_( grandParent->right );
         parent = insertedNode;
-        insertedNode = insertedNode->right.get();
+        insertedNode = insertedNode->right;
     }
 
     //now parent is LEFT child of grandParent and insertedNode is LEFT child of parent
     //or parent is RIGHT child of grandParent and insertedNode is RIGHT child of parent
 
-    parent->color = Color::Black;
-    grandParent->color = Color::Red;
+    parent->setColor( Color::Black );
+    grandParent->setColor( Color::Red );
 
-    if ( insertedNode == parent->left.get() && parent == grandParent->left.get() )
+    if ( insertedNode == parent->left && parent == grandParent->left )
     {
         if ( grandParent->parent == nullptr )
         {
-            rotateRight_( m_root );
+            rotateRight_( root );
         }
-        else if ( grandParent->parent->right.get() == grandParent )
+        else if ( grandParent->parent->right == grandParent )
         {
             rotateRight_( grandParent->parent->right );
         }
@@ -584,13 +2892,13 @@ inline void RedBlackTree<T, Less>::fixAfterInsert_( Node<T>* insertedNode )
             rotateRight_( grandParent->parent->left );
         }
     }
-    else if ( insertedNode == parent->right.get() && parent == grandParent->right.get() )
+    else if ( insertedNode == parent->right && parent == grandParent->right )
     {
         if ( grandParent->parent == nullptr )
         {
-            rotateLeft_( m_root );
+            rotateLeft_( root );
         }
-        else if ( grandParent->parent->right.get() == grandParent )
+        else if ( grandParent->parent->right == grandParent )
         {
             rotateLeft_( grandParent->parent->right );
         }
@@ -605,8 +2913,8 @@ inline void RedBlackTree<T, Less>::fixAfterInsert_( Node<T>* insertedNode )
     }
 }
 
-template<typename T, typename Less>
-inline void RedBlackTree<T, Less>::fixAfterErase_( Node<T>* parent, bool removedNodeIsLeft )
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline void RedBlackTree<T, Less, Allocator, Augmentation>::fixAfterErase_( Node<T, Augmentation>* parent, bool removedNodeIsLeft )
 {
     if ( parent == nullptr )
     {
@@ -615,13 +2923,13 @@ inline void RedBlackTree<T, Less>::fixAfterErase_( Node<T>* parent, bool removed
     }
 
     auto sibling = removedNodeIsLeft ?
-        parent->right.get() : parent->left.get();
+        parent->right : parent->left;
     ASSERT_NOT_NULL( sibling ); //sibling must not be nullptr, because of equal blackLength for parent
 
-    if ( sibling->color == Color::Red )
+    if ( sibling->color() == Color::Red )
     {
-        parent->color = Color::Red;
-        sibling->color = Color::Black;
+        parent->setColor( Color::Red );
+        sibling->setColor( Color::Black );
 
         if ( removedNodeIsLeft )
         {
@@ -636,33 +2944,33 @@ inline void RedBlackTree<T, Less>::fixAfterErase_( Node<T>* parent, bool removed
     //but sibling could changed
 
     sibling = removedNodeIsLeft ?
-        parent->right.get() : parent->left.get();
+        parent->right : parent->left;
     ASSERT_NOT_NULL( sibling ); //sibling must not be nullptr, because of equal blackLength for parent
 
-    if ( parent->color == Color::Black &&
-        ( sibling->left == nullptr || sibling->left->color == Color::Black ) &&
-        ( sibling->right == nullptr || sibling->right->color == Color::Black ) )
+    if ( parent->color() == Color::Black &&
+        ( sibling->left == nullptr || sibling->left->color() == Color::Black ) &&
+        ( sibling->right == nullptr || sibling->right->color() == Color::Black ) )
     {
         //If all this nodes are black, then we should set sibling's color to Red 
         //to set correct blackLength for parent, but it leads to invalidate
         //blackLength for parent's parents. So, we must fix parent node.
-        sibling->color = Color::Red;
+        sibling->setColor( Color::Red );
         const bool parentIsLeft = parent->parent == nullptr ? true :
-            parent == parent->parent->left.get();
+            parent == parent->parent->left;
         fixAfterErase_( parent->parent, parentIsLeft );
         return;
     }
 
-    if ( parent->color == Color::Red && //in previous case was checked that parent is Black
-        ( sibling->left == nullptr || sibling->left->color == Color::Black ) &&
-        ( sibling->right == nullptr || sibling->right->color == Color::Black ) )
+    if ( parent->color() == Color::Red && //in previous case was checked that parent is Black
+        ( sibling->left == nullptr || sibling->left->color() == Color::Black ) &&
+        ( sibling->right == nullptr || sibling->right->color() == Color::Black ) )
     {
         //If parent is Red, then turning it to Black increases blackLength to all ways,
         //which are going through node (we want to do it in this function).
         //And it also doesn't changes blackLength of all ways,
         //which are going through sibling. This result satisfies us.
-        sibling->color = Color::Red;
-        parent->color = Color::Black;
+        sibling->setColor( Color::Red );
+        parent->setColor( Color::Black );
         return;
     }
     //at least one of sibling's children is Red
@@ -670,26 +2978,26 @@ inline void RedBlackTree<T, Less>::fixAfterErase_( Node<T>* parent, bool removed
     //We want to ensure that sibling is right child and it's right child is Red
     //or sibling is left child and it's left child is Red
 
-    if ( sibling == parent->right.get() )
+    if ( sibling == parent->right )
     {
-        if ( sibling->right == nullptr || sibling->right->color == Color::Black )
+        if ( sibling->right == nullptr || sibling->right->color() == Color::Black )
         {
-            sibling->color = Color::Red;
+            sibling->setColor( Color::Red );
             if ( sibling->left )
             {
-                sibling->left->color = Color::Black;
+                sibling->left->setColor( Color::Black );
             }
             rotateRight_( getStorage_( *sibling ) );
         }
     }
     else
     {
-        if ( sibling->left == nullptr || sibling->left->color == Color::Black )
+        if ( sibling->left == nullptr || sibling->left->color() == Color::Black )
         {
-            sibling->color = Color::Red;
+            sibling->setColor( Color::Red );
             if ( sibling->right )
             {
-                sibling->right->color = Color::Black;
+                sibling->right->setColor( Color::Black );
             }
             rotateLeft_( getStorage_( *sibling ) );
         }
@@ -698,33 +3006,33 @@ inline void RedBlackTree<T, Less>::fixAfterErase_( Node<T>* parent, bool removed
     //or sibling is left child and it's left child is Red
 
     sibling = removedNodeIsLeft ?
-        parent->right.get() : parent->left.get();
+        parent->right : parent->left;
     ASSERT_NOT_NULL( sibling ); //sibling must not be nullptr, because of equal blackLength for parent
 
-    sibling->color = parent->color;
-    parent->color = Color::Black;
+    sibling->setColor( parent->color() );
+    parent->setColor( Color::Black );
 
-    if ( sibling == parent->right.get() )
+    if ( sibling == parent->right )
     {
-        sibling->right->color = Color::Black;
+        sibling->right->setColor( Color::Black );
         rotateLeft_( getStorage_( *parent ) );
     }
     else
     {
-        sibling->left->color = Color::Black;
+        sibling->left->setColor( Color::Black );
         rotateRight_( getStorage_( *parent ) );
     }
 }
 
-template<typename T, typename Less>
-inline std::unique_ptr<Node<T>>& RedBlackTree<T, Less>::getStorage_( Node<T>& node )
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline Node<T, Augmentation>*& RedBlackTree<T, Less, Allocator, Augmentation>::getStorage_( Node<T, Augmentation>& node )
 {
     if ( node.parent == nullptr )
     {
         return m_root;
     }
 
-    if ( &node == node.parent->left.get() )
+    if ( &node == node.parent->left )
     {
         return node.parent->left;
     }
@@ -732,32 +3040,95 @@ inline std::unique_ptr<Node<T>>& RedBlackTree<T, Less>::getStorage_( Node<T>& no
     return node.parent->right;
 }
 
-template<typename T, typename Less>
-inline RedBlackTree<T, Less>::ConstIterator::ConstIterator( Node<T>* const root, Node<T>* node )
-    : m_root( root )
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline void RedBlackTree<T, Less, Allocator, Augmentation>::swapNodes_( Node<T, Augmentation>* upper, Node<T, Augmentation>* lower )
+{
+    //lower must be a descendant of upper
+    const auto upperColor = upper->color();
+    upper->setColor( lower->color() );
+    lower->setColor( upperColor );
+
+    decltype( auto ) upperStorage = getStorage_( *upper );
+    auto upperParent = upper->parent;
+    auto upperLeft = upper->left;
+    auto upperRight = upper->right;
+
+    auto lowerParent = lower->parent;
+    auto lowerLeft = lower->left;
+    auto lowerRight = lower->right;
+
+    if ( lowerParent == upper )
+    {
+        if ( upperLeft == lower )
+        {
+            lower->left = upper;
+            lower->right = upperRight;
+        }
+        else
+        {
+            lower->left = upperLeft;
+            lower->right = upper;
+        }
+        upper->parent = lower;
+    }
+    else
+    {
+        getStorage_( *lower ) = upper;
+        upper->parent = lowerParent;
+        lower->left = upperLeft;
+        lower->right = upperRight;
+    }
+
+    if ( lower->left != nullptr )
+    {
+        lower->left->parent = lower;
+    }
+    if ( lower->right != nullptr )
+    {
+        lower->right->parent = lower;
+    }
+
+    upper->left = lowerLeft;
+    upper->right = lowerRight;
+    if ( lowerLeft != nullptr )
+    {
+        lowerLeft->parent = upper;
+    }
+    if ( lowerRight != nullptr )
+    {
+        lowerRight->parent = upper;
+    }
+
+    lower->parent = upperParent;
+    upperStorage = lower;
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline RedBlackTree<T, Less, Allocator, Augmentation>::ConstIterator::ConstIterator( const RedBlackTree* tree, Node<T, Augmentation>* node )
+    : m_tree( tree )
     , m_node( node )
 {
 
 }
 
-template<typename T, typename Less>
-inline RedBlackTree<T, Less>::ConstIterator::ConstIterator( const ConstIterator& other )
-    : m_root( other.m_root )
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline RedBlackTree<T, Less, Allocator, Augmentation>::ConstIterator::ConstIterator( const ConstIterator& other )
+    : m_tree( other.m_tree )
     , m_node( other.m_node )
 {
 }
 
-template<typename T, typename Less>
-inline typename RedBlackTree<T, Less>::ConstIterator& RedBlackTree<T, Less>::ConstIterator::operator=( const ConstIterator& other )
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::ConstIterator& RedBlackTree<T, Less, Allocator, Augmentation>::ConstIterator::operator=( const ConstIterator& other )
 {
-    m_root = other.m_root;
+    m_tree = other.m_tree;
     m_node = other.m_node;
 
     return *this;
 }
 
-template<typename T, typename Less>
-inline typename RedBlackTree<T, Less>::ConstIterator::value_type RedBlackTree<T, Less>::ConstIterator::operator*() const
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::ConstIterator::value_type RedBlackTree<T, Less, Allocator, Augmentation>::ConstIterator::operator*() const
 {
     if ( m_node == nullptr )
     {
@@ -766,8 +3137,8 @@ inline typename RedBlackTree<T, Less>::ConstIterator::value_type RedBlackTree<T,
     return m_node->value;
 }
 
-template<typename T, typename Less>
-inline typename RedBlackTree<T, Less>::ConstIterator::reference RedBlackTree<T, Less>::ConstIterator::operator*()
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::ConstIterator::reference RedBlackTree<T, Less, Allocator, Augmentation>::ConstIterator::operator*()
 {
     if ( m_node == nullptr )
     {
@@ -776,8 +3147,8 @@ inline typename RedBlackTree<T, Less>::ConstIterator::reference RedBlackTree<T,
     return m_node->value;
 }
 
-template<typename T, typename Less>
-inline typename RedBlackTree<T, Less>::ConstIterator::const_pointer RedBlackTree<T, Less>::ConstIterator::operator->() const
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::ConstIterator::const_pointer RedBlackTree<T, Less, Allocator, Augmentation>::ConstIterator::operator->() const
 {
     if ( m_node == nullptr )
     {
@@ -786,8 +3157,8 @@ inline typename RedBlackTree<T, Less>::ConstIterator::const_pointer RedBlackTree
     return &( m_node->value );
 }
 
-template<typename T, typename Less>
-inline typename RedBlackTree<T, Less>::ConstIterator::pointer RedBlackTree<T, Less>::ConstIterator::operator->()
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::ConstIterator::pointer RedBlackTree<T, Less, Allocator, Augmentation>::ConstIterator::operator->()
 {
     if ( m_node == nullptr )
     {
@@ -796,52 +3167,52 @@ inline typename RedBlackTree<T, Less>::ConstIterator::pointer RedBlackTree<T, Le
     return &( m_node->value );
 }
 
-template<typename T, typename Less>
-inline bool RedBlackTree<T, Less>::ConstIterator::operator==( const RedBlackTree<T, Less>::ConstIterator& other ) const
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline bool RedBlackTree<T, Less, Allocator, Augmentation>::ConstIterator::operator==( const RedBlackTree<T, Less, Allocator, Augmentation>::ConstIterator& other ) const
 {
-    return m_root == other.m_root && m_node == other.m_node;
+    return m_tree == other.m_tree && m_node == other.m_node;
 }
 
-template<typename T, typename Less>
-inline bool RedBlackTree<T, Less>::ConstIterator::operator!=( const RedBlackTree<T, Less>::ConstIterator& other ) const
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline bool RedBlackTree<T, Less, Allocator, Augmentation>::ConstIterator::operator!=( const RedBlackTree<T, Less, Allocator, Augmentation>::ConstIterator& other ) const
 {
     return !( *this == other );
 }
 
-template<typename T, typename Less>
-inline typename RedBlackTree<T, Less>::ConstIterator& RedBlackTree<T, Less>::ConstIterator::operator++()
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::ConstIterator& RedBlackTree<T, Less, Allocator, Augmentation>::ConstIterator::operator++()
 {
     m_node = next_( m_node );
     return *this;
 }
 
-template<typename T, typename Less>
-inline typename RedBlackTree<T, Less>::ConstIterator RedBlackTree<T, Less>::ConstIterator::operator++( int )
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::ConstIterator RedBlackTree<T, Less, Allocator, Augmentation>::ConstIterator::operator++( int )
 {
     auto copy = *this;
     m_node = next_( m_node );
     return copy;
 }
 
-template<typename T, typename Less>
-inline typename RedBlackTree<T, Less>::ConstIterator& RedBlackTree<T, Less>::ConstIterator::operator--()
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::ConstIterator& RedBlackTree<T, Less, Allocator, Augmentation>::ConstIterator::operator--()
 {
     m_node = prev_( m_node );
     return *this;
 }
 
-template<typename T, typename Less>
-inline typename RedBlackTree<T, Less>::ConstIterator RedBlackTree<T, Less>::ConstIterator::operator--( int )
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::ConstIterator RedBlackTree<T, Less, Allocator, Augmentation>::ConstIterator::operator--( int )
 {
     auto copy = *this;
     m_node = prev_( m_node );
     return copy;
 }
 
-template<typename T, typename Less>
-inline Node<T>* RedBlackTree<T, Less>::ConstIterator::next_( Node<T>* node ) const
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline Node<T, Augmentation>* RedBlackTree<T, Less, Allocator, Augmentation>::ConstIterator::next_( Node<T, Augmentation>* node ) const
 {
-    Node<T>* nextNode = nullptr;
+    Node<T, Augmentation>* nextNode = nullptr;
 
     if ( node == nullptr )
     {
@@ -851,10 +3222,10 @@ inline Node<T>* RedBlackTree<T, Less>::ConstIterator::next_( Node<T>* node ) con
 
     if ( node->right != nullptr )
     {
-        nextNode = node->right.get();
+        nextNode = node->right;
         while ( nextNode->left != nullptr )
         {
-            nextNode = nextNode->left.get();
+            nextNode = nextNode->left;
         }
 
         return nextNode;
@@ -865,13 +3236,13 @@ inline Node<T>* RedBlackTree<T, Less>::ConstIterator::next_( Node<T>* node ) con
         return nullptr;
     }
 
-    if ( node == node->parent->left.get() )
+    if ( node == node->parent->left )
     {
         return node->parent;
     }
 
     nextNode = node;
-    while ( nextNode->parent->parent != nullptr && nextNode->parent == nextNode->parent->parent->right.get() )
+    while ( nextNode->parent->parent != nullptr && nextNode->parent == nextNode->parent->parent->right )
     {
         nextNode = nextNode->parent;
     }
@@ -879,28 +3250,22 @@ inline Node<T>* RedBlackTree<T, Less>::ConstIterator::next_( Node<T>* node ) con
     return nextNode->parent->parent;
 }
 
-template<typename T, typename Less>
-inline Node<T>* RedBlackTree<T, Less>::ConstIterator::prev_( Node<T>* node ) const
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline Node<T, Augmentation>* RedBlackTree<T, Less, Allocator, Augmentation>::ConstIterator::prev_( Node<T, Augmentation>* node ) const
 {
-    Node<T>* nextNode = nullptr;
+    Node<T, Augmentation>* nextNode = nullptr;
 
     if ( node == nullptr )
     {
-        nextNode = m_root;
-        while ( nextNode->right != nullptr )
-        {
-            nextNode = nextNode->right.get();
-        }
-
-        return nextNode;
+        return m_tree->m_rightmost;
     }
 
     if ( node->left != nullptr )
     {
-        nextNode = node->left.get();
+        nextNode = node->left;
         while ( nextNode->right != nullptr )
         {
-            nextNode = nextNode->right.get();
+            nextNode = nextNode->right;
         }
 
         return nextNode;
@@ -911,16 +3276,354 @@ inline Node<T>* RedBlackTree<T, Less>::ConstIterator::prev_( Node<T>* node ) con
         return nullptr;
     }
 
-    if ( node == node->parent->right.get() )
+    if ( node == node->parent->right )
     {
         return node->parent;
     }
 
     nextNode = node;
-    while ( nextNode->parent->parent != nullptr && nextNode->parent == nextNode->parent->parent->left.get() )
+    while ( nextNode->parent->parent != nullptr && nextNode->parent == nextNode->parent->parent->left )
     {
         nextNode = nextNode->parent;
     }
 
     return nextNode->parent->parent;
 }
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline RedBlackTree<T, Less, Allocator, Augmentation>::ConstRange::ConstRange( const const_iterator& first, const const_iterator& last )
+    : m_first( first )
+    , m_last( last )
+{
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::const_iterator RedBlackTree<T, Less, Allocator, Augmentation>::ConstRange::begin() const
+{
+    return m_first;
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline typename RedBlackTree<T, Less, Allocator, Augmentation>::const_iterator RedBlackTree<T, Less, Allocator, Augmentation>::ConstRange::end() const
+{
+    return m_last;
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline bool RedBlackTree<T, Less, Allocator, Augmentation>::ConstRange::empty() const
+{
+    return m_first == m_last;
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline RedBlackTree<T, Less, Allocator, Augmentation>::JsonReader::JsonReader( RedBlackTree& tree )
+    : m_tree( tree )
+    , m_frames()
+    , m_done( false )
+    , m_error()
+{
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline RedBlackTree<T, Less, Allocator, Augmentation>::JsonReader::~JsonReader()
+{
+    for ( auto& frame : m_frames )
+    {
+        m_tree.destroySubtree_( frame.left ? frame.left->root : nullptr );
+        m_tree.destroySubtree_( frame.right ? frame.right->root : nullptr );
+    }
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline bool RedBlackTree<T, Less, Allocator, Augmentation>::JsonReader::Null()
+{
+    if ( m_frames.empty() )
+    {
+        //an empty tree
+        m_done = true;
+        return true;
+    }
+
+    return subtree_( Subtree{} );
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline bool RedBlackTree<T, Less, Allocator, Augmentation>::JsonReader::Bool( bool value )
+{
+    if constexpr ( std::is_same_v<T, bool> )
+    {
+        return value_( T( value ) );
+    }
+    else
+    {
+        return fail_( "unexpected boolean" );
+    }
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline bool RedBlackTree<T, Less, Allocator, Augmentation>::JsonReader::Int( int value )
+{
+    return number_( value );
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline bool RedBlackTree<T, Less, Allocator, Augmentation>::JsonReader::Uint( unsigned value )
+{
+    return number_( value );
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline bool RedBlackTree<T, Less, Allocator, Augmentation>::JsonReader::Int64( std::int64_t value )
+{
+    return number_( value );
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline bool RedBlackTree<T, Less, Allocator, Augmentation>::JsonReader::Uint64( std::uint64_t value )
+{
+    return number_( value );
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline bool RedBlackTree<T, Less, Allocator, Augmentation>::JsonReader::Double( double value )
+{
+    return number_( value );
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline bool RedBlackTree<T, Less, Allocator, Augmentation>::JsonReader::RawNumber( const char*, rapidjson::SizeType, bool )
+{
+    return fail_( "unexpected raw number" );
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline bool RedBlackTree<T, Less, Allocator, Augmentation>::JsonReader::String( const char* text, rapidjson::SizeType length, bool )
+{
+    const std::string_view string( text, length );
+    if ( !m_frames.empty() && m_frames.back().field == Field::Color )
+    {
+        auto& frame = m_frames.back();
+        if ( string != "red" && string != "black" )
+        {
+            return fail_( "color must be red or black" );
+        }
+        frame.color = string == "red" ? Color::Red : Color::Black;
+        frame.field = Field::None;
+        return true;
+    }
+
+    if constexpr ( std::is_constructible_v<T, std::string_view> && !std::is_arithmetic_v<T> )
+    {
+        return value_( T( string ) );
+    }
+    else
+    {
+        return fail_( "unexpected string" );
+    }
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline bool RedBlackTree<T, Less, Allocator, Augmentation>::JsonReader::StartObject()
+{
+    if ( !m_frames.empty() && m_frames.back().field != Field::Left && m_frames.back().field != Field::Right )
+    {
+        return fail_( "objects are only allowed as left and right" );
+    }
+
+    m_frames.emplace_back();
+    return true;
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline bool RedBlackTree<T, Less, Allocator, Augmentation>::JsonReader::Key( const char* text, rapidjson::SizeType length, bool )
+{
+    auto& frame = m_frames.back();
+    const std::string_view key( text, length );
+
+    bool seen = false;
+    if ( key == "value" )
+    {
+        frame.field = Field::Value;
+        seen = frame.value.has_value();
+    }
+    else if ( key == "color" )
+    {
+        frame.field = Field::Color;
+        seen = frame.color.has_value();
+    }
+    else if ( key == "left" )
+    {
+        frame.field = Field::Left;
+        seen = frame.left.has_value();
+    }
+    else if ( key == "right" )
+    {
+        frame.field = Field::Right;
+        seen = frame.right.has_value();
+    }
+    else
+    {
+        return fail_( "unknown member" );
+    }
+
+    return seen ? fail_( "duplicate member" ) : true;
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline bool RedBlackTree<T, Less, Allocator, Augmentation>::JsonReader::EndObject( rapidjson::SizeType )
+{
+    auto& frame = m_frames.back();
+    if ( !frame.value || !frame.color )
+    {
+        return fail_( "node without value or color" );
+    }
+
+    const Subtree left = frame.left.value_or( Subtree{} );
+    const Subtree right = frame.right.value_or( Subtree{} );
+    const bool isRed = *frame.color == Color::Red;
+
+    if ( left.root != nullptr && !m_tree.m_less( left.rightmost->value, *frame.value ) )
+    {
+        return fail_( "left subtree is not less than its parent" );
+    }
+    if ( right.root != nullptr && !m_tree.m_less( *frame.value, right.leftmost->value ) )
+    {
+        return fail_( "right subtree is not greater than its parent" );
+    }
+    if ( left.blackHeight != right.blackHeight )
+    {
+        return fail_( "black heights of the subtrees differ" );
+    }
+    if ( isRed && ( ( left.root != nullptr && left.root->color() == Color::Red )
+        || ( right.root != nullptr && right.root->color() == Color::Red ) ) )
+    {
+        return fail_( "red node with a red child" );
+    }
+
+    //the frame keeps owning the children until the node exists
+    Node<T, Augmentation>* node = m_tree.createNode_( std::in_place, std::move( *frame.value ) );
+    node->setColor( *frame.color );
+    node->left = left.root;
+    node->right = right.root;
+    if ( left.root != nullptr )
+    {
+        left.root->parent = node;
+    }
+    if ( right.root != nullptr )
+    {
+        right.root->parent = node;
+    }
+    updateAggregate_( node );
+    ++m_tree.m_size;
+
+    m_frames.pop_back();
+    return subtree_( { node,
+        left.root != nullptr ? left.leftmost : node,
+        right.root != nullptr ? right.rightmost : node,
+        left.blackHeight + ( isRed ? 0 : 1 ) } );
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline bool RedBlackTree<T, Less, Allocator, Augmentation>::JsonReader::StartArray()
+{
+    return fail_( "unexpected array" );
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline bool RedBlackTree<T, Less, Allocator, Augmentation>::JsonReader::EndArray( rapidjson::SizeType )
+{
+    return fail_( "unexpected array" );
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline bool RedBlackTree<T, Less, Allocator, Augmentation>::JsonReader::done() const
+{
+    return m_done;
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline const std::string& RedBlackTree<T, Less, Allocator, Augmentation>::JsonReader::error() const
+{
+    return m_error;
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+template<typename Number>
+inline bool RedBlackTree<T, Less, Allocator, Augmentation>::JsonReader::number_( Number number )
+{
+    if constexpr ( std::is_floating_point_v<T> )
+    {
+        return value_( static_cast<T>( number ) );
+    }
+    else if constexpr ( std::is_integral_v<T> && !std::is_same_v<T, bool> && std::is_integral_v<Number> )
+    {
+        const T value = static_cast<T>( number );
+        if ( static_cast<Number>( value ) != number || ( value < T{} ) != ( number < Number{} ) )
+        {
+            return fail_( "value out of range" );
+        }
+        return value_( T( value ) );
+    }
+    else
+    {
+        return fail_( "unexpected number" );
+    }
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline bool RedBlackTree<T, Less, Allocator, Augmentation>::JsonReader::value_( T&& value )
+{
+    if ( m_frames.empty() || m_frames.back().field != Field::Value )
+    {
+        return fail_( "unexpected value" );
+    }
+
+    auto& frame = m_frames.back();
+    frame.value.emplace( std::move( value ) );
+    frame.field = Field::None;
+    return true;
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline bool RedBlackTree<T, Less, Allocator, Augmentation>::JsonReader::subtree_( const Subtree& subtree )
+{
+    if ( m_frames.empty() )
+    {
+        if ( subtree.root->color() != Color::Black )
+        {
+            m_tree.destroySubtree_( subtree.root );
+            return fail_( "root must be black" );
+        }
+
+        m_tree.m_root = subtree.root;
+        m_tree.m_leftmost = subtree.leftmost;
+        m_tree.m_rightmost = subtree.rightmost;
+        m_done = true;
+        return true;
+    }
+
+    auto& frame = m_frames.back();
+    if ( frame.field == Field::Left )
+    {
+        frame.left = subtree;
+    }
+    else if ( frame.field == Field::Right )
+    {
+        frame.right = subtree;
+    }
+    else
+    {
+        m_tree.destroySubtree_( subtree.root );
+        return fail_( subtree.root == nullptr ? "unexpected null" : "unexpected object" );
+    }
+
+    frame.field = Field::None;
+    return true;
+}
+
+template<typename T, typename Less, typename Allocator, typename Augmentation>
+inline bool RedBlackTree<T, Less, Allocator, Augmentation>::JsonReader::fail_( const char* message )
+{
+    m_error = message;
+    return false;
+}
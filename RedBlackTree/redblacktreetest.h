@@ -1,13 +1,15 @@
 #pragma once
 #include "redblacktree.h"
+#include "persistenttree.h"
+#include "concurrenttree.h"
 
 class RedBlackTreeTest
 {
 public:
 
 #define TEST_DECL(testName) \
-	template<typename T, typename Less = std::less<T>> \
-	static bool testName(const RedBlackTree<T, Less>& tree)
+	template<typename T, typename Less = std::less<T>, typename Allocator = std::allocator<T>, typename Augmentation = NoAugmentation> \
+	static bool testName(const RedBlackTree<T, Less, Allocator, Augmentation>& tree)
 
     TEST_DECL( copyConstructorIsValid );
     TEST_DECL( moveConstructorIsValid );
@@ -23,32 +25,43 @@ public:
     TEST_DECL( bothChildrenOfRedAreBlack );
     TEST_DECL( blackLengthIsCorrectForEveryNode );
 
+    TEST_DECL( cachedNodesAreValid );
+    TEST_DECL( aggregatesAreValid );
+
     TEST_DECL( isRedBlackTree );
 
     TEST_DECL( iteratorsAreValid );
     TEST_DECL( reverseIteratorsAreValid );
 
     TEST_DECL( findIsCorrect );
+    TEST_DECL( findManyIsCorrect );
+    TEST_DECL( boundsAreCorrect );
 
     TEST_DECL( eraseIsValid );
 
 #undef TEST_DECL
+
+    template<typename T, typename Less, typename Allocator>
+    static bool isRedBlackTree( const PersistentRedBlackTree<T, Less, Allocator>& tree );
+
+    template<typename T, typename Less, typename Allocator>
+    static bool isRedBlackTree( const ConcurrentRedBlackTree<T, Less, Allocator>& tree );
 };
 
 #define TEST_DEF(testName) \
-template<typename T, typename Less> \
-inline bool RedBlackTreeTest::testName(const RedBlackTree<T, Less>& tree)
+template<typename T, typename Less, typename Allocator, typename Augmentation> \
+inline bool RedBlackTreeTest::testName(const RedBlackTree<T, Less, Allocator, Augmentation>& tree)
 
 TEST_DEF( copyConstructorIsValid )
 {
-    RedBlackTree<T, Less> copy( tree );
+    RedBlackTree<T, Less, Allocator, Augmentation> copy( tree );
     return isRedBlackTree( copy ) && tree == copy;
 }
 
 TEST_DEF( moveConstructorIsValid )
 {
-    RedBlackTree<T, Less> copyTree( tree );
-    RedBlackTree<T, Less> moveTree( std::move( copyTree ) );
+    RedBlackTree<T, Less, Allocator, Augmentation> copyTree( tree );
+    RedBlackTree<T, Less, Allocator, Augmentation> moveTree( std::move( copyTree ) );
 
     return copyTree.size() == 0 && copyTree.m_root == nullptr &&
         isRedBlackTree( moveTree ) && tree == moveTree;
@@ -56,15 +69,15 @@ TEST_DEF( moveConstructorIsValid )
 
 TEST_DEF( copyAssignmentIsValid )
 {
-    RedBlackTree<T, Less> copy;
+    RedBlackTree<T, Less, Allocator, Augmentation> copy;
     copy = tree;
     return isRedBlackTree( copy ) && tree == copy;
 }
 
 TEST_DEF( moveAssignmentIsValid )
 {
-    RedBlackTree<T, Less> copyTree( tree );
-    RedBlackTree<T, Less> moveTree;
+    RedBlackTree<T, Less, Allocator, Augmentation> copyTree( tree );
+    RedBlackTree<T, Less, Allocator, Augmentation> moveTree;
 
     moveTree = std::move( copyTree );
 
@@ -77,8 +90,8 @@ TEST_DEF( isEmpty )
     return tree.size() == 0 && tree.m_root == nullptr;
 }
 
-template<typename T, typename Less>
-inline bool isBinarySearchTreeImpl( const Node<T>* node, const Less& less )
+template<typename NodeType, typename Less>
+inline bool isBinarySearchTreeImpl( const NodeType* node, const Less& less )
 {
     if ( node == nullptr )
     {
@@ -91,17 +104,17 @@ inline bool isBinarySearchTreeImpl( const Node<T>* node, const Less& less )
     return
         leftIsLess &&
         rightIsGreater &&
-        isBinarySearchTreeImpl( node->left.get(), less ) &&
-        isBinarySearchTreeImpl( node->right.get(), less );
+        isBinarySearchTreeImpl( node->left, less ) &&
+        isBinarySearchTreeImpl( node->right, less );
 }
 
 TEST_DEF( isBinarySearchTree )
 {
-    return isBinarySearchTreeImpl( tree.m_root.get(), tree.m_less );
+    return isBinarySearchTreeImpl( tree.m_root, tree.m_less );
 }
 
-template<typename T>
-bool allPointersAreValidImpl( const Node<T>* node )
+template<typename NodeType>
+bool allPointersAreValidImpl( const NodeType* node )
 {
     if ( node == nullptr )
     {
@@ -111,22 +124,22 @@ bool allPointersAreValidImpl( const Node<T>* node )
     return
         ( node->left == nullptr || node->left->parent == node ) &&
         ( node->right == nullptr || node->right->parent == node ) &&
-        allPointersAreValidImpl( node->left.get() ) &&
-        allPointersAreValidImpl( node->right.get() );
+        allPointersAreValidImpl( node->left ) &&
+        allPointersAreValidImpl( node->right );
 }
 
 TEST_DEF( allPointersAreValid )
 {
-    return allPointersAreValidImpl( tree.m_root.get() );
+    return allPointersAreValidImpl( tree.m_root );
 }
 
 TEST_DEF( rootIsBlack )
 {
-    return tree.m_root == nullptr || tree.m_root->color == Color::Black;
+    return tree.m_root == nullptr || tree.m_root->color() == Color::Black;
 }
 
-template<typename T>
-bool bothChildrenOfRedAreBlackImpl( const Node<T>* node )
+template<typename NodeType>
+bool bothChildrenOfRedAreBlackImpl( const NodeType* node )
 {
     if ( node == nullptr )
     {
@@ -134,42 +147,86 @@ bool bothChildrenOfRedAreBlackImpl( const Node<T>* node )
     }
 
     return
-        ( node->color == Color::Black ||
-            ( node->left == nullptr || node->left->color == Color::Black ) &&
-            ( node->right == nullptr || node->right->color == Color::Black ) ) &&
-        bothChildrenOfRedAreBlackImpl( node->left.get() ) &&
-        bothChildrenOfRedAreBlackImpl( node->right.get() );
+        ( node->color() == Color::Black ||
+            ( node->left == nullptr || node->left->color() == Color::Black ) &&
+            ( node->right == nullptr || node->right->color() == Color::Black ) ) &&
+        bothChildrenOfRedAreBlackImpl( node->left ) &&
+        bothChildrenOfRedAreBlackImpl( node->right );
 }
 
 TEST_DEF( bothChildrenOfRedAreBlack )
 {
-    return bothChildrenOfRedAreBlackImpl( tree.m_root.get() );
+    return bothChildrenOfRedAreBlackImpl( tree.m_root );
 }
 
-template<typename T>
-std::pair<bool, std::size_t> blackLengthIsCorrectForEveryNodeImpl( const Node<T>* node, std::size_t blackLength )
+template<typename NodeType>
+std::pair<bool, std::size_t> blackLengthIsCorrectForEveryNodeImpl( const NodeType* node, std::size_t blackLength )
 {
     if ( node == nullptr )
     {
         return { true, blackLength + 1 }; // sheets always have black color
     }
 
-    const std::size_t thisNodeLength = node->color == Color::Black ? 1 : 0;
+    const std::size_t thisNodeLength = node->color() == Color::Black ? 1 : 0;
 
-    const auto [leftEqual, leftLength] = blackLengthIsCorrectForEveryNodeImpl( node->left.get(), blackLength + thisNodeLength );
+    const auto [leftEqual, leftLength] = blackLengthIsCorrectForEveryNodeImpl( node->left, blackLength + thisNodeLength );
     if ( !leftEqual )
     {
         return { false, leftLength };
     }
 
-    const auto [rightEqual, rightLength] = blackLengthIsCorrectForEveryNodeImpl( node->right.get(), blackLength + thisNodeLength );
+    const auto [rightEqual, rightLength] = blackLengthIsCorrectForEveryNodeImpl( node->right, blackLength + thisNodeLength );
 
     return { leftEqual && rightEqual && leftLength == rightLength, leftLength };
 }
 
 TEST_DEF( blackLengthIsCorrectForEveryNode )
 {
-    return blackLengthIsCorrectForEveryNodeImpl( tree.m_root.get(), 1 ).first;
+    return blackLengthIsCorrectForEveryNodeImpl( tree.m_root, 1 ).first;
+}
+
+TEST_DEF( cachedNodesAreValid )
+{
+    const Node<T, Augmentation>* leftmost = tree.m_root;
+    while ( leftmost != nullptr && leftmost->left != nullptr )
+    {
+        leftmost = leftmost->left;
+    }
+
+    const Node<T, Augmentation>* rightmost = tree.m_root;
+    while ( rightmost != nullptr && rightmost->right != nullptr )
+    {
+        rightmost = rightmost->right;
+    }
+
+    return tree.m_leftmost == leftmost && tree.m_rightmost == rightmost;
+}
+
+template<typename Augmentation, typename NodeType>
+std::pair<bool, typename Augmentation::value_type> aggregatesAreValidImpl( const NodeType* node )
+{
+    if ( node == nullptr )
+    {
+        return { true, Augmentation::identity() };
+    }
+
+    const auto [leftValid, left] = aggregatesAreValidImpl<Augmentation>( node->left );
+    const auto [rightValid, right] = aggregatesAreValidImpl<Augmentation>( node->right );
+    const auto aggregate = Augmentation::combine( Augmentation::combine( left, Augmentation::make( node->value ) ), right );
+
+    return { leftValid && rightValid && node->aggregate == aggregate, aggregate };
+}
+
+TEST_DEF( aggregatesAreValid )
+{
+    if constexpr ( std::is_same_v<Augmentation, NoAugmentation> )
+    {
+        return true;
+    }
+    else
+    {
+        return aggregatesAreValidImpl<Augmentation>( tree.m_root ).first;
+    }
 }
 
 
@@ -177,6 +234,8 @@ TEST_DEF( isRedBlackTree )
 {
     return
         allPointersAreValid( tree ) &&
+        cachedNodesAreValid( tree ) &&
+        aggregatesAreValid( tree ) &&
         isBinarySearchTree( tree ) &&
         rootIsBlack( tree ) &&
         bothChildrenOfRedAreBlack( tree ) &&
@@ -214,6 +273,65 @@ TEST_DEF( findIsCorrect )
     return true;
 }
 
+TEST_DEF( findManyIsCorrect )
+{
+    //stored values interleaved with absent ones, in shuffled order and more than one batch
+    std::vector<T> keys;
+    for ( auto it = tree.cbegin(); it != tree.cend(); it = std::next( it ) )
+    {
+        keys.push_back( *it );
+        keys.push_back( *it + 1 );
+    }
+    std::shuffle( keys.begin(), keys.end(), std::mt19937( 7 ) );
+
+    std::vector<typename RedBlackTree<T, Less, Allocator, Augmentation>::const_iterator> found;
+    tree.find_many( keys.cbegin(), keys.cend(), std::back_inserter( found ) );
+
+    return found.size() == keys.size() &&
+        std::equal( keys.cbegin(), keys.cend(), found.cbegin(), [&tree]( const T& key, const auto& it )
+        {
+            return it == tree.find( key );
+        } );
+}
+
+TEST_DEF( boundsAreCorrect )
+{
+    const std::set<T, Less> reference( tree.cbegin(), tree.cend() );
+    if ( reference.empty() )
+    {
+        return tree.lower_bound( T{} ) == tree.cend() && tree.upper_bound( T{} ) == tree.cend();
+    }
+
+    const auto toIterator = [&tree, &reference]( auto it )
+    {
+        return it == reference.cend() ? tree.cend() : tree.find( *it );
+    };
+
+    //every stored value and every gap between neighbours is probed
+    const auto [minimum, maximum] = std::minmax( *reference.cbegin(), *reference.crbegin() );
+    for ( T value = minimum - 1; value <= maximum + 1; ++value )
+    {
+        const auto [first, last] = tree.equal_range( value );
+        if ( tree.lower_bound( value ) != toIterator( reference.lower_bound( value ) ) ||
+            tree.upper_bound( value ) != toIterator( reference.upper_bound( value ) ) ||
+            first != tree.lower_bound( value ) || last != tree.upper_bound( value ) ||
+            tree.count( value ) != reference.count( value ) ||
+            tree.contains( value ) != ( reference.count( value ) == 1 ) )
+        {
+            return false;
+        }
+
+        const auto high = tree.m_less( value, value + 10 ) ? value + 10 : value - 10;
+        const auto range = tree.range( value, high );
+        if ( !std::equal( range.begin(), range.end(), reference.lower_bound( value ), reference.lower_bound( high ) ) )
+        {
+            return false;
+        }
+    }
+
+    return tree.range( *reference.crbegin(), *reference.cbegin() ).empty();
+}
+
 TEST_DEF( eraseIsValid )
 {
     std::vector<T> values( tree.cbegin(), tree.cend() );
@@ -223,7 +341,7 @@ TEST_DEF( eraseIsValid )
 
     std::shuffle( values.begin(), values.end(), generator );
 
-    RedBlackTree<T, Less> copyTree( tree );
+    RedBlackTree<T, Less, Allocator, Augmentation> copyTree( tree );
     std::size_t size = copyTree.size();
 
     for ( int value : values )
@@ -239,4 +357,26 @@ TEST_DEF( eraseIsValid )
     return true;
 }
 
-#undef TEST_DEF
\ No newline at end of file
+#undef TEST_DEF
+
+template<typename T, typename Less, typename Allocator>
+inline bool RedBlackTreeTest::isRedBlackTree( const PersistentRedBlackTree<T, Less, Allocator>& tree )
+{
+    return
+        isBinarySearchTreeImpl( tree.m_root, tree.m_less ) &&
+        ( tree.m_root == nullptr || tree.m_root->color() == Color::Black ) &&
+        bothChildrenOfRedAreBlackImpl( tree.m_root ) &&
+        blackLengthIsCorrectForEveryNodeImpl( tree.m_root, 1 ).first &&
+        static_cast<std::size_t>( std::distance( tree.begin(), tree.end() ) ) == tree.size();
+}
+
+template<typename T, typename Less, typename Allocator>
+inline bool RedBlackTreeTest::isRedBlackTree( const ConcurrentRedBlackTree<T, Less, Allocator>& tree )
+{
+    const auto root = tree.m_head.right;
+    return
+        isBinarySearchTreeImpl( root, tree.m_less ) &&
+        ( root == nullptr || root->color() == Color::Black ) &&
+        bothChildrenOfRedAreBlackImpl( root ) &&
+        blackLengthIsCorrectForEveryNodeImpl( root, 1 ).first;
+}
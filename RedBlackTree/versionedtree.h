@@ -0,0 +1,214 @@
+#pragma once
+
+#include <array>
+#include "persistenttree.h"
+
+//Sorted set for one writer and any number of lock-free readers (multiversion concurrency control).
+//The writer changes a PersistentRedBlackTree, which copies only the paths shared with published versions,
+//and publishes the result as a new immutable version through an atomic pointer.
+//snapshot() returns a consistent version: an O(1) copy which later writes never change.
+//
+//A reader announces the version it is about to copy in a hazard slot, so the writer does not free it in between.
+//Replaced versions are freed on the next publish once no slot holds them; their nodes live on
+//as long as a snapshot shares them and are freed by the last one, so the allocator must be thread safe.
+//
+//insert, erase, clear and update must be called from one thread at a time, snapshot from any thread.
+template<typename T, typename Less = std::less<T>, typename Allocator = std::allocator<T>>
+class VersionedRedBlackTree
+{
+public:
+    using value_type = T;
+    using allocator_type = Allocator;
+    using size_type = std::size_t;
+    using snapshot_type = PersistentRedBlackTree<T, Less, Allocator>;
+
+public:
+    VersionedRedBlackTree();
+    explicit VersionedRedBlackTree( const Allocator& allocator );
+    ~VersionedRedBlackTree();
+
+    VersionedRedBlackTree( const VersionedRedBlackTree& ) = delete;
+    VersionedRedBlackTree& operator=( const VersionedRedBlackTree& ) = delete;
+
+    //Writer side; every call publishes a new version
+    bool insert( const T& value );
+    bool insert( T&& value );
+    bool erase( const T& value );
+    void clear();
+
+    //Applies mutate( tree ) to the writer's tree and publishes the result once, for batches of changes
+    template<typename Mutation>
+    void update( Mutation mutate );
+
+    //Reader side
+    snapshot_type snapshot() const;
+
+private:
+    void publish_();
+    void reclaim_();
+
+private:
+    //readers spread over this many slots; a slot is held only while one root reference is taken
+    static constexpr std::size_t hazardSlots = 64;
+
+    struct alignas( 64 ) HazardSlot
+    {
+        std::atomic<bool> busy{ false };
+        std::atomic<const snapshot_type*> version{ nullptr };
+    };
+
+    snapshot_type m_writer;
+    std::atomic<const snapshot_type*> m_published;
+    std::vector<const snapshot_type*> m_retired;
+    mutable std::array<HazardSlot, hazardSlots> m_hazards;
+};
+
+
+template<typename T, typename Less, typename Allocator>
+inline VersionedRedBlackTree<T, Less, Allocator>::VersionedRedBlackTree()
+    : VersionedRedBlackTree( Allocator() )
+{
+}
+
+template<typename T, typename Less, typename Allocator>
+inline VersionedRedBlackTree<T, Less, Allocator>::VersionedRedBlackTree( const Allocator& allocator )
+    : m_writer( allocator )
+    , m_published( new snapshot_type( m_writer ) )
+    , m_retired()
+    , m_hazards()
+{
+}
+
+template<typename T, typename Less, typename Allocator>
+inline VersionedRedBlackTree<T, Less, Allocator>::~VersionedRedBlackTree()
+{
+    //no reader may still be inside snapshot()
+    delete m_published.load();
+    for ( auto version : m_retired )
+    {
+        delete version;
+    }
+}
+
+template<typename T, typename Less, typename Allocator>
+inline bool VersionedRedBlackTree<T, Less, Allocator>::insert( const T& value )
+{
+    const auto size = m_writer.size();
+    m_writer.insert( value );
+    if ( m_writer.size() == size )
+    {
+        return false;
+    }
+
+    publish_();
+    return true;
+}
+
+template<typename T, typename Less, typename Allocator>
+inline bool VersionedRedBlackTree<T, Less, Allocator>::insert( T&& value )
+{
+    const auto size = m_writer.size();
+    m_writer.insert( std::move( value ) );
+    if ( m_writer.size() == size )
+    {
+        return false;
+    }
+
+    publish_();
+    return true;
+}
+
+template<typename T, typename Less, typename Allocator>
+inline bool VersionedRedBlackTree<T, Less, Allocator>::erase( const T& value )
+{
+    const auto size = m_writer.size();
+    m_writer.erase( value );
+    if ( m_writer.size() == size )
+    {
+        return false;
+    }
+
+    publish_();
+    return true;
+}
+
+template<typename T, typename Less, typename Allocator>
+inline void VersionedRedBlackTree<T, Less, Allocator>::clear()
+{
+    m_writer.clear();
+    publish_();
+}
+
+template<typename T, typename Less, typename Allocator>
+template<typename Mutation>
+inline void VersionedRedBlackTree<T, Less, Allocator>::update( Mutation mutate )
+{
+    mutate( m_writer );
+    publish_();
+}
+
+template<typename T, typename Less, typename Allocator>
+inline typename VersionedRedBlackTree<T, Less, Allocator>::snapshot_type VersionedRedBlackTree<T, Less, Allocator>::snapshot() const
+{
+    //any free slot will do, they are held for a few instructions
+    HazardSlot* slot = nullptr;
+    for ( std::size_t i = 0; slot == nullptr; i = ( i + 1 ) % hazardSlots )
+    {
+        if ( !m_hazards[i].busy.load( std::memory_order_relaxed ) && !m_hazards[i].busy.exchange( true, std::memory_order_acquire ) )
+        {
+            slot = &m_hazards[i];
+        }
+    }
+
+    //the announcement must be visible before the version is read again, hence the sequentially consistent accesses
+    const snapshot_type* version = m_published.load();
+    while ( true )
+    {
+        slot->version.store( version );
+        const auto current = m_published.load();
+        if ( current == version )
+        {
+            break;
+        }
+        version = current;
+    }
+
+    snapshot_type copy( *version );
+
+    slot->version.store( nullptr, std::memory_order_release );
+    slot->busy.store( false, std::memory_order_release );
+
+    return copy;
+}
+
+template<typename T, typename Less, typename Allocator>
+inline void VersionedRedBlackTree<T, Less, Allocator>::publish_()
+{
+    //the published copy shares every node, so the next write copies its path instead of changing it
+    const auto previous = m_published.exchange( new snapshot_type( m_writer ) );
+    m_retired.push_back( previous );
+    reclaim_();
+}
+
+template<typename T, typename Less, typename Allocator>
+inline void VersionedRedBlackTree<T, Less, Allocator>::reclaim_()
+{
+    std::vector<const snapshot_type*> protectedVersions;
+    for ( const auto& slot : m_hazards )
+    {
+        if ( const auto version = slot.version.load() )
+        {
+            protectedVersions.push_back( version );
+        }
+    }
+
+    const auto kept = std::partition( m_retired.begin(), m_retired.end(), [&protectedVersions]( const snapshot_type* version )
+    {
+        return std::find( protectedVersions.begin(), protectedVersions.end(), version ) != protectedVersions.end();
+    } );
+    for ( auto it = kept; it != m_retired.end(); ++it )
+    {
+        delete *it;
+    }
+    m_retired.erase( kept, m_retired.end() );
+}
@@ -1,7 +1,32 @@
+#include <filesystem>
 #include <redblacktree.h>
+#include <poolallocator.h>
+#include <intervaltree.h>
+#include <packedtree.h>
+#include <persistenttree.h>
+#include <versionedtree.h>
+#include <concurrentmap.h>
+#include <concurrenttree.h>
 #include <redblacktreetest.h>
 #include <maptest.h>
 
+#if defined( __has_feature )
+#if __has_feature( thread_sanitizer )
+#define TESTS_THREAD_SANITIZER
+#endif
+#elif defined( __SANITIZE_THREAD__ )
+#define TESTS_THREAD_SANITIZER
+#endif
+
+#ifdef TESTS_THREAD_SANITIZER
+//Hand-over-hand locking across rotations reverses the order in which node locks were first taken
+//(see ConcurrentRedBlackTree), which ThreadSanitizer's lock-order check cannot tell from a deadlock
+extern "C" const char* __tsan_default_suppressions()
+{
+    return "deadlock:ConcurrentRedBlackTree\n";
+}
+#endif
+
 namespace
 {
 template<typename T>
@@ -93,6 +118,180 @@ TEST( RedBlackTreeTest, Empty )
     EXPECT_TRUE( RedBlackTreeTest::isEmpty( RedBlackTree<RedBlackTree<RedBlackTree<int>>>{} ) );
 }
 
+TEST( RedBlackTreeTest, Serialize )
+{
+    EXPECT_EQ( RedBlackTree<int>().serialize(), "Null" );
+
+    const RedBlackTree<int> small{ 2, 1, 3 };
+    EXPECT_EQ( small.serialize( true ),
+        R"({"value":2,"color":"black",)"
+        R"("left":{"value":1,"color":"red","left":null,"right":null},)"
+        R"("right":{"value":3,"color":"red","left":null,"right":null}})" );
+
+    const RedBlackTree<std::string> words{ "b", "a" };
+    EXPECT_EQ( words.serialize( true ),
+        R"({"value":"b","color":"black","left":{"value":"a","color":"red","left":null,"right":null},"right":null})" );
+
+    RedBlackTree<int> tree;
+    for ( int i = 0; i < 100000; ++i )
+    {
+        tree.insert( ( i * 7919 ) % 100003 );
+    }
+
+    for ( const bool compact : { true, false } )
+    {
+        std::ostringstream stream;
+        tree.serialize( stream, compact );
+        EXPECT_EQ( stream.str(), tree.serialize( compact ) );
+    }
+    const auto json = tree.serialize( true );
+    EXPECT_EQ( std::count( json.begin(), json.end(), '{' ), tree.size() );
+}
+
+TEST( RedBlackTreeTest, Deserialize )
+{
+    EXPECT_TRUE( RedBlackTree<int>::deserialize( "Null" ).size() == 0 );
+    EXPECT_TRUE( RedBlackTree<int>::deserialize( " null " ).size() == 0 );
+
+    RedBlackTree<int> tree;
+    for ( int i = 0; i < 10000; ++i )
+    {
+        tree.insert( ( i * 7919 ) % 10007 );
+    }
+    for ( int i = 0; i < 10000; i += 3 )
+    {
+        tree.erase( i );
+    }
+
+    //the exact shape and colors come back
+    const auto json = tree.serialize();
+    const auto copy = RedBlackTree<int>::deserialize( json );
+    EXPECT_TRUE( RedBlackTreeTest::isRedBlackTree( copy ) );
+    EXPECT_EQ( copy.size(), tree.size() );
+    EXPECT_EQ( copy.serialize(), json );
+    EXPECT_EQ( *copy.begin(), *tree.begin() );
+    EXPECT_EQ( *copy.rbegin(), *tree.rbegin() );
+
+    std::istringstream stream( tree.serialize( true ) );
+    const auto streamed = RedBlackTree<int, std::less<int>, std::allocator<int>, SubtreeSize>::deserialize( stream );
+    EXPECT_TRUE( RedBlackTreeTest::isRedBlackTree( streamed ) );
+    EXPECT_EQ( *streamed.nth( 100 ), *std::next( tree.begin(), 100 ) );
+
+    const RedBlackTree<std::string> words{ "pear", "apple", "fig", "kiwi" };
+    EXPECT_EQ( RedBlackTree<std::string>::deserialize( words.serialize() ).serialize(), words.serialize() );
+
+    PoolAllocator<int> allocator( 64 );
+    const auto leaf = []( int value, const char* color )
+    {
+        return R"({"value":)" + std::to_string( value ) + R"(,"color":")" + color + R"(","left":null,"right":null})";
+    };
+    const auto node = []( int value, const char* color, const std::string& left, const std::string& right )
+    {
+        return R"({"value":)" + std::to_string( value ) + R"(,"color":")" + color + R"(","left":)" + left + R"(,"right":)" + right + "}";
+    };
+
+    const std::vector<std::string> invalid{
+        node( 2, "red", leaf( 1, "black" ), leaf( 3, "black" ) ),                   //red root
+        node( 2, "black", leaf( 3, "red" ), leaf( 1, "red" ) ),                     //out of order
+        node( 2, "black", leaf( 2, "red" ), "null" ),                               //duplicate key
+        node( 2, "black", leaf( 1, "black" ), "null" ),                             //black heights
+        node( 3, "black", node( 2, "red", leaf( 1, "red" ), "null" ), leaf( 4, "red" ) ), //red child of red
+        node( 2, "black", leaf( 1, "green" ), "null" ),
+        node( 2, "black", leaf( 1, "red" ), leaf( 3, "red" ) ) + "x",
+        R"({"value":2,"color":"black","left":null})" + std::string( 1, ',' ),
+        R"({"value":2.5,"color":"black","left":null,"right":null})",
+        R"({"value":2,"color":"black","left":[],"right":null})",
+        R"({"value":2,"color":"black","left":null,"right":null,"size":1})",
+        R"({"value":2,"value":3,"color":"black","left":null,"right":null})",
+        R"({"color":"black","left":null,"right":null})",
+        R"({"value":4294967296,"color":"black","left":null,"right":null})",
+        "[1,2]",
+        "" };
+    for ( const auto& json : invalid )
+    {
+        EXPECT_THROW( ( RedBlackTree<int, std::less<int>, PoolAllocator<int>>::deserialize( json, allocator ) ), std::invalid_argument ) << json;
+        EXPECT_EQ( allocator.allocated(), 0 );
+    }
+
+    const auto valid = RedBlackTree<int, std::less<int>, PoolAllocator<int>>::deserialize(
+        node( 2, "black", leaf( 1, "red" ), leaf( 3, "red" ) ), allocator );
+    EXPECT_EQ( valid.size(), 3 );
+    EXPECT_EQ( allocator.allocated(), 3 );
+}
+
+namespace
+{
+std::atomic<std::size_t> countedAllocations{ 0 };
+
+//std::allocator counting the allocations of every rebound copy
+template<typename T>
+struct CountingAllocator : std::allocator<T>
+{
+    using value_type = T;
+
+    template<typename U>
+    struct rebind
+    {
+        using other = CountingAllocator<U>;
+    };
+
+    CountingAllocator() = default;
+
+    template<typename U>
+    CountingAllocator( const CountingAllocator<U>& )
+    {
+    }
+
+    T* allocate( std::size_t n )
+    {
+        ++countedAllocations;
+        return std::allocator<T>::allocate( n );
+    }
+};
+}
+
+TEST( RedBlackTreeTest, ParallelCopy )
+{
+    std::vector<int> values( 1 << 17 );
+    std::iota( values.begin(), values.end(), 0 );
+
+    PoolAllocator<int> allocator( 1024 );
+    const auto tree = RedBlackTree<int, std::less<int>, PoolAllocator<int>, SubtreeSize>::from_sorted( values.begin(), values.end(), allocator );
+
+    for ( const std::size_t threads : { 1, 4 } )
+    {
+        const decltype( tree ) copy( tree, threads );
+        EXPECT_TRUE( RedBlackTreeTest::isRedBlackTree( copy ) );
+        EXPECT_EQ( copy.serialize( true ), tree.serialize( true ) );
+        EXPECT_EQ( *copy.nth( 12345 ), 12345 );
+        //nodes claimed but not used by the threads are returned
+        EXPECT_EQ( copy.get_allocator().allocated(), values.size() );
+    }
+
+    const RedBlackTree<int> empty;
+    const RedBlackTree<int> emptyCopy( empty, 4 );
+    EXPECT_TRUE( RedBlackTreeTest::isEmpty( emptyCopy ) );
+
+    //a tree just big enough to fork is not copied with a spare batch for each of many threads
+    values.resize( 20000 );
+    const auto small = RedBlackTree<int, std::less<int>, CountingAllocator<int>>::from_sorted( values.begin(), values.end() );
+    countedAllocations = 0;
+    const decltype( small ) smallCopy( small, 64 );
+    EXPECT_TRUE( RedBlackTreeTest::isRedBlackTree( smallCopy ) );
+    EXPECT_EQ( smallCopy.size(), values.size() );
+    EXPECT_LE( countedAllocations.load(), values.size() + 4 * 1024 );
+}
+
+
+TEST( RedBlackTreeTest, NodeFootprint )
+{
+    //the color lives in the parent link, so a node is its value plus three pointers
+    static_assert( sizeof( void* ) != 8 || sizeof( Node<int> ) == 32 );
+    static_assert( sizeof( void* ) != 8 || sizeof( Node<double> ) == 32 );
+    EXPECT_EQ( sizeof( Node<std::int64_t> ), sizeof( std::int64_t ) + 3 * sizeof( void* ) );
+    EXPECT_EQ( sizeof( Node<int, SubtreeSize> ), sizeof( Node<double> ) + sizeof( std::size_t ) );
+}
+
 TEST( RedBlackTreeTest, RedBlackTree )
 {
     std::ofstream log( "log.txt" );
@@ -123,9 +322,29 @@ TEST( RedBlackTreeTest, Iterators )
     EXPECT_TRUE( RedBlackTreeTest::iteratorsAreValid( tree ) );
     EXPECT_TRUE( RedBlackTreeTest::reverseIteratorsAreValid( tree ) );
     EXPECT_TRUE( RedBlackTreeTest::findIsCorrect( tree ) );
+    EXPECT_TRUE( RedBlackTreeTest::findManyIsCorrect( tree ) );
+    EXPECT_TRUE( RedBlackTreeTest::findManyIsCorrect( RedBlackTree<int>() ) );
     EXPECT_EQ( tree.find( -1 ), tree.cend() );
 }
 
+TEST( RedBlackTreeTest, Bounds )
+{
+    std::vector<int> values( 1000 );
+    for ( int i = 0; i < static_cast<int>( values.size() ); ++i )
+    {
+        values[i] = 3 * i;
+    }
+
+    std::random_device device;
+    std::mt19937 generator( device() );
+    std::shuffle( values.begin(), values.end(), generator );
+
+    const RedBlackTree<int> tree( std::cbegin( values ), std::cend( values ) );
+    EXPECT_TRUE( RedBlackTreeTest::boundsAreCorrect( tree ) );
+    EXPECT_TRUE( RedBlackTreeTest::boundsAreCorrect( RedBlackTree<int>{} ) );
+    EXPECT_TRUE( RedBlackTreeTest::boundsAreCorrect( RedBlackTree<int, std::greater<int>>( std::cbegin( values ), std::cend( values ) ) ) );
+}
+
 TEST( RedBlackTreeTest, Erase )
 {
     std::ofstream log( "log.txt" );
@@ -138,6 +357,782 @@ TEST( RedBlackTreeTest, Erase )
     EXPECT_TRUE( RedBlackTreeTest::eraseIsValid( tree ) );
 }
 
+TEST( RedBlackTreeTest, PoolAllocator )
+{
+    const std::size_t N = 1000;
+    const Generator<int> generate( N );
+
+    PoolAllocator<int> allocator( 64 );
+    RedBlackTree<int, std::less<int>, PoolAllocator<int>> tree( std::cbegin( generate.m_numbers ), std::cend( generate.m_numbers ), allocator );
+
+    EXPECT_EQ( tree.size(), N );
+    EXPECT_EQ( allocator.allocated(), N );
+    EXPECT_TRUE( RedBlackTreeTest::isRedBlackTree( tree ) );
+    EXPECT_TRUE( RedBlackTreeTest::copyConstructorIsValid( tree ) );
+    EXPECT_TRUE( RedBlackTreeTest::moveAssignmentIsValid( tree ) );
+    EXPECT_TRUE( RedBlackTreeTest::eraseIsValid( tree ) );
+
+    for ( int i = 0; i < static_cast<int>( N ); i += 2 )
+    {
+        tree.erase( i );
+    }
+    EXPECT_EQ( allocator.allocated(), N / 2 );
+
+    for ( int i = 0; i < static_cast<int>( N ); i += 2 )
+    {
+        tree.insert( i );
+    }
+    EXPECT_EQ( allocator.allocated(), N );
+    EXPECT_TRUE( RedBlackTreeTest::isRedBlackTree( tree ) );
+
+    tree.clear();
+    EXPECT_EQ( allocator.allocated(), 0 );
+    EXPECT_TRUE( RedBlackTreeTest::isEmpty( tree ) );
+
+    //the block size claimed by another type first: nodes come from operator new, and the foreign block counted
+    //by the pool must survive clear even when the counts match
+    PoolAllocator<double> shared( 64 );
+    double* foreign = shared.allocate( 1 );
+    RedBlackTree<int, std::less<int>, PoolAllocator<int>> unpooled( { 1 }, PoolAllocator<int>( shared ) );
+    EXPECT_EQ( shared.allocated(), 1 );
+    unpooled.clear();
+    EXPECT_EQ( shared.allocated(), 1 );
+    *foreign = 1.0;
+    shared.deallocate( foreign, 1 );
+}
+
+TEST( RedBlackTreeTest, MoveOnlyValues )
+{
+    struct PointeeLess
+    {
+        bool operator()( const std::unique_ptr<int>& left, const std::unique_ptr<int>& right ) const
+        {
+            return *left < *right;
+        }
+    };
+
+    const std::size_t N = 1000;
+    const Generator<int> generate( N );
+
+    RedBlackTree<std::unique_ptr<int>, PointeeLess> tree;
+    for ( int number : generate.m_numbers )
+    {
+        if ( number % 2 == 0 )
+        {
+            tree.insert( std::make_unique<int>( number ) );
+        }
+        else
+        {
+            tree.emplace( new int( number ) );
+        }
+    }
+
+    EXPECT_EQ( tree.size(), N );
+    EXPECT_EQ( tree.insert( std::make_unique<int>( 0 ) ), tree.cend() );
+    EXPECT_EQ( tree.emplace( new int( 1 ) ), tree.cend() );
+    EXPECT_TRUE( RedBlackTreeTest::isRedBlackTree( tree ) );
+
+    auto it = tree.cbegin();
+    for ( int i = 0; i < static_cast<int>( N ); ++i )
+    {
+        EXPECT_EQ( **it, i );
+        it = tree.erase( it );
+    }
+
+    EXPECT_EQ( it, tree.cend() );
+    EXPECT_TRUE( RedBlackTreeTest::isEmpty( tree ) );
+}
+
+TEST( RedBlackTreeTest, FromSorted )
+{
+    for ( int N = 0; N < 300; ++N )
+    {
+        std::vector<int> values;
+        for ( int i = 0; i < N; ++i )
+        {
+            values.push_back( i / 2 );
+        }
+
+        const auto tree = RedBlackTree<int>::from_sorted( std::cbegin( values ), std::cend( values ) );
+        values.erase( std::unique( values.begin(), values.end() ), values.end() );
+
+        EXPECT_EQ( tree.size(), values.size() );
+        EXPECT_TRUE( RedBlackTreeTest::isRedBlackTree( tree ) );
+        EXPECT_TRUE( std::equal( tree.cbegin(), tree.cend(), values.cbegin(), values.cend() ) );
+    }
+
+    const std::set<int> sorted{ 1, 3, 5, 7, 9, 11, 13 };
+    const RedBlackTree<int, std::less<int>, PoolAllocator<int>> tree( std::cbegin( sorted ), std::cend( sorted ) );
+    EXPECT_TRUE( RedBlackTreeTest::isRedBlackTree( tree ) );
+    EXPECT_TRUE( std::equal( tree.cbegin(), tree.cend(), sorted.cbegin(), sorted.cend() ) );
+
+    const std::map<std::string, int> ordered{ { "a", 1 }, { "b", 2 }, { "c", 3 } };
+    const Map<std::string, int> map( std::cbegin( ordered ), std::cend( ordered ) );
+    EXPECT_TRUE( std::equal( map.cbegin(), map.cend(), ordered.cbegin(), ordered.cend() ) );
+}
+
+TEST( RedBlackTreeTest, FromUnsorted )
+{
+    const std::size_t N = 100000;
+    const Generator<int> generate( N );
+
+    std::vector<int> values( generate.m_numbers );
+    values.insert( values.end(), generate.m_numbers.cbegin(), generate.m_numbers.cbegin() + N / 2 );
+
+    const auto tree = RedBlackTree<int>::from_unsorted( std::cbegin( values ), std::cend( values ), 4 );
+
+    EXPECT_EQ( tree.size(), N );
+    EXPECT_TRUE( RedBlackTreeTest::isRedBlackTree( tree ) );
+    EXPECT_TRUE( RedBlackTreeTest::iteratorsAreValid( tree ) );
+    EXPECT_EQ( *tree.cbegin(), 0 );
+    EXPECT_EQ( *tree.crbegin(), static_cast<int>( N ) - 1 );
+
+    const std::vector<std::pair<const std::string, int>> pairs{ { "b", 1 }, { "a", 2 }, { "b", 3 } };
+    const auto map = RedBlackTree<std::pair<const std::string, int>, PairComparer<std::string, int, std::less<>>>::from_unsorted(
+        std::cbegin( pairs ), std::cend( pairs ) );
+    const std::vector<std::pair<const std::string, int>> ref{ { "a", 2 }, { "b", 1 } };
+    EXPECT_TRUE( std::equal( map.cbegin(), map.cend(), ref.cbegin(), ref.cend() ) );
+}
+
+TEST( RedBlackTreeTest, HintedInsert )
+{
+    const int N = 1000;
+
+    RedBlackTree<int> ascending;
+    for ( int i = 0; i < N; ++i )
+    {
+        EXPECT_EQ( *ascending.append_max( i ), i );
+    }
+    EXPECT_EQ( ascending.append_max( N / 2 ), ascending.cend() );
+    EXPECT_TRUE( RedBlackTreeTest::isRedBlackTree( ascending ) );
+
+    RedBlackTree<int> descending;
+    for ( int i = N - 1; i >= 0; --i )
+    {
+        descending.insert( descending.cbegin(), i );
+    }
+    EXPECT_TRUE( RedBlackTreeTest::isRedBlackTree( descending ) );
+    EXPECT_TRUE( std::equal( ascending.cbegin(), ascending.cend(), descending.cbegin(), descending.cend() ) );
+
+    //every odd number is inserted before its even successor, wrong hints fall back to a full descent
+    RedBlackTree<int> tree;
+    for ( int i = 0; i < N; i += 2 )
+    {
+        tree.append_max( i );
+    }
+    for ( int i = 1; i < N; i += 2 )
+    {
+        const auto hint = i % 3 == 0 ? tree.cbegin() : tree.find( i + 1 );
+        EXPECT_EQ( *tree.emplace_hint( hint, i ), i );
+        EXPECT_TRUE( RedBlackTreeTest::cachedNodesAreValid( tree ) );
+    }
+    EXPECT_EQ( tree.insert( tree.find( 10 ), 10 ), tree.cend() );
+
+    EXPECT_EQ( tree.size(), static_cast<std::size_t>( N ) );
+    EXPECT_TRUE( RedBlackTreeTest::isRedBlackTree( tree ) );
+    EXPECT_TRUE( std::equal( tree.cbegin(), tree.cend(), ascending.cbegin(), ascending.cend() ) );
+    EXPECT_TRUE( RedBlackTreeTest::eraseIsValid( tree ) );
+}
+
+TEST( RedBlackTreeTest, FrontAndBack )
+{
+    const std::size_t N = 1000;
+    const Generator<int> generate( N );
+
+    RedBlackTree<int> queue;
+    EXPECT_THROW( queue.front(), std::out_of_range );
+    EXPECT_THROW( queue.back(), std::out_of_range );
+    queue.pop_front();
+    queue.pop_back();
+
+    const auto end = queue.cend();
+    for ( int number : generate.m_numbers )
+    {
+        queue.insert( number );
+        EXPECT_TRUE( RedBlackTreeTest::cachedNodesAreValid( queue ) );
+    }
+    //iterators refer to the tree, not to its current root
+    EXPECT_EQ( end, queue.cend() );
+    EXPECT_EQ( &*queue.cbegin(), &queue.front() );
+    EXPECT_EQ( *std::prev( queue.cend() ), static_cast<int>( N ) - 1 );
+    EXPECT_EQ( *queue.crbegin(), queue.back() );
+
+    int low = 0;
+    int high = static_cast<int>( N ) - 1;
+    while ( queue.size() != 0 )
+    {
+        EXPECT_EQ( queue.front(), low );
+        EXPECT_EQ( queue.back(), high );
+        if ( ( low + high ) % 3 == 0 )
+        {
+            queue.pop_back();
+            --high;
+        }
+        else
+        {
+            queue.pop_front();
+            ++low;
+        }
+        EXPECT_TRUE( RedBlackTreeTest::cachedNodesAreValid( queue ) );
+    }
+    EXPECT_TRUE( RedBlackTreeTest::isEmpty( queue ) );
+}
+
+TEST( RedBlackTreeTest, OrderStatistics )
+{
+    using CountedTree = RedBlackTree<int, std::less<int>, std::allocator<int>, SubtreeSize>;
+
+    const std::size_t N = 1000;
+    const Generator<int> generate( N );
+
+    //sizes are kept through inserts and every erase case
+    CountedTree tree;
+    for ( int number : generate.m_numbers )
+    {
+        tree.insert( 2 * number );
+    }
+    for ( int i = 0; i < static_cast<int>( N ); i += 3 )
+    {
+        tree.erase( 2 * i );
+    }
+    EXPECT_TRUE( RedBlackTreeTest::isRedBlackTree( tree ) );
+
+    const std::vector<int> values( tree.cbegin(), tree.cend() );
+    for ( std::size_t k = 0; k < values.size(); ++k )
+    {
+        EXPECT_EQ( *tree.nth( k ), values[k] );
+    }
+    EXPECT_EQ( tree.nth( values.size() ), tree.cend() );
+
+    for ( int value = -1; value <= 2 * static_cast<int>( N ); ++value )
+    {
+        const auto rank = static_cast<std::size_t>( std::lower_bound( values.cbegin(), values.cend(), value ) - values.cbegin() );
+        EXPECT_EQ( tree.rank( value ), rank );
+        EXPECT_EQ( tree.count_between( value, value + 50 ), static_cast<std::size_t>( std::distance(
+            std::lower_bound( values.cbegin(), values.cend(), value ), std::lower_bound( values.cbegin(), values.cend(), value + 50 ) ) ) );
+    }
+    EXPECT_EQ( tree.count_between( 100, 10 ), 0 );
+
+    //bulk builds, copies and hinted inserts fill sizes too
+    const auto sorted = CountedTree::from_sorted( values.cbegin(), values.cend() );
+    const auto unsorted = CountedTree::from_unsorted( generate.m_numbers.cbegin(), generate.m_numbers.cend(), 4 );
+    CountedTree appended;
+    for ( int value : values )
+    {
+        appended.append_max( value );
+    }
+    EXPECT_TRUE( RedBlackTreeTest::isRedBlackTree( sorted ) );
+    EXPECT_TRUE( RedBlackTreeTest::isRedBlackTree( unsorted ) );
+    EXPECT_TRUE( RedBlackTreeTest::isRedBlackTree( appended ) );
+    EXPECT_TRUE( RedBlackTreeTest::copyConstructorIsValid( sorted ) );
+    EXPECT_EQ( *unsorted.nth( N / 2 ), static_cast<int>( N / 2 ) );
+    EXPECT_TRUE( RedBlackTreeTest::eraseIsValid( appended ) );
+}
+
+TEST( RedBlackTreeTest, Reduce )
+{
+    //concatenation is associative but not commutative, so the order of combined parts is checked too
+    struct Elements
+    {
+        using value_type = std::vector<int>;
+
+        static value_type make( int value )
+        {
+            return { value };
+        }
+
+        static value_type combine( value_type left, const value_type& right )
+        {
+            left.insert( left.end(), right.cbegin(), right.cend() );
+            return left;
+        }
+
+        static value_type identity()
+        {
+            return {};
+        }
+    };
+
+    const std::size_t N = 300;
+    const Generator<int> generate( N );
+
+    RedBlackTree<int, std::less<int>, std::allocator<int>, Elements> tree( generate.m_numbers.cbegin(), generate.m_numbers.cend() );
+    for ( int i = 0; i < static_cast<int>( N ); i += 4 )
+    {
+        tree.erase( i );
+    }
+    EXPECT_TRUE( RedBlackTreeTest::isRedBlackTree( tree ) );
+
+    const std::vector<int> values( tree.cbegin(), tree.cend() );
+    for ( int low = -1; low <= static_cast<int>( N ); low += 3 )
+    {
+        for ( int high = low; high <= static_cast<int>( N ) + 1; high += 7 )
+        {
+            const std::vector<int> expected( std::lower_bound( values.cbegin(), values.cend(), low ),
+                std::lower_bound( values.cbegin(), values.cend(), high ) );
+            EXPECT_EQ( tree.reduce( low, high ), expected );
+        }
+    }
+    EXPECT_TRUE( tree.reduce( 10, 5 ).empty() );
+    EXPECT_TRUE( RedBlackTreeTest::eraseIsValid( tree ) );
+}
+
+TEST( RedBlackTreeTest, SplitAndJoin )
+{
+    const std::size_t N = 1000;
+    const Generator<int> generate( N );
+    const RedBlackTree<int> tree( generate.m_numbers.cbegin(), generate.m_numbers.cend() );
+
+    for ( int key = -1; key <= static_cast<int>( N ); key += 37 )
+    {
+        RedBlackTree<int> lower( tree );
+        auto upper = lower.split( key );
+
+        const auto middle = std::max( 0, std::min( key, static_cast<int>( N ) ) );
+        EXPECT_EQ( lower.size(), static_cast<std::size_t>( middle ) );
+        EXPECT_EQ( upper.size(), N - middle );
+        EXPECT_TRUE( RedBlackTreeTest::isRedBlackTree( lower ) );
+        EXPECT_TRUE( RedBlackTreeTest::isRedBlackTree( upper ) );
+        EXPECT_TRUE( lower.size() == 0 || *lower.crbegin() == middle - 1 );
+        EXPECT_TRUE( upper.size() == 0 || *upper.cbegin() == middle );
+
+        const auto joined = RedBlackTree<int>::join( std::move( lower ), std::move( upper ) );
+        EXPECT_TRUE( RedBlackTreeTest::isRedBlackTree( joined ) );
+        EXPECT_TRUE( std::equal( joined.cbegin(), joined.cend(), tree.cbegin(), tree.cend() ) );
+        EXPECT_TRUE( RedBlackTreeTest::isEmpty( lower ) );
+        EXPECT_TRUE( RedBlackTreeTest::isEmpty( upper ) );
+    }
+
+    //parts of very different heights, subtree sizes and a shared pool
+    using CountedTree = RedBlackTree<int, std::less<int>, PoolAllocator<int>, SubtreeSize>;
+    CountedTree counted( generate.m_numbers.cbegin(), generate.m_numbers.cend() );
+    auto large = counted.split( 3 );
+    large.erase( 3 );
+    EXPECT_EQ( large.size(), N - 4 );
+    EXPECT_EQ( large.rank( 500 ), 496 );
+
+    const auto rejoined = CountedTree::join( std::move( counted ), 3, std::move( large ) );
+    EXPECT_EQ( rejoined.size(), N );
+    EXPECT_EQ( *rejoined.nth( 3 ), 3 );
+    EXPECT_TRUE( RedBlackTreeTest::isRedBlackTree( rejoined ) );
+    EXPECT_EQ( rejoined.get_allocator().allocated(), N );
+
+    const auto single = RedBlackTree<int>::join( RedBlackTree<int>{}, 5, RedBlackTree<int>{} );
+    EXPECT_EQ( single.size(), 1 );
+    EXPECT_TRUE( RedBlackTreeTest::isRedBlackTree( single ) );
+}
+
+TEST( RedBlackTreeTest, SetOperations )
+{
+    using CountedTree = RedBlackTree<int, std::less<int>, std::allocator<int>, SubtreeSize>;
+
+    std::mt19937 generator( std::random_device{}() );
+    for ( const auto& [N, threads] : { std::make_pair( 1000, 1 ), std::make_pair( 100000, 4 ) } )
+    {
+        std::uniform_int_distribution<int> value( 0, 2 * N );
+        std::vector<int> first;
+        std::vector<int> second;
+        for ( int i = 0; i < N; ++i )
+        {
+            first.push_back( value( generator ) );
+            second.push_back( value( generator ) / 3 );
+        }
+
+        const auto left = CountedTree::from_unsorted( first.cbegin(), first.cend() );
+        const auto right = CountedTree::from_unsorted( second.cbegin(), second.cend() );
+
+        const auto check = [&left, &right]( const CountedTree& tree, auto operation )
+        {
+            std::vector<int> expected;
+            operation( left.cbegin(), left.cend(), right.cbegin(), right.cend(), std::back_inserter( expected ) );
+            return RedBlackTreeTest::isRedBlackTree( tree ) && tree.size() == expected.size() &&
+                std::equal( tree.cbegin(), tree.cend(), expected.cbegin(), expected.cend() );
+        };
+
+        EXPECT_TRUE( check( CountedTree::set_union( CountedTree( left ), CountedTree( right ), threads ),
+            []( auto... args ) { return std::set_union( args... ); } ) );
+        EXPECT_TRUE( check( CountedTree::set_intersection( CountedTree( left ), CountedTree( right ), threads ),
+            []( auto... args ) { return std::set_intersection( args... ); } ) );
+        EXPECT_TRUE( check( CountedTree::set_difference( CountedTree( left ), CountedTree( right ), threads ),
+            []( auto... args ) { return std::set_difference( args... ); } ) );
+        EXPECT_TRUE( check( CountedTree::set_difference( CountedTree( left ), CountedTree{}, threads ),
+            []( auto first, auto last, auto, auto, auto out ) { return std::copy( first, last, out ); } ) );
+    }
+
+    PoolAllocator<int> allocator;
+    RedBlackTree<int, std::less<int>, PoolAllocator<int>> odd( allocator );
+    RedBlackTree<int, std::less<int>, PoolAllocator<int>> small( allocator );
+    for ( int i = 0; i < 100; ++i )
+    {
+        odd.insert( 2 * i + 1 );
+        small.insert( i );
+    }
+    const auto even = decltype( odd )::set_difference( std::move( small ), std::move( odd ) );
+    EXPECT_EQ( even.size(), 50 );
+    EXPECT_EQ( allocator.allocated(), 50 );
+    EXPECT_TRUE( RedBlackTreeTest::isEmpty( odd ) );
+}
+
+TEST( IntervalTreeTest, Overlaps )
+{
+    const int N = 2000;
+    std::mt19937 generator( std::random_device{}() );
+    std::uniform_int_distribution<int> start( 0, 1000 );
+    std::uniform_int_distribution<int> length( 1, 50 );
+
+    IntervalTree<int> tree;
+    std::set<std::pair<int, int>> reference;
+    for ( int i = 0; i < N; ++i )
+    {
+        const int low = start( generator );
+        const int high = low + length( generator );
+        tree.emplace( low, high );
+        reference.emplace( low, high );
+    }
+
+    //ends are maintained through erase fix-ups as well
+    for ( auto it = reference.begin(); it != reference.end(); )
+    {
+        if ( it->first % 3 == 0 )
+        {
+            tree.erase( Interval<int>( it->first, it->second ) );
+            it = reference.erase( it );
+        }
+        else
+        {
+            ++it;
+        }
+    }
+    EXPECT_EQ( tree.size(), reference.size() );
+    EXPECT_TRUE( RedBlackTreeTest::isRedBlackTree( tree ) );
+
+    for ( int low = -10; low < 1100; low += 7 )
+    {
+        const int high = low + length( generator );
+        std::vector<Interval<int>> overlapping;
+        std::vector<Interval<int>> containing;
+        for ( const auto& [first, last] : reference )
+        {
+            if ( first < high && low < last )
+            {
+                overlapping.emplace_back( first, last );
+            }
+            if ( first <= low && low < last )
+            {
+                containing.emplace_back( first, last );
+            }
+        }
+
+        EXPECT_EQ( tree.overlapping( low, high ), overlapping );
+        EXPECT_EQ( tree.containing( low ), containing );
+        EXPECT_EQ( tree.stabbing_count( low ), containing.size() );
+        EXPECT_TRUE( tree.overlapping( high, low ).empty() );
+    }
+
+    const IntervalTree<int> copy( tree );
+    EXPECT_TRUE( RedBlackTreeTest::isRedBlackTree( copy ) );
+    EXPECT_EQ( copy.overlapping( 0, 2000 ).size(), reference.size() );
+}
+
+TEST( PackedTreeTest, Relocatable )
+{
+    EXPECT_EQ( sizeof( PackedNode<int> ), 16 );
+
+    std::mt19937 generator( std::random_device{}() );
+    std::uniform_int_distribution<int> distribution( 0, 20000 );
+    RedBlackTree<int> tree;
+    for ( int i = 0; i < 5000; ++i )
+    {
+        tree.insert( 2 * distribution( generator ) );
+    }
+
+    const PackedTree<int> packed( tree );
+    ASSERT_EQ( packed.size(), tree.size() );
+    EXPECT_TRUE( std::equal( packed.begin(), packed.end(), tree.begin(), tree.end() ) );
+    EXPECT_TRUE( std::equal( packed.rbegin(), packed.rend(), tree.rbegin(), tree.rend() ) );
+
+    //the node block is searched in place after a plain byte copy
+    std::vector<PackedNode<int>> moved( packed.size() );
+    std::memcpy( moved.data(), packed.data(), packed.size() * sizeof( PackedNode<int> ) );
+    const auto view = PackedTree<int>::view( moved.data(), moved.size() );
+    const auto copy = view;
+    EXPECT_EQ( copy.data(), moved.data() );
+
+    for ( int value = -1; value < 40003; ++value )
+    {
+        EXPECT_EQ( view.contains( value ), tree.contains( value ) );
+        const auto lower = view.lower_bound( value );
+        const auto upper = view.upper_bound( value );
+        EXPECT_EQ( lower == view.end() ? -1 : *lower, tree.lower_bound( value ) == tree.end() ? -1 : *tree.lower_bound( value ) );
+        EXPECT_EQ( upper == view.end() ? -1 : *upper, tree.upper_bound( value ) == tree.end() ? -1 : *tree.upper_bound( value ) );
+    }
+
+    //back to a mutable tree
+    const RedBlackTree<int> thawed( sortedRange, view.begin(), view.end() );
+    EXPECT_TRUE( RedBlackTreeTest::isRedBlackTree( thawed ) );
+    EXPECT_TRUE( std::equal( thawed.begin(), thawed.end(), tree.begin(), tree.end() ) );
+
+    const PackedTree<int> empty;
+    EXPECT_TRUE( empty.empty() );
+    EXPECT_EQ( empty.begin(), empty.end() );
+    EXPECT_EQ( empty.find( 1 ), empty.end() );
+    EXPECT_THROW( *empty.begin(), std::out_of_range );
+}
+
+TEST( PackedTreeTest, SaveAndOpen )
+{
+    const auto path = ( std::filesystem::temp_directory_path() / "packedtreetest.bin" ).string();
+
+    RedBlackTree<int> tree;
+    for ( int i = 0; i < 10000; ++i )
+    {
+        tree.insert( ( i * 7919 ) % 10007 );
+    }
+    PackedTree<int>( tree ).save( path );
+
+    {
+        const auto mapped = PackedTree<int>::open_readonly( path, true );
+        ASSERT_EQ( mapped.size(), tree.size() );
+        EXPECT_TRUE( std::equal( mapped.begin(), mapped.end(), tree.begin(), tree.end() ) );
+        EXPECT_TRUE( mapped.contains( 7919 ) );
+        EXPECT_FALSE( mapped.contains( 10007 ) );
+
+        //copies share the mapping
+        PackedTree<int> copy;
+        copy = mapped;
+        EXPECT_EQ( copy.data(), mapped.data() );
+        EXPECT_EQ( *copy.lower_bound( -5 ), 0 );
+    }
+
+    EXPECT_THROW( PackedTree<double>::open_readonly( path ), std::runtime_error );
+
+    {
+        std::fstream file( path, std::ios::in | std::ios::out | std::ios::binary );
+        file.seekp( -3, std::ios::end );
+        file.put( 'x' );
+    }
+    EXPECT_NO_THROW( PackedTree<int>::open_readonly( path ) );
+    EXPECT_THROW( PackedTree<int>::open_readonly( path, true ), std::runtime_error );
+
+    std::filesystem::resize_file( path, std::filesystem::file_size( path ) - 1 );
+    EXPECT_THROW( PackedTree<int>::open_readonly( path ), std::runtime_error );
+
+    PackedTree<int>().save( path );
+    EXPECT_TRUE( PackedTree<int>::open_readonly( path, true ).empty() );
+    std::filesystem::remove( path );
+
+    EXPECT_THROW( PackedTree<int>::open_readonly( path ), std::runtime_error );
+}
+
+TEST( PersistentTreeTest, Snapshots )
+{
+    PoolAllocator<int> allocator( 1024 );
+    PersistentRedBlackTree<int, std::less<int>, PoolAllocator<int>> tree( allocator );
+    std::set<int> reference;
+
+    std::mt19937 generator( std::random_device{}() );
+    std::uniform_int_distribution<int> distribution( 0, 5000 );
+
+    std::vector<std::pair<decltype( tree ), std::set<int>>> snapshots;
+    for ( int i = 0; i < 20000; ++i )
+    {
+        const int value = distribution( generator );
+        if ( i % 3 == 0 )
+        {
+            tree.erase( value );
+            reference.erase( value );
+        }
+        else
+        {
+            EXPECT_EQ( *tree.insert( value ), value );
+            reference.insert( value );
+        }
+
+        if ( i % 1000 == 0 )
+        {
+            //a copy shares every node
+            const auto allocated = allocator.allocated();
+            snapshots.emplace_back( tree, reference );
+            EXPECT_EQ( allocator.allocated(), allocated );
+            EXPECT_TRUE( snapshots.back().first == tree );
+        }
+    }
+
+    EXPECT_TRUE( RedBlackTreeTest::isRedBlackTree( tree ) );
+    EXPECT_TRUE( std::equal( tree.begin(), tree.end(), reference.begin(), reference.end() ) );
+    EXPECT_TRUE( std::equal( tree.rbegin(), tree.rend(), reference.rbegin(), reference.rend() ) );
+
+    //later changes did not leak into any snapshot
+    for ( const auto& [snapshot, values] : snapshots )
+    {
+        EXPECT_TRUE( RedBlackTreeTest::isRedBlackTree( snapshot ) );
+        EXPECT_TRUE( std::equal( snapshot.begin(), snapshot.end(), values.begin(), values.end() ) );
+    }
+
+    //a write to a shared tree copies one path (at most 2 log n nodes) and the siblings recolored along it
+    auto copy = tree;
+    const auto allocated = allocator.allocated();
+    copy.insert( -1 );
+    EXPECT_LE( allocator.allocated() - allocated, 4 * 13 );
+    EXPECT_FALSE( tree.contains( -1 ) );
+    EXPECT_EQ( *copy.lower_bound( -5 ), -1 );
+    EXPECT_EQ( copy.upper_bound( 5000 ), copy.end() );
+
+    for ( const int value : reference )
+    {
+        copy.erase( value );
+    }
+    EXPECT_TRUE( RedBlackTreeTest::isRedBlackTree( copy ) );
+    EXPECT_EQ( copy.size(), 1 );
+    EXPECT_EQ( tree.size(), reference.size() );
+
+    snapshots.clear();
+    copy.clear();
+    tree.clear();
+    EXPECT_EQ( allocator.allocated(), 0 );
+}
+
+TEST( VersionedTreeTest, ConcurrentSnapshots )
+{
+    const int N = 20000;
+    VersionedRedBlackTree<int> tree;
+    std::atomic<bool> done{ false };
+
+    //values are written in increasing order, so every consistent version is 0, 1, ..., size - 1
+    const auto read = [&tree, &done]()
+    {
+        bool consistent = true;
+        std::size_t lastSize = 0;
+        while ( !done.load() )
+        {
+            const auto snapshot = tree.snapshot();
+            const auto size = snapshot.size();
+            consistent = consistent && size >= lastSize &&
+                ( size == 0 || ( *snapshot.begin() == 0 && *snapshot.rbegin() == static_cast<int>( size ) - 1 ) );
+            lastSize = size;
+        }
+        return consistent;
+    };
+
+    std::vector<std::future<bool>> readers;
+    for ( int i = 0; i < 4; ++i )
+    {
+        readers.push_back( std::async( std::launch::async, read ) );
+    }
+
+    for ( int i = 0; i < N; ++i )
+    {
+        EXPECT_TRUE( tree.insert( i ) );
+    }
+    EXPECT_FALSE( tree.insert( 0 ) );
+    done.store( true );
+
+    for ( auto& reader : readers )
+    {
+        EXPECT_TRUE( reader.get() );
+    }
+
+    const auto before = tree.snapshot();
+    tree.update( []( auto& writer )
+    {
+        for ( int i = 0; i < N; i += 2 )
+        {
+            writer.erase( i );
+        }
+    } );
+    EXPECT_TRUE( tree.erase( 1 ) );
+    EXPECT_FALSE( tree.erase( 1 ) );
+
+    const auto after = tree.snapshot();
+    EXPECT_EQ( before.size(), N );
+    EXPECT_TRUE( RedBlackTreeTest::isRedBlackTree( before ) );
+    EXPECT_EQ( after.size(), N / 2 - 1 );
+    EXPECT_TRUE( RedBlackTreeTest::isRedBlackTree( after ) );
+    EXPECT_EQ( *after.begin(), 3 );
+}
+
+
+TEST( ConcurrentTreeTest, TopDown )
+{
+    std::mt19937 generator( 42 );
+    std::uniform_int_distribution<int> distribution( 0, 2000 );
+
+    ConcurrentRedBlackTree<int> tree;
+    std::set<int> reference;
+    for ( int i = 0; i < 20000; ++i )
+    {
+        const int value = distribution( generator );
+        if ( i % 3 == 2 )
+        {
+            EXPECT_EQ( tree.erase( value ), reference.erase( value ) == 1 );
+        }
+        else
+        {
+            EXPECT_EQ( tree.insert( value ), reference.insert( value ).second );
+        }
+
+        if ( i % 1000 == 0 )
+        {
+            EXPECT_TRUE( RedBlackTreeTest::isRedBlackTree( tree ) );
+        }
+    }
+
+    EXPECT_TRUE( RedBlackTreeTest::isRedBlackTree( tree ) );
+    EXPECT_EQ( tree.size(), reference.size() );
+    for ( int value = 0; value <= 2000; ++value )
+    {
+        EXPECT_EQ( tree.contains( value ), reference.count( value ) == 1 );
+    }
+
+    for ( int value : reference )
+    {
+        EXPECT_TRUE( tree.erase( value ) );
+    }
+    EXPECT_TRUE( tree.empty() );
+    EXPECT_FALSE( tree.find( 0 ).has_value() );
+}
+
+
+TEST( ConcurrentTreeTest, ParallelWriters )
+{
+    const int threads = 8;
+    const int N = 4000;
+    ConcurrentRedBlackTree<int> tree;
+
+    //writers own interleaved values and erase the odd ones again while others still insert
+    std::vector<std::future<bool>> writers;
+    for ( int t = 0; t < threads; ++t )
+    {
+        writers.push_back( std::async( std::launch::async, [&tree, t]()
+        {
+            bool valid = true;
+            for ( int value = t; value < N; value += threads )
+            {
+                valid = tree.insert( value ) && valid;
+                valid = tree.find( value ) == value && valid;
+            }
+            for ( int value = t; value < N; value += threads )
+            {
+                if ( value % 2 == 1 )
+                {
+                    valid = tree.erase( value ) && !tree.contains( value ) && valid;
+                }
+            }
+            return valid;
+        } ) );
+    }
+    for ( auto& writer : writers )
+    {
+        EXPECT_TRUE( writer.get() );
+    }
+
+    EXPECT_TRUE( RedBlackTreeTest::isRedBlackTree( tree ) );
+    EXPECT_EQ( tree.size(), N / 2 );
+    for ( int value = 0; value < N; ++value )
+    {
+        EXPECT_EQ( tree.contains( value ), value % 2 == 0 );
+    }
+}
 
 TEST( MapTest, Basic )
 {
@@ -148,4 +1143,176 @@ TEST( MapTest, Basic )
 TEST( MapTest, Insert )
 {
     EXPECT_TRUE( MapTest::insertTest() );
-}
\ No newline at end of file
+}
+
+
+TEST( MapTest, PoolAllocator )
+{
+    EXPECT_TRUE( MapTest::poolAllocatorTest() );
+}
+
+
+TEST( MapTest, MoveInsert )
+{
+    EXPECT_TRUE( MapTest::moveInsertTest() );
+}
+
+
+TEST( MapTest, TryEmplace )
+{
+    EXPECT_TRUE( MapTest::tryEmplaceTest() );
+}
+
+
+TEST( MapTest, HeterogeneousLookup )
+{
+    EXPECT_TRUE( MapTest::heterogeneousLookupTest() );
+}
+
+
+TEST( MapTest, GetMany )
+{
+    EXPECT_TRUE( MapTest::getManyTest() );
+}
+
+
+TEST( MapTest, Reduce )
+{
+    EXPECT_TRUE( MapTest::reduceTest() );
+}
+
+
+TEST( MapTest, SetOperations )
+{
+    EXPECT_TRUE( MapTest::setOperationsTest() );
+}
+
+TEST( MapTest, ConcurrentMap )
+{
+    const int threads = 8;
+    const int N = 4000;
+    ConcurrentMap<int, int> map( 256 );
+
+    //writers own interleaved keys, so shards are split while all of them write
+    std::vector<std::future<void>> writers;
+    for ( int t = 0; t < threads; ++t )
+    {
+        writers.push_back( std::async( std::launch::async, [&map, t]()
+        {
+            for ( int key = t; key < N; key += threads )
+            {
+                map.insert( key, key );
+                map.modify( key, []( int& value )
+                {
+                    value *= 2;
+                } );
+            }
+        } ) );
+    }
+    for ( auto& writer : writers )
+    {
+        writer.get();
+    }
+
+    EXPECT_EQ( map.size(), N );
+    EXPECT_GT( map.shard_count(), 1u );
+    EXPECT_FALSE( map.insert( 7, 0 ) );
+    EXPECT_FALSE( map.insert_or_assign( 7, 7 ) );
+    EXPECT_EQ( map.find( 7 ), 7 );
+    EXPECT_EQ( map.find( 8 ), 16 );
+    EXPECT_FALSE( map.find( N ).has_value() );
+
+    int expected = 0;
+    bool ordered = true;
+    map.for_each( [&expected, &ordered]( const std::pair<const int, int>& entry )
+    {
+        ordered = ordered && entry.first == expected++;
+    } );
+    EXPECT_TRUE( ordered );
+    EXPECT_EQ( expected, N );
+
+    std::vector<int> range;
+    map.for_each_in_range( 100, 3000, [&range]( const std::pair<const int, int>& entry )
+    {
+        range.push_back( entry.first );
+    } );
+    EXPECT_EQ( range.size(), 2900u );
+    EXPECT_EQ( range.front(), 100 );
+    EXPECT_EQ( range.back(), 2999 );
+
+    //emptied shards are joined again
+    const auto shards = map.shard_count();
+    for ( int key = 0; key < N - 10; ++key )
+    {
+        EXPECT_EQ( map.erase( key ), 1u );
+    }
+    EXPECT_EQ( map.erase( 0 ), 0u );
+    EXPECT_EQ( map.size(), 10u );
+    EXPECT_LT( map.shard_count(), shards );
+    EXPECT_TRUE( map.contains( N - 1 ) );
+    EXPECT_FALSE( map.contains( 0 ) );
+
+    EXPECT_THROW( ( ConcurrentMap<int, int>( std::vector<int>{ 3, 1 } ) ), std::invalid_argument );
+}
+
+
+TEST( MapTest, ConcurrentMapBoundaries )
+{
+    //preset shards are never joined, however small
+    ConcurrentMap<int, int> preset( { 100, 200, 300 }, 1024 );
+    EXPECT_EQ( preset.shard_count(), 4u );
+    for ( int key : { 50, 150, 250, 350 } )
+    {
+        EXPECT_TRUE( preset.insert( key, key ) );
+    }
+    EXPECT_EQ( preset.shard_count(), 4u );
+    EXPECT_EQ( preset.erase( 150 ), 1u );
+    EXPECT_EQ( preset.shard_count(), 4u );
+
+    //a shard growing past the limit is split, and only the split is joined again
+    ConcurrentMap<int, int> splitting( { 100 }, 16 );
+    for ( int key = 0; key < 40; ++key )
+    {
+        splitting.insert( key, key );
+    }
+    EXPECT_GT( splitting.shard_count(), 2u );
+    for ( int key = 0; key < 40; ++key )
+    {
+        splitting.erase( key );
+    }
+    EXPECT_EQ( splitting.shard_count(), 2u );
+    EXPECT_TRUE( splitting.empty() );
+}
+
+
+TEST( MapTest, ConcurrentMapUndersizedShard )
+{
+    //shards of 0..31, 32..63 and 64..: the first one shrinks below a quarter but is too big to join its neighbour
+    ConcurrentMap<int, int> map( 64 );
+    for ( int key = 0; key < 100; ++key )
+    {
+        map.insert( key, key );
+    }
+    EXPECT_EQ( map.shard_count(), 3u );
+    for ( int key = 0; key < 17; ++key )
+    {
+        map.erase( key );
+    }
+    EXPECT_EQ( map.shard_count(), 3u );
+
+    //further writes to it must not take the routing table exclusively: one would wait for the scan holding it shared
+    std::future<std::size_t> writer;
+    bool writerDone = false;
+    map.for_each_in_range( 64, 65, [&map, &writer, &writerDone]( const std::pair<const int, int>& )
+    {
+        writer = std::async( std::launch::async, [&map]()
+        {
+            return map.erase( 17 );
+        } );
+        writerDone = writer.wait_for( std::chrono::seconds( 5 ) ) == std::future_status::ready;
+    } );
+    EXPECT_TRUE( writerDone );
+    EXPECT_EQ( writer.get(), 1u );
+    EXPECT_FALSE( map.contains( 17 ) );
+    EXPECT_EQ( map.shard_count(), 3u );
+}